@@ -0,0 +1,217 @@
+#include "callgraph.h"
+#include <iostream>
+#include <set>
+#include <utility>
+
+// a worklist instead of recursion, operator chains can be arbitrarily deep
+void collectCalls(const std::vector<std::unique_ptr<ASTNode>>& nodes,
+                  std::vector<const CallExprAST*>& out){
+    std::vector<const ASTNode*> stack;
+    auto pushAll = [&](const std::vector<std::unique_ptr<ASTNode>>& list){
+        for(auto& n : list)
+            stack.push_back(n.get());
+    };
+    pushAll(nodes);
+    while(!stack.empty()){
+        const ASTNode* node = stack.back();
+        stack.pop_back();
+        if(auto* n = dynamic_cast<const BinaryExprAST*>(node)){
+            stack.push_back(n->lhs.get());
+            stack.push_back(n->rhs.get());
+        }
+        else if(auto* n = dynamic_cast<const CallExprAST*>(node)){
+            out.push_back(n);
+            pushAll(n->Args);
+        }
+        else if(auto* n = dynamic_cast<const AssignExprAST*>(node)){
+            stack.push_back(n->Value.get());
+        }
+        else if(auto* n = dynamic_cast<const IfStmtAST*>(node)){
+            stack.push_back(n->Condition.get());
+            pushAll(n->Then);
+            pushAll(n->Else);
+        }
+        else if(auto* n = dynamic_cast<const CycleStmtAST*>(node)){
+            stack.push_back(n->Condition.get());
+            pushAll(n->Body);
+        }
+        else if(auto* n = dynamic_cast<const PCycleStmtAST*>(node)){
+            stack.push_back(n->Start.get());
+            stack.push_back(n->End.get());
+            pushAll(n->Body);
+        }
+    }
+}
+
+std::set<std::string> collectCallees(const FunctionAST& fn){
+    std::vector<const CallExprAST*> calls;
+    collectCalls(fn.Body, calls);
+    std::set<std::string> out;
+    for(const CallExprAST* call : calls)
+        out.insert(call->Callee);
+    return out;
+}
+
+static void where(const std::string& caller, unsigned line, const char* note = ""){
+    std::cerr << " (called from " << caller;
+    if(line) std::cerr << ", line " << line;
+    std::cerr << note << ")\n";
+}
+
+static void wrongArity(const std::string& callee, size_t given, size_t expected,
+                       const std::string& caller, unsigned line){
+    std::cerr << "Incorrect number of arguments to " << callee << ": "
+              << given << " given, " << expected << " expected";
+    where(caller, line);
+}
+
+bool CallGraph::build(const ProgramAST& program, const std::map<std::string, size_t>& earlier){
+    start(&earlier);
+    // externs are declared before any body is generated, so every function
+    // sees all of them
+    for(auto& ext : program.Externs)
+        addExtern(*ext);
+    for(auto& fn : program.Functions)
+        add(*fn);
+    bool ok = finish();
+    Earlier = nullptr;
+    return ok;
+}
+
+void CallGraph::start(const std::map<std::string, size_t>* earlier){
+    Callees.clear();
+    Self.clear();
+    Outside.clear();
+    Names.clear();
+    Arity.clear();
+    Index.clear();
+    Externs.clear();
+    Unresolved.clear();
+    Earlier = earlier;
+    Ok = true;
+}
+
+void CallGraph::addExtern(const PrototypeAST& proto){
+    Externs.emplace(proto.getName(), proto.Args.size());
+}
+
+bool CallGraph::add(const FunctionAST& fn, std::map<std::string, size_t>* callees){
+    size_t i = Callees.size();
+    const std::string& caller = fn.Proto->getName();
+    Callees.emplace_back();
+    Self.push_back(0);
+    Outside.push_back(0);
+    Names.push_back(caller);
+    Arity.push_back(fn.Proto->Args.size());
+    if(!Index.emplace(caller, i).second){
+        std::cerr << "Redefinition of function: " << caller << "\n";
+        Ok = false;
+    }
+
+    static const std::map<std::string, size_t> none;
+    const auto& earlier = Earlier ? *Earlier : none;
+    std::vector<const CallExprAST*> calls;
+    collectCalls(fn.Body, calls);
+    // one report per callee and caller is enough
+    std::set<std::string> reported;
+    std::set<size_t> edges;
+    bool ok = true;
+    for(const CallExprAST* call : calls){
+        size_t arity;
+        auto def = Index.find(call->Callee);
+        auto ext = Externs.find(call->Callee);
+        auto old = earlier.find(call->Callee);
+        // same lookup order as codegen: earlier modules and externs are
+        // declared before any body, definitions only above the caller
+        if(old != earlier.end()){
+            arity = old->second;
+            Outside[i] = 1;
+        }
+        else if(ext != Externs.end()){
+            arity = ext->second;
+            Outside[i] = 1;
+        }
+        else if(def != Index.end()){
+            arity = Arity[def->second];
+            if(def->second != i) edges.insert(def->second);
+            else Self[i] = 1;
+        }
+        else{
+            // an extern further down at best
+            Outside[i] = 1;
+            Unresolved.push_back({call->Callee, i, call->Args.size(), call->Loc.Line});
+            if(callees) callees->emplace(call->Callee, call->Args.size());
+            continue;
+        }
+        if(callees && call->Callee != caller) callees->emplace(call->Callee, arity);
+        if(call->Args.size() != arity){
+            if(reported.insert(call->Callee).second)
+                wrongArity(call->Callee, call->Args.size(), arity, caller, call->Loc.Line);
+            ok = false;
+        }
+    }
+    Callees[i].assign(edges.begin(), edges.end());
+    Ok = Ok && ok;
+    return ok;
+}
+
+bool CallGraph::finish(){
+    std::set<std::pair<size_t, std::string>> reported;
+    for(const Pending& p : Unresolved){
+        if(!reported.insert({p.From, p.Callee}).second) continue;
+        auto ext = Externs.find(p.Callee);
+        if(ext != Externs.end()){
+            if(p.Args != ext->second){
+                wrongArity(p.Callee, p.Args, ext->second, Names[p.From], p.Line);
+                Ok = false;
+            }
+            continue;
+        }
+        std::cerr << "Unknown function: " << p.Callee;
+        where(Names[p.From], p.Line, Index.count(p.Callee) ? "; it is only defined below" : "");
+        Ok = false;
+    }
+    Unresolved.clear();
+    return Ok;
+}
+
+bool CallGraph::bottomUp(const std::vector<std::string>& roots, std::vector<size_t>& order) const {
+    std::vector<size_t> start;
+    for(auto& name : roots){
+        auto it = Index.find(name);
+        if(it == Index.end()){
+            std::cerr << "Unknown entry function: " << name << "\n";
+            return false;
+        }
+        start.push_back(it->second);
+    }
+    if(roots.empty())
+        for(size_t i = 0; i < Callees.size(); i++)
+            start.push_back(i);
+
+    // iterative post-order DFS: a function goes out once all its callees
+    // have. Calls only go upwards, so there are no cycles to break besides
+    // self-calls, which aren't edges.
+    order.clear();
+    std::vector<char> seen(Callees.size(), 0);
+    std::vector<std::pair<size_t, size_t>> stack; // function, next callee
+    for(size_t root : start){
+        if(seen[root]) continue;
+        seen[root] = 1;
+        stack.push_back({root, 0});
+        while(!stack.empty()){
+            auto& [fn, next] = stack.back();
+            if(next < Callees[fn].size()){
+                size_t callee = Callees[fn][next++];
+                if(!seen[callee]){
+                    seen[callee] = 1;
+                    stack.push_back({callee, 0});
+                }
+                continue;
+            }
+            order.push_back(fn);
+            stack.pop_back();
+        }
+    }
+    return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../parser/parser.h"
+
+// every call in nodes (a function's body, say), in no particular order
+void collectCalls(const std::vector<std::unique_ptr<ASTNode>>& nodes,
+                  std::vector<const CallExprAST*>& out);
+// names called anywhere in fn's body
+std::set<std::string> collectCallees(const FunctionAST& fn);
+
+// Whole program call graph, from the CallExprAST nodes of every function.
+// A call resolves the way codegen resolves it: to an extern, to a function
+// defined above the caller (or the caller itself), or to a function
+// compiled before (earlier Session::compile()s). Everything else is
+// reported here, before any IR exists.
+class CallGraph {
+public:
+    // false (and reports every problem to stderr) if a call has no callee
+    // it could resolve to or passes the wrong number of arguments, or a
+    // function is defined twice. earlier: name -> parameter count.
+    bool build(const ProgramAST& program,
+               const std::map<std::string, size_t>& earlier = {});
+
+    // the same one definition at a time, for a parser that hands them out
+    // as they close (see pipeline/): addExtern() / add() in source order,
+    // then finish(). A call to a name that isn't known yet may still be an
+    // extern further down, so those are only reported by finish(). earlier
+    // has to outlive the graph. add() fills callees (if given) with what fn
+    // calls besides itself and the number of arguments each takes.
+    void start(const std::map<std::string, size_t>* earlier = nullptr);
+    void addExtern(const PrototypeAST& proto);
+    bool add(const FunctionAST& fn, std::map<std::string, size_t>* callees = nullptr);
+    bool finish();
+
+    // indexes into program.Functions of everything reachable from roots,
+    // callees before their callers, so codegen and the inliner find every
+    // callee finished. No roots means every function, in source order
+    // (which already is callees first). false (and reports) if a root
+    // isn't defined in the program.
+    bool bottomUp(const std::vector<std::string>& roots, std::vector<size_t>& order) const;
+
+    size_t size() const { return Callees.size(); }
+    // function i of the program (see purity.h): its name, the functions of
+    // this program it calls, whether it calls itself, and whether it calls
+    // anything whose body isn't here: an extern, a function of an earlier
+    // compile() or a name that doesn't resolve. Calls only go upwards, so
+    // every callee has a smaller index than its caller.
+    const std::string& name(size_t i) const { return Names[i]; }
+    const std::vector<size_t>& callees(size_t i) const { return Callees[i]; }
+    bool callsItself(size_t i) const { return Self[i]; }
+    bool callsOutside(size_t i) const { return Outside[i]; }
+
+private:
+    // a call nothing above resolved, checked again once every extern is in
+    struct Pending {
+        std::string Callee;
+        size_t From;       // calling function
+        size_t Args;
+        unsigned Line;
+    };
+
+    // per function, the functions of this program it calls (not itself)
+    std::vector<std::vector<size_t>> Callees;
+    std::vector<char> Self, Outside;
+    std::vector<std::string> Names;
+    std::vector<size_t> Arity;
+    std::map<std::string, size_t> Index;
+    std::map<std::string, size_t> Externs;
+    const std::map<std::string, size_t>* Earlier = nullptr;
+    std::vector<Pending> Unresolved;
+    bool Ok = true;
+};
@@ -0,0 +1,449 @@
+#include "consteval.h"
+#include "purity.h"
+#include <cstring>
+#include <limits>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+// The evaluator runs a function the way its generated code does:
+//  - everything is a double, < and > give 1 or 0, and a condition holds
+//    when it is ordered and non zero (NaN is false, like fcmp one)
+//  - a block is worth its last statement, an empty one 0; an if is worth
+//    the arm that ran, a cycle 0 and an assignment the value assigned
+//  - a call only sees the functions defined above it, and itself
+// A function codegen would reject, or whose IR would be undefined, is not
+// run at all: reading a variable no assignment before it declares, calling
+// something not visible from it or with the wrong number of arguments.
+// Reading a declared variable that wasn't assigned yet on this path stops
+// the evaluation too. pcycle isn't run either: its reductions are combined
+// in whatever order the threads finish, the bits needn't match ours.
+
+namespace {
+
+const unsigned MaxDepth = 512;   // calls being evaluated inside each other
+
+struct FunctionInfo;
+
+// Bodies are compiled once into a flat list of these for a value stack, so
+// running a loop costs a switch per step rather than a dynamic_cast chain
+// per AST node, and allocates nothing.
+enum class Op : uint8_t {
+    Const,      // push Value
+    Load,       // push variable A, fails if it wasn't assigned on this path
+    Store,      // variable A = top, which stays (an assignment's value)
+    Binary,     // replace the top two with Bin of them
+    Call,       // replace Fn's arguments with its result
+    Jump,       // to A
+    JumpIfNot,  // pop, to A if it doesn't hold
+    Pop
+};
+
+struct Instr {
+    Op Code;
+    uint32_t A = 0;
+    char Bin = 0;
+    double Value = 0;
+    const FunctionInfo* Fn = nullptr;
+};
+
+struct FunctionInfo {
+    FunctionAST* Fn = nullptr;
+    size_t Index = 0;        // position in the program
+    bool Evaluable = false;
+    std::vector<Instr> Code;
+    unsigned Params = 0;
+    unsigned Slots = 0;      // variables, parameters first
+};
+
+enum class Outcome { Ok, Failed, OutOfSteps };
+
+// a call and its arguments, as bits so NaN arguments compare equal
+using Key = std::pair<const FunctionInfo*, std::vector<uint64_t>>;
+
+bool truthy(double v){
+    return v < 0 || v > 0;
+}
+
+// a NaN made here comes out as LLVM's constant folder makes it (positive),
+// not as the FPU does, the IR would get it from the folder after inlining.
+// f32 rounds the exact double result to float, which for + - * / is the
+// same as doing the operation in float.
+double arith(double v, bool f32){
+    if(f32) v = (float)v;
+    return v != v ? std::numeric_limits<double>::quiet_NaN() : v;
+}
+
+bool binary(char op, double L, double R, bool f32, double& out){
+    switch(op){
+        case '+': out = arith(L + R, f32); return true;
+        case '-': out = arith(L - R, f32); return true;
+        case '*': out = arith(L * R, f32); return true;
+        case '/': out = arith(L / R, f32); return true;
+        case '<': out = L < R ? 1.0 : 0.0; return true;
+        case '>': out = L > R ? 1.0 : 0.0; return true;
+        default:  return false;
+    }
+}
+
+class Evaluator {
+public:
+    Evaluator(ProgramAST& program, const CallGraph& graph, uint64_t budget, bool f32);
+
+    // value of call site n in function number from
+    Outcome site(CallExprAST* n, size_t from, double& out);
+
+private:
+    // what is being compiled: a body, or a call site (no Vars, variables
+    // aren't constant)
+    struct Scope {
+        size_t From;
+        std::map<std::string, unsigned>* Vars;
+        unsigned& Slots;
+        std::vector<Instr>& Code;
+    };
+
+    // what n calls if codegen of function number from would find it and
+    // the argument count is right, else null
+    const FunctionInfo* callee(const CallExprAST* n, size_t from) const;
+    // false if the code can't be run, see the top of the file
+    bool compile(FunctionInfo& info);
+    bool compileBlock(const std::vector<std::unique_ptr<ASTNode>>& stmts, Scope& s);
+    bool compileStatement(ASTNode* node, Scope& s);
+    bool compileExpr(ASTNode* root, Scope& s);
+
+    // runs code with its variables from Locals[base] on, leaves Stack as
+    // it found it
+    Outcome run(const std::vector<Instr>& code, size_t base, double& out);
+    // fn with its arguments taken off the top of Stack
+    Outcome call(const FunctionInfo& fn, double& out);
+
+    std::unordered_map<std::string, FunctionInfo> Functions;
+    // results of every call evaluated so far, for any site: a pure function
+    // gives the same for the same arguments (fib's recursion only runs once
+    // per n). Calls that didn't work out aren't tried again.
+    std::map<Key, double> Results;
+    std::map<Key, Outcome> Failures;
+    Key Probe;               // the call being looked up, reused
+    bool F32;                // numbers are floats (FPOptions::F32)
+    // left for the whole program: once a site has used them up the rest
+    // give up at their first step
+    uint64_t Steps;
+    unsigned Depth = 0;
+    // shared by every call being evaluated, each one's part starts where
+    // its caller's ends
+    std::vector<double> Stack, Locals;
+    std::vector<char> Set;   // assigned on this path yet
+    std::vector<Instr> SiteCode;
+};
+
+Evaluator::Evaluator(ProgramAST& program, const CallGraph& graph, uint64_t budget, bool f32)
+    : F32(f32), Steps(budget){
+    std::set<std::string> pure = findPureFunctions(graph);
+    std::set<std::string> externs;
+    for(auto& ext : program.Externs)
+        externs.insert(ext->getName());
+    std::map<std::string, size_t> defs;
+    for(auto& fn : program.Functions)
+        defs[fn->Proto->getName()]++;
+
+    // a name defined twice, or also declared extern, isn't one function
+    for(size_t i = 0; i < program.Functions.size(); i++){
+        const std::string& name = program.Functions[i]->Proto->getName();
+        if(defs[name] != 1 || externs.count(name) || !pure.count(name)) continue;
+        FunctionInfo& info = Functions[name];
+        info.Fn = program.Functions[i].get();
+        info.Index = i;
+    }
+    // Call instructions point at the callee's entry, which is compiled (or
+    // found not evaluable) by the time anything runs
+    for(auto& [name, info] : Functions)
+        info.Evaluable = compile(info);
+}
+
+const FunctionInfo* Evaluator::callee(const CallExprAST* n, size_t from) const {
+    auto it = Functions.find(n->Callee);
+    if(it == Functions.end() || it->second.Index > from
+       || it->second.Fn->Proto->Args.size() != n->Args.size())
+        return nullptr;
+    return &it->second;
+}
+
+// variables get their slots in codegen order, an assignment declares its
+// name where codegen creates the alloca
+bool Evaluator::compile(FunctionInfo& info){
+    std::map<std::string, unsigned> declared;
+    for(auto& arg : info.Fn->Proto->Args)
+        if(!declared.emplace(arg, info.Slots++).second)
+            return false;
+    info.Params = info.Slots;
+    Scope s{info.Index, &declared, info.Slots, info.Code};
+    return compileBlock(info.Fn->Body, s);
+}
+
+// worth its last statement, an empty block 0
+bool Evaluator::compileBlock(const std::vector<std::unique_ptr<ASTNode>>& stmts, Scope& s){
+    if(stmts.empty()){
+        s.Code.push_back({Op::Const});
+        return true;
+    }
+    for(size_t i = 0; i < stmts.size(); i++){
+        if(!compileExpr(stmts[i].get(), s)) return false;
+        if(i + 1 < stmts.size())
+            s.Code.push_back({Op::Pop});
+    }
+    return true;
+}
+
+// recursion is fine here, blocks don't nest deeper than the parser's
+// MaxBlockNesting
+bool Evaluator::compileStatement(ASTNode* node, Scope& s){
+    if(!s.Vars) return false;
+    if(auto* n = dynamic_cast<AssignExprAST*>(node)){
+        if(!compileExpr(n->Value.get(), s)) return false;
+        auto it = s.Vars->emplace(n->Name, s.Slots).first;
+        if(it->second == s.Slots) s.Slots++;
+        s.Code.push_back({Op::Store, it->second});
+        return true;
+    }
+    if(auto* n = dynamic_cast<IfStmtAST*>(node)){
+        if(!compileExpr(n->Condition.get(), s)) return false;
+        size_t toElse = s.Code.size();
+        s.Code.push_back({Op::JumpIfNot});
+        if(!compileBlock(n->Then, s)) return false;
+        size_t toEnd = s.Code.size();
+        s.Code.push_back({Op::Jump});
+        s.Code[toElse].A = (uint32_t)s.Code.size();
+        if(!compileBlock(n->Else, s)) return false;
+        s.Code[toEnd].A = (uint32_t)s.Code.size();
+        return true;
+    }
+    if(auto* n = dynamic_cast<CycleStmtAST*>(node)){
+        uint32_t top = (uint32_t)s.Code.size();
+        if(!compileExpr(n->Condition.get(), s)) return false;
+        size_t toEnd = s.Code.size();
+        s.Code.push_back({Op::JumpIfNot});
+        for(auto& stmt : n->Body){
+            if(!compileExpr(stmt.get(), s)) return false;
+            s.Code.push_back({Op::Pop});
+        }
+        s.Code.push_back({Op::Jump, top});
+        s.Code[toEnd].A = (uint32_t)s.Code.size();
+        s.Code.push_back({Op::Const});
+        return true;
+    }
+    return false;   // pcycle
+}
+
+// operators and calls from an explicit stack, as in CodeGen::codegenExpr:
+// operator chains can be arbitrarily deep
+bool Evaluator::compileExpr(ASTNode* root, Scope& s){
+    struct Pending {
+        ASTNode* node;
+        size_t done;   // children compiled
+    };
+    std::vector<Pending> work{{root, 0}};
+
+    while(!work.empty()){
+        Pending p = work.back();
+        if(auto* n = dynamic_cast<NumberExprAST*>(p.node)){
+            s.Code.push_back({Op::Const, 0, 0, F32 ? (float)n->value : n->value});
+        }
+        else if(auto* n = dynamic_cast<VariableExprAST*>(p.node)){
+            if(!s.Vars) return false;
+            auto it = s.Vars->find(n->name);
+            if(it == s.Vars->end()) return false;
+            s.Code.push_back({Op::Load, it->second});
+        }
+        else if(auto* n = dynamic_cast<BinaryExprAST*>(p.node)){
+            if(p.done < 2){
+                work.back().done++;
+                work.push_back({p.done == 0 ? n->lhs.get() : n->rhs.get(), 0});
+                continue;
+            }
+            s.Code.push_back({Op::Binary, 0, n->op});
+        }
+        else if(auto* n = dynamic_cast<CallExprAST*>(p.node)){
+            const FunctionInfo* fn = callee(n, s.From);
+            if(!fn) return false;
+            if(p.done < n->Args.size()){
+                work.back().done++;
+                work.push_back({n->Args[p.done].get(), 0});
+                continue;
+            }
+            s.Code.push_back({Op::Call, 0, 0, 0, fn});
+        }
+        else if(!compileStatement(p.node, s))
+            return false;
+        work.pop_back();
+    }
+    return true;
+}
+
+Outcome Evaluator::site(CallExprAST* n, size_t from, double& out){
+    const FunctionInfo* fn = callee(n, from);
+    if(!fn || !fn->Evaluable) return Outcome::Failed;
+    // the arguments are constant if they compile without variables
+    unsigned slots = 0;
+    SiteCode.clear();
+    Scope s{from, nullptr, slots, SiteCode};
+    if(!compileExpr(n, s)) return Outcome::Failed;
+    Depth = 0;
+    return run(SiteCode, Locals.size(), out);
+}
+
+Outcome Evaluator::call(const FunctionInfo& fn, double& out){
+    size_t argc = fn.Params;
+    Probe.first = &fn;
+    Probe.second.resize(argc);
+    std::memcpy(Probe.second.data(), Stack.data() + Stack.size() - argc, argc * sizeof(double));
+    Stack.resize(Stack.size() - argc);
+    if(!fn.Evaluable) return Outcome::Failed;
+    if(auto it = Results.find(Probe); it != Results.end()){
+        out = it->second;
+        return Outcome::Ok;
+    }
+    if(auto it = Failures.find(Probe); it != Failures.end())
+        return it->second;
+    if(Depth == MaxDepth) return Outcome::OutOfSteps;
+
+    // Probe gets reused by the calls inside this one
+    Key key = Probe;
+    size_t base = Locals.size();
+    Locals.resize(base + fn.Slots);
+    Set.resize(base + fn.Slots);
+    std::memcpy(Locals.data() + base, key.second.data(), argc * sizeof(double));
+    std::memset(Set.data() + base, 1, argc);
+    Depth++;
+    Outcome r = run(fn.Code, base, out);
+    Depth--;
+    Locals.resize(base);
+    Set.resize(base);
+    // running out of steps deeper down says nothing about this call on
+    // its own, at the site itself it would only run out again
+    if(r == Outcome::Ok)
+        Results.emplace(std::move(key), out);
+    else if(r == Outcome::Failed || Depth == 0)
+        Failures.emplace(std::move(key), r);
+    return r;
+}
+
+Outcome Evaluator::run(const std::vector<Instr>& code, size_t base, double& out){
+    size_t height = Stack.size();
+    Outcome r = Outcome::Ok;
+    for(size_t pc = 0; pc < code.size() && r == Outcome::Ok; ){
+        if(Steps == 0){
+            r = Outcome::OutOfSteps;
+            break;
+        }
+        Steps--;
+        const Instr& in = code[pc++];
+        switch(in.Code){
+            case Op::Const:
+                Stack.push_back(in.Value);
+                break;
+            case Op::Load:
+                if(!Set[base + in.A]) r = Outcome::Failed;
+                else Stack.push_back(Locals[base + in.A]);
+                break;
+            case Op::Store:
+                Locals[base + in.A] = Stack.back();
+                Set[base + in.A] = 1;
+                break;
+            case Op::Binary: {
+                double R = Stack.back();
+                Stack.pop_back();
+                if(!binary(in.Bin, Stack.back(), R, F32, Stack.back())) r = Outcome::Failed;
+                break;
+            }
+            case Op::Call: {
+                double v;
+                r = call(*in.Fn, v);
+                if(r == Outcome::Ok) Stack.push_back(v);
+                break;
+            }
+            case Op::Jump:
+                pc = in.A;
+                break;
+            case Op::JumpIfNot:
+                if(!truthy(Stack.back())) pc = in.A;
+                Stack.pop_back();
+                break;
+            case Op::Pop:
+                Stack.pop_back();
+                break;
+        }
+    }
+    if(r == Outcome::Ok) out = Stack.back();
+    Stack.resize(height);
+    return r;
+}
+
+} // namespace
+
+FoldStats foldConstantCalls(ProgramAST& program, const CallGraph& graph,
+                            uint64_t budget, bool f32){
+    FoldStats stats;
+    if(budget == 0) return stats;
+    Evaluator ev(program, graph, budget, f32);
+
+    for(size_t i = 0; i < program.Functions.size(); i++){
+        // post order, a call's arguments are folded before the call
+        struct Visit {
+            std::unique_ptr<ASTNode>* slot;
+            bool expanded;
+        };
+        std::vector<Visit> stack;
+        auto pushAll = [&](std::vector<std::unique_ptr<ASTNode>>& list){
+            for(auto it = list.rbegin(); it != list.rend(); ++it)
+                stack.push_back({&*it, false});
+        };
+        pushAll(program.Functions[i]->Body);
+        while(!stack.empty()){
+            std::unique_ptr<ASTNode>* slot = stack.back().slot;
+            if(!stack.back().expanded){
+                stack.back().expanded = true;
+                ASTNode* node = slot->get();
+                if(auto* n = dynamic_cast<BinaryExprAST*>(node)){
+                    stack.push_back({&n->rhs, false});
+                    stack.push_back({&n->lhs, false});
+                }
+                else if(auto* n = dynamic_cast<CallExprAST*>(node))
+                    pushAll(n->Args);
+                else if(auto* n = dynamic_cast<AssignExprAST*>(node))
+                    stack.push_back({&n->Value, false});
+                else if(auto* n = dynamic_cast<IfStmtAST*>(node)){
+                    pushAll(n->Else);
+                    pushAll(n->Then);
+                    stack.push_back({&n->Condition, false});
+                }
+                else if(auto* n = dynamic_cast<CycleStmtAST*>(node)){
+                    pushAll(n->Body);
+                    stack.push_back({&n->Condition, false});
+                }
+                else if(auto* n = dynamic_cast<PCycleStmtAST*>(node)){
+                    pushAll(n->Body);
+                    stack.push_back({&n->End, false});
+                    stack.push_back({&n->Start, false});
+                }
+                continue;
+            }
+            stack.pop_back();
+
+            auto* call = dynamic_cast<CallExprAST*>(slot->get());
+            if(!call) continue;
+            double value;
+            Outcome r = ev.site(call, i, value);
+            if(r == Outcome::Ok){
+                auto number = std::make_unique<NumberExprAST>(value);
+                number->Loc = call->Loc;
+                *slot = std::move(number);
+                stats.Folded++;
+            }
+            else if(r == Outcome::OutOfSteps)
+                stats.OutOfSteps++;
+        }
+    }
+    return stats;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "callgraph.h"
+
+// Compile-time evaluation of calls with constant arguments.
+// A call to a pure function (see purity.h) whose arguments are all
+// constant always gives the same number, so it can be run right here on
+// the AST and the call replaced by its result: max(10, 20) reaches codegen
+// as 20. Loops and recursion are run as well, but all the call sites of a
+// program together only get Budget steps (instructions of the compiled
+// bodies, about one per AST node), so a compile never spends more than that
+// however many sites don't terminate. A site that runs out, or whose code
+// the generated IR would run differently (see consteval.cpp), is left as
+// it was.
+
+constexpr uint64_t DefaultFoldBudget = 1 << 20;
+
+struct FoldStats {
+    size_t Folded = 0;      // call sites replaced with a number
+    size_t OutOfSteps = 0;  // constant call sites the budget ran out on
+};
+
+// folds every call site in program that it can, in place. graph has to be
+// built from program (and not have failed); after folding it is out of
+// date wherever a call went. f32: the program is compiled with
+// FPOptions::F32, every number and result rounds to float
+FoldStats foldConstantCalls(ProgramAST& program, const CallGraph& graph,
+                            uint64_t budget = DefaultFoldBudget, bool f32 = false);
@@ -0,0 +1,23 @@
+#include "purity.h"
+#include <vector>
+
+std::set<std::string> findPureFunctions(const CallGraph& graph){
+    // callees come before their callers, so every callee is decided by the
+    // time its caller is; externs and unknown names are never pure
+    std::vector<char> pure(graph.size());
+    std::set<std::string> out;
+    for(size_t i = 0; i < graph.size(); i++){
+        pure[i] = !graph.callsOutside(i);
+        for(size_t callee : graph.callees(i))
+            pure[i] = pure[i] && pure[callee];
+        if(pure[i]) out.insert(graph.name(i));
+    }
+    return out;
+}
+
+std::set<std::string> findRecursiveFunctions(const CallGraph& graph){
+    std::set<std::string> out;
+    for(size_t i = 0; i < graph.size(); i++)
+        if(graph.callsItself(i)) out.insert(graph.name(i));
+    return out;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <set>
+#include <string>
+#include "callgraph.h"
+
+// Purity / recursion facts about a program, from its call graph.
+// A Paradox function can only touch its own locals, so it is pure unless it
+// (transitively) calls something whose body we don't have: an extern or an
+// unknown name. Pure functions always give the same result for the same
+// arguments, which is what --memoize relies on.
+
+std::set<std::string> findPureFunctions(const CallGraph& graph);
+
+// functions that can reach themselves through calls. A call only sees the
+// functions above it, so that is the ones calling themselves.
+std::set<std::string> findRecursiveFunctions(const CallGraph& graph);
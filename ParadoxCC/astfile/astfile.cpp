@@ -0,0 +1,487 @@
+#include "astfile.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// flattens the AST bottom up, so every child index is smaller than its
+// parent's index. the reader relies on that to reject cyclic files.
+class ASTWriter {
+public:
+    std::vector<ASTNodeRecord> nodes;
+    std::vector<uint32_t> lists;
+    std::vector<char> strings;
+    std::unordered_map<std::string, uint32_t> interned;
+    bool failed = false;
+
+    uint32_t intern(const std::string& s) {
+        auto it = interned.find(s);
+        if (it != interned.end()) return it->second;
+        uint32_t off = strings.size();
+        uint32_t len = s.size();
+        const char* lenBytes = reinterpret_cast<const char*>(&len);
+        strings.insert(strings.end(), lenBytes, lenBytes + sizeof(len));
+        strings.insert(strings.end(), s.begin(), s.end());
+        interned.emplace(s, off);
+        return off;
+    }
+
+    uint32_t addNode(ASTNodeKind kind, char op, uint32_t a, uint32_t b,
+                     uint32_t c, double value) {
+        ASTNodeRecord rec{};
+        rec.kind = kind;
+        rec.op = op;
+        rec.a = a;
+        rec.b = b;
+        rec.c = c;
+        rec.value = value;
+        nodes.push_back(rec);
+        return nodes.size() - 1;
+    }
+
+    uint32_t addList(const std::vector<uint32_t>& items) {
+        uint32_t off = lists.size();
+        lists.push_back(items.size());
+        lists.insert(lists.end(), items.begin(), items.end());
+        return off;
+    }
+
+    uint32_t addBlock(const std::vector<std::unique_ptr<ASTNode>>& stmts) {
+        std::vector<uint32_t> items;
+        for (auto& s : stmts)
+            items.push_back(write(s.get()));
+        return addList(items);
+    }
+
+    uint32_t write(ASTNode* node) {
+        if (auto* n = dynamic_cast<NumberExprAST*>(node))
+            return addNode(ASTNodeKind::Number, 0, 0, 0, 0, n->value);
+        if (auto* n = dynamic_cast<VariableExprAST*>(node))
+            return addNode(ASTNodeKind::Variable, 0, intern(n->name), 0, 0, 0);
+        if (auto* n = dynamic_cast<BinaryExprAST*>(node)) {
+            // the left spine of a + b + c + ... with a loop, it can be
+            // arbitrarily long
+            std::vector<BinaryExprAST*> spine{n};
+            while (auto* l = dynamic_cast<BinaryExprAST*>(spine.back()->lhs.get()))
+                spine.push_back(l);
+            uint32_t l = write(spine.back()->lhs.get());
+            for (auto it = spine.rbegin(); it != spine.rend(); ++it) {
+                uint32_t r = write((*it)->rhs.get());
+                l = addNode(ASTNodeKind::Binary, (*it)->op, l, r, 0, 0);
+            }
+            return l;
+        }
+        if (auto* n = dynamic_cast<CallExprAST*>(node)) {
+            uint32_t args = addBlock(n->Args);
+            return addNode(ASTNodeKind::Call, 0, intern(n->Callee), args, 0, 0);
+        }
+        if (auto* n = dynamic_cast<AssignExprAST*>(node)) {
+            uint32_t v = write(n->Value.get());
+            return addNode(ASTNodeKind::Assign, 0, intern(n->Name), v, 0, 0);
+        }
+        if (auto* n = dynamic_cast<IfStmtAST*>(node)) {
+            uint32_t cond = write(n->Condition.get());
+            uint32_t thenL = addBlock(n->Then);
+            uint32_t elseL = addBlock(n->Else);
+            return addNode(ASTNodeKind::If, 0, cond, thenL, elseL, 0);
+        }
+        if (auto* n = dynamic_cast<CycleStmtAST*>(node)) {
+            uint32_t cond = write(n->Condition.get());
+            uint32_t body = addBlock(n->Body);
+            return addNode(ASTNodeKind::Cycle, 0, cond, body, 0, 0);
+        }
+        if (auto* n = dynamic_cast<PCycleStmtAST*>(node)) {
+            std::vector<uint32_t> names{intern(n->Var)};
+            for (auto& [op, name] : n->Reductions)
+                names.push_back(intern(std::string(1, op) + name));
+            uint32_t nameL = addList(names);
+            uint32_t start = write(n->Start.get());
+            uint32_t end = write(n->End.get());
+            uint32_t bounds = addList({start, end});
+            uint32_t body = addBlock(n->Body);
+            return addNode(ASTNodeKind::PCycle, 0, nameL, bounds, body, 0);
+        }
+        std::cerr << "Cannot serialize unknown AST node\n";
+        failed = true;
+        return 0;
+    }
+
+    uint32_t writePrototype(PrototypeAST* proto) {
+        std::vector<uint32_t> params;
+        for (auto& p : proto->Args)
+            params.push_back(intern(p));
+        return addNode(ASTNodeKind::Prototype, 0, intern(proto->Name),
+                       addList(params), 0, 0);
+    }
+
+    uint32_t writeFunction(FunctionAST* fn) {
+        uint32_t proto = writePrototype(fn->Proto.get());
+        uint32_t body = addBlock(fn->Body);
+        return addNode(ASTNodeKind::Function, 0, proto, body, 0, 0);
+    }
+};
+
+// a child of a statement/expression: must come earlier in the file and
+// can never be a prototype or a function
+// a parser with default limits stays far below this (blocks and expression
+// groups both add levels)
+constexpr uint32_t MaxFileNesting = 4 * DefaultMaxNesting;
+
+bool isNode(const ASTFileView& view, uint32_t idx, uint32_t parent) {
+    if (idx >= parent || idx >= view.nodeCount()) return false;
+    ASTNodeKind k = view.node(idx).kind;
+    return k != ASTNodeKind::Prototype && k != ASTNodeKind::Function;
+}
+
+} // namespace
+
+bool writeASTFile(const ProgramAST& program, const std::string& path) {
+    ASTWriter w;
+    std::vector<uint32_t> fns;
+    for (auto& ext : program.Externs)
+        fns.push_back(w.writePrototype(ext.get()));
+    for (auto& fn : program.Functions)
+        fns.push_back(w.writeFunction(fn.get()));
+    uint32_t fnList = w.addList(fns);
+    if (w.failed) return false;
+
+    ASTFileHeader hdr{};
+    std::memcpy(hdr.magic, "PXAS", 4);
+    hdr.version = ASTFileVersion;
+    hdr.nodeCount = w.nodes.size();
+    hdr.listWords = w.lists.size();
+    hdr.stringBytes = w.strings.size();
+    hdr.functions = fnList;
+    hdr.nodesOffset = sizeof(ASTFileHeader);
+    hdr.listsOffset = hdr.nodesOffset + w.nodes.size() * sizeof(ASTNodeRecord);
+    hdr.stringsOffset = hdr.listsOffset + w.lists.size() * sizeof(uint32_t);
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        std::cerr << "Cannot open " << path << " for writing\n";
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    out.write(reinterpret_cast<const char*>(w.nodes.data()),
+              w.nodes.size() * sizeof(ASTNodeRecord));
+    out.write(reinterpret_cast<const char*>(w.lists.data()),
+              w.lists.size() * sizeof(uint32_t));
+    out.write(w.strings.data(), w.strings.size());
+    if (!out) {
+        std::cerr << "Failed writing " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+ASTFileView::~ASTFileView() {
+    if (Data) munmap(const_cast<unsigned char*>(Data), Size);
+}
+
+bool ASTFileView::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Cannot open " << path << "\n";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ASTFileHeader)) {
+        std::cerr << path << " is not an AST file\n";
+        close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "Cannot map " << path << "\n";
+        return false;
+    }
+    Data = static_cast<const unsigned char*>(p);
+    Size = st.st_size;
+    Header = reinterpret_cast<const ASTFileHeader*>(Data);
+
+    if (std::memcmp(Header->magic, "PXAS", 4) != 0
+        || Header->version != ASTFileVersion) {
+        std::cerr << path << " is not a version " << ASTFileVersion
+                  << " AST file\n";
+        return false;
+    }
+    // the offsets come from the file: each one is checked on its own and
+    // the length against what is left after it, offset + length could wrap.
+    // validate() counts on every section being inside the file, after the
+    // header and clear of the others.
+    struct Section {
+        uint64_t offset, bytes;
+    };
+    const Section sections[] = {
+        {Header->nodesOffset, (uint64_t)Header->nodeCount * sizeof(ASTNodeRecord)},
+        {Header->listsOffset, (uint64_t)Header->listWords * sizeof(uint32_t)},
+        {Header->stringsOffset, Header->stringBytes},
+    };
+    bool ok = Header->nodesOffset % alignof(ASTNodeRecord) == 0
+           && Header->listsOffset % alignof(uint32_t) == 0;
+    for (const Section& s : sections)
+        ok = ok && s.offset >= sizeof(ASTFileHeader) && s.offset <= Size
+                && s.bytes <= Size - s.offset;
+    for (size_t i = 0; ok && i < 3; i++)
+        for (size_t j = i + 1; ok && j < 3; j++)
+            ok = sections[i].offset + sections[i].bytes <= sections[j].offset
+              || sections[j].offset + sections[j].bytes <= sections[i].offset;
+    if (!ok) {
+        std::cerr << path << ": truncated or corrupt AST file\n";
+        return false;
+    }
+    return true;
+}
+
+const ASTNodeRecord& ASTFileView::node(uint32_t idx) const {
+    auto* nodes = reinterpret_cast<const ASTNodeRecord*>(Data + Header->nodesOffset);
+    return nodes[idx];
+}
+
+std::string_view ASTFileView::str(uint32_t offset) const {
+    const unsigned char* p = Data + Header->stringsOffset + offset;
+    uint32_t len;
+    std::memcpy(&len, p, sizeof(len));
+    return std::string_view(reinterpret_cast<const char*>(p + sizeof(len)), len);
+}
+
+uint32_t ASTFileView::listSize(uint32_t offset) const {
+    auto* words = reinterpret_cast<const uint32_t*>(Data + Header->listsOffset);
+    return words[offset];
+}
+
+uint32_t ASTFileView::listAt(uint32_t offset, uint32_t i) const {
+    auto* words = reinterpret_cast<const uint32_t*>(Data + Header->listsOffset);
+    return words[offset + 1 + i];
+}
+
+bool ASTFileView::validate() const {
+    auto strOk = [&](uint32_t off) {
+        if ((uint64_t)off + sizeof(uint32_t) > Header->stringBytes) return false;
+        uint32_t len;
+        std::memcpy(&len, Data + Header->stringsOffset + off, sizeof(len));
+        return (uint64_t)off + sizeof(uint32_t) + len <= Header->stringBytes;
+    };
+    auto listOk = [&](uint32_t off) {
+        return off < Header->listWords
+            && (uint64_t)off + 1 + listSize(off) <= Header->listWords;
+    };
+    auto nodeListOk = [&](uint32_t off, uint32_t parent) {
+        if (!listOk(off)) return false;
+        for (uint32_t i = 0; i < listSize(off); i++)
+            if (!isNode(*this, listAt(off, i), parent)) return false;
+        return true;
+    };
+
+    for (uint32_t i = 0; i < Header->nodeCount; i++) {
+        const ASTNodeRecord& n = node(i);
+        bool ok = false;
+        switch (n.kind) {
+            case ASTNodeKind::Number:
+                ok = true;
+                break;
+            case ASTNodeKind::Variable:
+                ok = strOk(n.a);
+                break;
+            case ASTNodeKind::Binary:
+                ok = isNode(*this, n.a, i) && isNode(*this, n.b, i);
+                break;
+            case ASTNodeKind::Call:
+                ok = strOk(n.a) && nodeListOk(n.b, i);
+                break;
+            case ASTNodeKind::Assign:
+                ok = strOk(n.a) && isNode(*this, n.b, i);
+                break;
+            case ASTNodeKind::If:
+                ok = isNode(*this, n.a, i) && nodeListOk(n.b, i) && nodeListOk(n.c, i);
+                break;
+            case ASTNodeKind::Cycle:
+                ok = isNode(*this, n.a, i) && nodeListOk(n.b, i);
+                break;
+            case ASTNodeKind::PCycle:
+                ok = listOk(n.a) && listSize(n.a) >= 1
+                  && nodeListOk(n.b, i) && listSize(n.b) == 2
+                  && nodeListOk(n.c, i);
+                for (uint32_t p = 0; ok && p < listSize(n.a); p++)
+                    ok = strOk(listAt(n.a, p)) && (p == 0 || str(listAt(n.a, p)).size() > 1);
+                break;
+            case ASTNodeKind::Prototype:
+                ok = strOk(n.a) && listOk(n.b);
+                for (uint32_t p = 0; ok && p < listSize(n.b); p++)
+                    ok = strOk(listAt(n.b, p));
+                break;
+            case ASTNodeKind::Function:
+                ok = n.a < i
+                  && node(n.a).kind == ASTNodeKind::Prototype
+                  && nodeListOk(n.b, i);
+                break;
+        }
+        if (!ok) {
+            std::cerr << "Corrupt AST node #" << i << "\n";
+            return false;
+        }
+    }
+
+    // how deep materializeAST() and later passes will recurse, the left
+    // spine of operator chains aside (they loop over it). Children come
+    // before parents, so one pass does it.
+    std::vector<uint32_t> depth(Header->nodeCount, 1);
+    auto deepest = [&](uint32_t list) {
+        uint32_t d = 0;
+        for (uint32_t i = 0; i < listSize(list); i++)
+            d = std::max(d, depth[listAt(list, i)]);
+        return d;
+    };
+    for (uint32_t i = 0; i < Header->nodeCount; i++) {
+        const ASTNodeRecord& n = node(i);
+        switch (n.kind) {
+            case ASTNodeKind::Binary:
+                depth[i] = std::max(depth[n.a], depth[n.b] + 1);
+                break;
+            case ASTNodeKind::Call:
+                depth[i] = 1 + deepest(n.b);
+                break;
+            case ASTNodeKind::Assign:
+                depth[i] = 1 + depth[n.b];
+                break;
+            case ASTNodeKind::If:
+                depth[i] = 1 + std::max({depth[n.a], deepest(n.b), deepest(n.c)});
+                break;
+            case ASTNodeKind::Cycle:
+                depth[i] = 1 + std::max(depth[n.a], deepest(n.b));
+                break;
+            case ASTNodeKind::PCycle:
+                depth[i] = 1 + std::max(deepest(n.b), deepest(n.c));
+                break;
+            case ASTNodeKind::Function:
+                depth[i] = 1 + deepest(n.b);
+                break;
+            default:
+                break;
+        }
+        if (depth[i] > MaxFileNesting) {
+            std::cerr << "AST node #" << i << " is nested more than "
+                      << MaxFileNesting << " levels deep\n";
+            return false;
+        }
+    }
+
+    uint32_t fns = Header->functions;
+    if (!listOk(fns)) {
+        std::cerr << "Corrupt AST function list\n";
+        return false;
+    }
+    for (uint32_t i = 0; i < listSize(fns); i++)
+        if (listAt(fns, i) >= Header->nodeCount
+            || (node(listAt(fns, i)).kind != ASTNodeKind::Function
+                && node(listAt(fns, i)).kind != ASTNodeKind::Prototype)) {
+            std::cerr << "Corrupt AST function list\n";
+            return false;
+        }
+    return true;
+}
+
+namespace {
+
+std::unique_ptr<ASTNode> buildNode(const ASTFileView& view, uint32_t idx);
+
+std::vector<std::unique_ptr<ASTNode>> buildList(const ASTFileView& view,
+                                                uint32_t list) {
+    std::vector<std::unique_ptr<ASTNode>> out;
+    uint32_t n = view.listSize(list);
+    out.reserve(n);
+    for (uint32_t i = 0; i < n; i++) {
+        auto node = buildNode(view, view.listAt(list, i));
+        if (!node) return {};
+        out.push_back(std::move(node));
+    }
+    return out;
+}
+
+std::unique_ptr<ASTNode> buildNode(const ASTFileView& view, uint32_t idx) {
+    const ASTNodeRecord& n = view.node(idx);
+    switch (n.kind) {
+        case ASTNodeKind::Number:
+            return std::make_unique<NumberExprAST>(n.value);
+        case ASTNodeKind::Variable:
+            return std::make_unique<VariableExprAST>(std::string(view.str(n.a)));
+        case ASTNodeKind::Binary: {
+            // left spine with a loop, like the writer
+            std::vector<const ASTNodeRecord*> spine{&n};
+            while (view.node(spine.back()->a).kind == ASTNodeKind::Binary)
+                spine.push_back(&view.node(spine.back()->a));
+            std::unique_ptr<ASTNode> lhs = buildNode(view, spine.back()->a);
+            for (auto it = spine.rbegin(); it != spine.rend(); ++it)
+                lhs = std::make_unique<BinaryExprAST>((*it)->op, std::move(lhs),
+                                                      buildNode(view, (*it)->b));
+            return lhs;
+        }
+        case ASTNodeKind::Call:
+            return std::make_unique<CallExprAST>(std::string(view.str(n.a)),
+                                                 buildList(view, n.b));
+        case ASTNodeKind::Assign:
+            return std::make_unique<AssignExprAST>(std::string(view.str(n.a)),
+                                                   buildNode(view, n.b));
+        case ASTNodeKind::If:
+            return std::make_unique<IfStmtAST>(buildNode(view, n.a),
+                                               buildList(view, n.b),
+                                               buildList(view, n.c));
+        case ASTNodeKind::Cycle:
+            return std::make_unique<CycleStmtAST>(buildNode(view, n.a),
+                                                  buildList(view, n.b));
+        case ASTNodeKind::PCycle: {
+            std::vector<std::pair<char, std::string>> reductions;
+            for (uint32_t p = 1; p < view.listSize(n.a); p++) {
+                std::string_view r = view.str(view.listAt(n.a, p));
+                reductions.emplace_back(r[0], std::string(r.substr(1)));
+            }
+            return std::make_unique<PCycleStmtAST>(std::string(view.str(view.listAt(n.a, 0))),
+                                                   buildNode(view, view.listAt(n.b, 0)),
+                                                   buildNode(view, view.listAt(n.b, 1)),
+                                                   std::move(reductions),
+                                                   buildList(view, n.c));
+        }
+        default:
+            std::cerr << "Unexpected AST node kind in statement position\n";
+            return nullptr;
+    }
+}
+
+std::unique_ptr<PrototypeAST> buildPrototype(const ASTFileView& view,
+                                             uint32_t idx) {
+    const ASTNodeRecord& proto = view.node(idx);
+    std::vector<std::string> params;
+    for (uint32_t p = 0; p < view.listSize(proto.b); p++)
+        params.emplace_back(view.str(view.listAt(proto.b, p)));
+    return std::make_unique<PrototypeAST>(std::string(view.str(proto.a)),
+                                          std::move(params));
+}
+
+} // namespace
+
+std::unique_ptr<ProgramAST> materializeAST(const ASTFileView& view) {
+    if (!view.validate()) return nullptr;
+
+    auto program = std::make_unique<ProgramAST>();
+    uint32_t fns = view.functionList();
+    for (uint32_t i = 0; i < view.listSize(fns); i++) {
+        uint32_t idx = view.listAt(fns, i);
+        const ASTNodeRecord& top = view.node(idx);
+        if (top.kind == ASTNodeKind::Prototype) {
+            program->addExtern(buildPrototype(view, idx));
+            continue;
+        }
+        program->addFunction(std::make_unique<FunctionAST>(
+            buildPrototype(view, top.a), buildList(view, top.b)));
+    }
+    return program;
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "../parser/parser.h"
+
+// Binary AST file (.pxa)
+// A parsed ProgramAST flattened into fixed size node records. Children are
+// referenced by node index, lists live in a separate pool of uint32 words
+// and every name goes through one interned string table, so the whole file
+// can be mmap'ed and walked in place without building any objects.
+//
+// layout:  [ASTFileHeader][node records][list pool][string table]
+// all integers are stored in host byte order (little endian on x86/arm64).
+
+enum class ASTNodeKind : uint8_t {
+    Number = 1,
+    Variable,
+    Binary,
+    Call,
+    Assign,
+    If,
+    Cycle,
+    Prototype,
+    Function,
+    PCycle,
+};
+
+// what a/b/c mean depends on the kind:
+//   Number    -> value
+//   Variable  -> a = name
+//   Binary    -> op, a = lhs node, b = rhs node
+//   Call      -> a = callee name, b = args list
+//   Assign    -> a = name, b = value node
+//   If        -> a = cond node, b = then list, c = else list
+//   Cycle     -> a = cond node, b = body list
+//   Prototype -> a = name, b = params list (string offsets)
+//   Function  -> a = prototype node, b = body list
+//   PCycle    -> a = names list (loop variable, then one "<op><name>" per
+//                reduction), b = [start node, end node], c = body list
+// names are byte offsets into the string table, lists are word offsets into
+// the list pool where the first word is the element count.
+struct ASTNodeRecord {
+    ASTNodeKind kind;
+    char op;
+    uint16_t reserved;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+    double value;
+};
+static_assert(sizeof(ASTNodeRecord) == 24, "ASTNodeRecord must stay 24 bytes");
+
+struct ASTFileHeader {
+    char magic[4];          // "PXAS"
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t listWords;
+    uint32_t stringBytes;
+    uint32_t functions;     // list pool offset of the top-level list
+    uint64_t nodesOffset;
+    uint64_t listsOffset;
+    uint64_t stringsOffset;
+};
+
+// v2: the top-level list also carries extern Prototype nodes
+// v3: PCycle nodes
+constexpr uint32_t ASTFileVersion = 3;
+
+// writes program to path, returns false (and reports) on failure
+bool writeASTFile(const ProgramAST& program, const std::string& path);
+
+// read only, zero copy view over an mmap'ed .pxa file
+class ASTFileView {
+    const unsigned char* Data = nullptr;
+    size_t Size = 0;
+    const ASTFileHeader* Header = nullptr;
+
+public:
+    ASTFileView() = default;
+    ~ASTFileView();
+    ASTFileView(const ASTFileView&) = delete;
+    ASTFileView& operator=(const ASTFileView&) = delete;
+
+    // maps the file and validates the header/section bounds
+    bool open(const std::string& path);
+
+    uint32_t nodeCount() const { return Header->nodeCount; }
+    const ASTNodeRecord& node(uint32_t idx) const;
+    std::string_view str(uint32_t offset) const;
+
+    // list access: element count and i-th element of the list at offset
+    uint32_t listSize(uint32_t offset) const;
+    uint32_t listAt(uint32_t offset, uint32_t i) const;
+
+    uint32_t functionList() const { return Header->functions; }
+
+    // checks every index/offset in the file so the accessors above can
+    // be used without further bounds checking
+    bool validate() const;
+};
+
+// rebuilds the heap AST from a view, nullptr if the file is malformed
+std::unique_ptr<ProgramAST> materializeAST(const ASTFileView& view);
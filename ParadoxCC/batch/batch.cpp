@@ -0,0 +1,166 @@
+#include "batch.h"
+#include "../runtime/runtime.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// emits  void <name>.batch(T** cols, T* out, i64 begin, i64 end)
+// where T is what scalar takes, double or float
+static llvm::Function* emitBatchWrapper(llvm::Module& M, llvm::Function* scalar,
+                                        const std::string& name){
+    llvm::LLVMContext& C = M.getContext();
+    llvm::Type* num = scalar->getReturnType();
+    llvm::Type* i64 = llvm::Type::getInt64Ty(C);
+    llvm::PointerType* numPtr = llvm::PointerType::getUnqual(num);
+    llvm::PointerType* colsTy = llvm::PointerType::getUnqual(numPtr);
+
+    llvm::FunctionType* ft = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(C), {colsTy, numPtr, i64, i64}, false);
+    llvm::Function* fn = llvm::Function::Create(
+        ft, llvm::Function::ExternalLinkage, name + ".batch", M);
+    auto argIt = fn->arg_begin();
+    llvm::Argument* cols = &*argIt++;
+    llvm::Argument* out = &*argIt++;
+    llvm::Argument* begin = &*argIt++;
+    llvm::Argument* end = &*argIt++;
+    cols->setName("cols");
+    out->setName("out");
+    begin->setName("begin");
+    end->setName("end");
+    // out never overlaps the inputs, this saves the vectorizer some checks
+    fn->addParamAttr(1, llvm::Attribute::NoAlias);
+    // same FP mode as the function it wraps, which is inlined into it
+    for(const llvm::Attribute& attr : scalar->getAttributes().getFnAttrs())
+        if(attr.isStringAttribute()) fn->addFnAttr(attr);
+
+    llvm::BasicBlock* entryBB = llvm::BasicBlock::Create(C, "entry", fn);
+    llvm::BasicBlock* loopBB = llvm::BasicBlock::Create(C, "loop", fn);
+    llvm::BasicBlock* exitBB = llvm::BasicBlock::Create(C, "exit", fn);
+    llvm::IRBuilder<> B(entryBB);
+
+    // column pointers are loop invariant, load them once up front
+    std::vector<llvm::Value*> colPtrs;
+    for(unsigned k = 0; k < scalar->arg_size(); k++){
+        llvm::Value* slot = B.CreateConstInBoundsGEP1_64(numPtr, cols, k);
+        colPtrs.push_back(B.CreateLoad(numPtr, slot, "col"));
+    }
+    B.CreateCondBr(B.CreateICmpSLT(begin, end), loopBB, exitBB);
+
+    B.SetInsertPoint(loopBB);
+    llvm::PHINode* i = B.CreatePHI(i64, 2, "i");
+    i->addIncoming(begin, entryBB);
+    std::vector<llvm::Value*> args;
+    for(llvm::Value* col : colPtrs)
+        args.push_back(B.CreateLoad(num, B.CreateInBoundsGEP(num, col, i), "x"));
+    llvm::Value* res = B.CreateCall(scalar, args, "res");
+    B.CreateStore(res, B.CreateInBoundsGEP(num, out, i));
+    llvm::Value* next = B.CreateAdd(i, llvm::ConstantInt::get(i64, 1), "next", true, true);
+    i->addIncoming(next, loopBB);
+    B.CreateCondBr(B.CreateICmpSLT(next, end), loopBB, exitBB);
+
+    B.SetInsertPoint(exitBB);
+    B.CreateRetVoid();
+    return fn;
+}
+
+std::unique_ptr<BatchKernel> compileBatchKernel(const llvm::Module& M,
+                                                const std::string& fnName,
+                                                unsigned optLevel,
+                                                const FPOptions& fp,
+                                                const TargetSpec& target,
+                                                const DebugOptions& debug){
+    auto ctx = std::make_unique<llvm::LLVMContext>();
+    auto mod = cloneToContext(M, *ctx);
+    if(!mod) return nullptr;
+
+    // --perf-calls: the kernel is measured as a whole, once per chunk (see
+    // runChunks), and calls what fnName would have been without counting
+    bool counted = mod->getFunction(fnName + ".body") != nullptr;
+    std::string base = counted ? fnName + ".body" : fnName;
+    // f32: the float body, not the double signature around it
+    llvm::Function* scalar = mod->getFunction(fp.F32 ? base + ".f32" : base);
+    if(!scalar || scalar->isDeclaration()){
+        std::cerr << "Batch: no definition of '" << fnName << "'\n";
+        return nullptr;
+    }
+    // per row call overhead is what we are getting rid of
+    scalar->addFnAttr(llvm::Attribute::AlwaysInline);
+    emitBatchWrapper(*mod, scalar, fnName);
+    if(llvm::verifyModule(*mod, &llvm::errs())){
+        std::cerr << "Batch: generated module is invalid\n";
+        return nullptr;
+    }
+
+    auto kernel = std::make_unique<BatchKernel>();
+    kernel->JIT = ParadoxJIT::create(fp, target, debug);
+    if(!kernel->JIT) return nullptr;
+    kernel->JIT->OptLevel = optLevel;
+    kernel->Arity = scalar->arg_size();
+    kernel->F32 = scalar->getReturnType()->isFloatTy();
+    kernel->Counted = counted;
+    kernel->CountedName = fnName + ".batch";
+    if(!kernel->JIT->addModule(std::move(mod), std::move(ctx)))
+        return nullptr;
+
+    kernel->Fn = kernel->JIT->lookup(fnName + ".batch");
+    if(!kernel->Fn) return nullptr;
+    return kernel;
+}
+
+bool BatchKernel::run(const double* const* cols, double* out, size_t rows,
+                      unsigned threads) const {
+    if(F32){
+        std::cerr << "Batch: the kernel takes float columns (--precision=f32)\n";
+        return false;
+    }
+    runChunks(reinterpret_cast<KernelFn<double>>(Fn), cols, out, rows, threads);
+    return true;
+}
+
+bool BatchKernel::run(const float* const* cols, float* out, size_t rows,
+                      unsigned threads) const {
+    if(!F32){
+        std::cerr << "Batch: the kernel takes double columns\n";
+        return false;
+    }
+    runChunks(reinterpret_cast<KernelFn<float>>(Fn), cols, out, rows, threads);
+    return true;
+}
+
+void BatchKernel::memoReport(FILE* out) const {
+    paradox_memo_report(JIT->memoTables(), out);
+}
+
+template <typename T>
+void BatchKernel::runChunks(KernelFn<T> fn, const T* const* cols, T* out, size_t rows,
+                            unsigned threads) const {
+    auto call = [&](size_t begin, size_t end){
+        if(!Counted){
+            fn(cols, out, begin, end);
+            return;
+        }
+        paradox_perf_enter();
+        fn(cols, out, begin, end);
+        paradox_perf_exit(&PerfSlot, CountedName.c_str());
+    };
+    if(threads <= 1 || rows < 2 * (size_t)threads){
+        call(0, rows);
+        return;
+    }
+    // contiguous chunks rounded to whole cache lines of output, so threads
+    // never write into the same line
+    const size_t line = 64 / sizeof(T);
+    size_t chunk = (rows + threads - 1) / threads;
+    chunk = (chunk + line - 1) & ~(line - 1);
+    std::vector<std::thread> workers;
+    for(size_t begin = 0; begin < rows; begin += chunk){
+        size_t end = std::min(rows, begin + chunk);
+        workers.emplace_back([=]{ call(begin, end); });
+    }
+    for(auto& t : workers)
+        t.join();
+}
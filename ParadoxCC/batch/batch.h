@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include "../jit/jit.h"
+#include "llvm/IR/Module.h"
+
+// Batch evaluation
+// Applies one scalar Paradox function to whole columns of inputs. For a
+// function f(a, b, ...) the JIT gets a wrapper
+//
+//   void f.batch(double** cols, double* out, i64 begin, i64 end)
+//     for i in [begin, end): out[i] = f(cols[0][i], cols[1][i], ...)
+//
+// with f forced inline, so after -O3 the loop body is straight line code
+// the loop vectorizer can turn into SIMD. With FPOptions::F32 the columns
+// are float and f's float body is called, twice the rows per vector.
+class BatchKernel {
+public:
+    template <typename T>
+    using KernelFn = void (*)(const T* const* cols, T* out, int64_t begin, int64_t end);
+
+    size_t arity() const { return Arity; }
+    // float columns, see FPOptions::F32
+    bool f32() const { return F32; }
+
+    // evaluates rows [0, rows). cols holds arity() column pointers. With
+    // threads > 1 the rows are split into contiguous chunks, one per thread.
+    // The element type has to match f32(), false (and reports) otherwise.
+    bool run(const double* const* cols, double* out, size_t rows,
+             unsigned threads = 1) const;
+    bool run(const float* const* cols, float* out, size_t rows,
+             unsigned threads = 1) const;
+
+    // hit rates of the --memoize tables the runs so far have filled, they
+    // are freed with the kernel
+    void memoReport(FILE* out) const;
+
+private:
+    friend std::unique_ptr<BatchKernel> compileBatchKernel(const llvm::Module&,
+                                                           const std::string&,
+                                                           unsigned,
+                                                           const FPOptions&,
+                                                           const TargetSpec&,
+                                                           const DebugOptions&);
+    template <typename T>
+    void runChunks(KernelFn<T> fn, const T* const* cols, T* out, size_t rows,
+                   unsigned threads) const;
+
+    std::unique_ptr<ParadoxJIT> JIT;
+    void* Fn = nullptr;
+    size_t Arity = 0;
+    bool F32 = false;
+    // built from code with --perf-calls: every chunk is measured, the
+    // totals go under CountedName (<fn>.batch)
+    bool Counted = false;
+    std::string CountedName;
+    mutable void* PerfSlot = nullptr;
+};
+
+// builds and JITs the batch wrapper for fnName out of a copy of M,
+// nullptr (and reports) on failure
+std::unique_ptr<BatchKernel> compileBatchKernel(const llvm::Module& M,
+                                                const std::string& fnName,
+                                                unsigned optLevel = 3,
+                                                const FPOptions& fp = FPOptions(),
+                                                const TargetSpec& target = TargetSpec(),
+                                                const DebugOptions& debug = DebugOptions());
@@ -0,0 +1,210 @@
+// Runtime benchmark: Paradox kernels vs. C reference implementations.
+//
+// Every kernel in kernels/<name>.px defines <name>(n, x); reference.c has
+// the same computation as ref_<name>. Both are run with warmup, the median
+// time of the timed runs is reported together with the Paradox/C ratio.
+// A result mismatch makes the run fail.
+//
+// The reductions are then run again in each FP mode (see --fast-math) and
+// in single precision (--precision=f32): time, speedup over strict IEEE
+// and relative error against a long double evaluation of the same sum.
+//
+// usage: paradox_bench [-O N] [--reps N] [--warmup N] [--dir kernels] [name...]
+#include "paradox/paradox.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+double ref_loopsum(double n, double x);
+double ref_fib(double n, double x);
+double ref_harmonic(double n, double x);
+double ref_branchy(double n, double x);
+double ref_nested(double n, double x);
+double ref_logistic(double n, double r);
+double exact_loopsum(double n, double x);
+double exact_harmonic(double n, double x);
+}
+
+using KernelFn = double (*)(double, double);
+
+struct Kernel {
+    const char* label;
+    const char* name;   // kernels/<name>.px, function <name>
+    double n, x;
+    KernelFn ref;
+    // pcycle counts with an integer. A cycle counting in floats never gets
+    // past 2^24 (i + 1 == i), so f32 is only run for these.
+    bool pcycle = false;
+};
+
+static const Kernel Kernels[] = {
+    {"loopsum",          "loopsum",  50000000, 0.5,  ref_loopsum},
+    {"fib",              "fib",      27,       0,    ref_fib},
+    {"harmonic",         "harmonic", 20000000, 1.5,  ref_harmonic},
+    {"branchy",          "branchy",  20000,    0.37, ref_branchy},
+    {"nested",           "nested",   3000,     0.25, ref_nested},
+    // same code, unpredictable vs. predictable branch (see logistic.px)
+    {"logistic/random",  "logistic", 20000000, 3.99, ref_logistic},
+    {"logistic/steady",  "logistic", 20000000, 2.5,  ref_logistic},
+};
+
+// FP mode comparison, ref is the long double version here. With x = 0.1 the
+// loopsum/psum totals land on an integer every mode rounds to, so their 0
+// error is exact; harmonic is the one whose error moves between modes.
+static const Kernel Reductions[] = {
+    {"loopsum",          "loopsum",  50000000, 0.1,  exact_loopsum},
+    {"harmonic",         "harmonic", 20000000, 1.5,  exact_harmonic},
+    {"psum",             "psum",     50000000, 0.1,  exact_loopsum,  true},
+    {"pharmonic",        "pharmonic", 20000000, 1.5, exact_harmonic, true},
+};
+
+struct FPMode {
+    const char* label;
+    bool reassoc, contract, fast, f32;
+};
+
+static const FPMode Modes[] = {
+    {"strict",   false, false, false, false},
+    {"contract", false, true,  false, false},
+    {"reassoc",  true,  false, false, false},
+    {"fast",     false, false, true,  false},
+    {"f32",      false, false, false, true},
+    {"f32+fast", false, false, true,  true},
+};
+
+struct Options {
+    unsigned optLevel = 2;
+    unsigned reps = 10;
+    unsigned warmup = 3;
+    std::string dir = "kernels";
+    std::vector<std::string> only;
+
+    bool wants(const Kernel& k) const {
+        return only.empty()
+            || std::find(only.begin(), only.end(), k.name) != only.end()
+            || std::find(only.begin(), only.end(), k.label) != only.end();
+    }
+};
+
+// median wall time in ms over opts.reps runs, after opts.warmup untimed ones
+template <typename F>
+static double measure(const Options& opts, F&& run, double& result){
+    for(unsigned i = 0; i < opts.warmup; i++)
+        result = run();
+    std::vector<double> times;
+    for(unsigned i = 0; i < opts.reps; i++){
+        auto start = std::chrono::steady_clock::now();
+        result = run();
+        auto stop = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+static bool sameResult(double a, double b){
+    if(a == b) return true;
+    return std::fabs(a - b) <= 1e-12 * std::max(std::fabs(a), std::fabs(b));
+}
+
+// compiles kernels/<k.name>.px into session, empty handle (and reports) on failure
+static paradox::Function<double(double, double)>
+compileKernel(paradox::Session& session, const Options& opts, const Kernel& k){
+    std::string path = opts.dir + "/" + k.name + ".px";
+    std::ifstream in(path);
+    if(!in){
+        std::fprintf(stderr, "cannot open %s\n", path.c_str());
+        return {};
+    }
+    std::stringstream src;
+    src << in.rdbuf();
+
+    session.OptLevel = opts.optLevel;
+    if(!session.compile(src.str())){
+        std::fprintf(stderr, "%s: compile failed\n", k.name);
+        return {};
+    }
+    auto fn = session.get<double(double, double)>(k.name);
+    if(!fn)
+        std::fprintf(stderr, "%s: no %s(n, x) in %s\n", k.name, k.name, path.c_str());
+    return fn;
+}
+
+int main(int argc, char** argv){
+    Options opts;
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if(arg == "-O" && i + 1 < argc) opts.optLevel = std::atoi(argv[++i]);
+        else if(arg == "--reps" && i + 1 < argc) opts.reps = std::max(1, std::atoi(argv[++i]));
+        else if(arg == "--warmup" && i + 1 < argc) opts.warmup = std::atoi(argv[++i]);
+        else if(arg == "--dir" && i + 1 < argc) opts.dir = argv[++i];
+        else opts.only.push_back(arg);
+    }
+
+    std::printf("%-16s %12s %12s %8s  %s\n", "kernel", "paradox ms", "C ms", "ratio", "result");
+    bool allOk = true;
+    for(const Kernel& k : Kernels){
+        if(!opts.wants(k)) continue;
+
+        paradox::Session session;
+        auto fn = compileKernel(session, opts, k);
+        if(!fn){
+            allOk = false;
+            continue;
+        }
+
+        double got = 0, want = 0;
+        double px = measure(opts, [&]{ return fn(k.n, k.x); }, got);
+        double c = measure(opts, [&]{ return k.ref(k.n, k.x); }, want);
+        bool ok = sameResult(got, want);
+        allOk = allOk && ok;
+        std::printf("%-16s %12.3f %12.3f %7.2fx  %s\n", k.label, px, c, px / c,
+                    ok ? "ok" : "MISMATCH");
+        if(!ok)
+            std::printf("%-16s paradox=%.17g C=%.17g\n", "", got, want);
+    }
+
+    // the FP table compares single core code; pcycle kernels would use
+    // every core otherwise (PARADOX_THREADS in the environment still wins)
+    setenv("PARADOX_THREADS", "1", 0);
+    std::printf("\n%-16s %-9s %12s %8s  %s\n", "reduction", "fp mode", "ms", "speedup", "rel. error");
+    bool reductions = false;
+    for(const Kernel& k : Reductions){
+        if(!opts.wants(k)) continue;
+        reductions = true;
+        double exact = k.ref(k.n, k.x);
+        double strictMs = 0;
+        for(const FPMode& mode : Modes){
+            if(mode.f32 && !k.pcycle) continue;
+            FPOptions fp;
+            fp.Reassoc = mode.reassoc;
+            fp.Contract = mode.contract;
+            fp.Fast = mode.fast;
+            fp.F32 = mode.f32;
+            paradox::Session session(fp);
+            auto fn = compileKernel(session, opts, k);
+            if(!fn){
+                allOk = false;
+                continue;
+            }
+            double got = 0;
+            double ms = measure(opts, [&]{ return fn(k.n, k.x); }, got);
+            if(!mode.reassoc && !mode.contract && !mode.fast && !mode.f32) strictMs = ms;
+            std::printf("%-16s %-9s %12.3f %7.2fx  %.2e\n", k.label, mode.label, ms,
+                        strictMs > 0 ? strictMs / ms : 1.0,
+                        std::fabs(got - exact) / std::fabs(exact));
+        }
+    }
+    // contract < 1x on a scalar cycle is expected, not a codegen bug
+    if(reductions)
+        std::printf("\ncontract/fast on a cycle loop: the fma is on the loop-carried chain,\n"
+                    "each iteration waits its full latency instead of an add's\n");
+    return allOk ? 0 : 1;
+}
@@ -0,0 +1,264 @@
+// Incremental frontend benchmark: editor style edits in the middle of
+// generated sources of 1/8, 1/4, 1/2 and all of --size MB (default 8).
+//
+// Every size is compiled once in full, then each edit is applied with
+// IncrementalFrontend::edit() and the module brought up to date with
+// generate(). The edits change a constant, add a function, change a
+// function's parameter count together with its callers and remove the
+// added function again. Reported per edit: milliseconds for edit + generate,
+// and how many items (top-level definitions) and functions were generated
+// again. Each edit is timed three times, undone in between; the best time
+// counts, the first one in a new place pays for cold caches.
+//
+// At the end the module has to match a plain Lexer / Parser / CodeGen
+// compile of the edited text, function by function. Then come edits a full
+// compile rejects (an unclosed brace, calls it can't resolve), which generate() has to reject as
+// well, and recover from once they are undone. The run fails if any of
+// that doesn't hold, if an edit redoes more than the items it touched, or
+// if an edit at the largest size takes more than 4 times (plus 1 ms) as
+// long as at the smallest.
+//
+// usage: paradox_edit [--size MB]
+#include "frontend/incremental.h"
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+#include "analysis/callgraph.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static double msSince(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// f<n> calls f<n-1>, so a signature change has a caller to fix up
+static std::string function(size_t n){
+    std::string s = "def f" + std::to_string(n) + "(a, b) { c = a * b + " + std::to_string(n) + "; ";
+    if(n == 0) return s + "c; }\n";
+    return s + "if (c > a) { c; } else { f" + std::to_string(n - 1) + "(a, c); } }\n";
+}
+
+// one edit() call: [begin, end) replaced with text
+struct Change {
+    size_t begin, end;
+    std::string text;
+};
+
+// replaces the first occurrence of what after from
+static void replace(std::string& source, std::vector<Change>& changes, size_t from,
+                    const std::string& what, const std::string& with){
+    size_t at = source.find(what, from);
+    changes.push_back({at, at + what.size(), with});
+    source.replace(at, what.size(), with);
+}
+
+static size_t defOf(const std::string& source, size_t n){
+    return source.find("def f" + std::to_string(n) + "(");
+}
+
+struct Edit {
+    const char* name;
+    size_t maxItems, maxFunctions;   // the most it may redo
+    // edits source around function mid, returns the same as edit() calls
+    std::vector<Change> (*apply)(std::string& source, size_t mid);
+};
+
+static const Edit Edits[] = {
+    {"constant", 1, 1, [](std::string& source, size_t mid){
+        std::vector<Change> changes;
+        std::string n = std::to_string(mid);
+        replace(source, changes, defOf(source, mid), "+ " + n + ";", "+ " + n + ".5;");
+        return changes;
+    }},
+    {"add", 1, 1, [](std::string& source, size_t mid){
+        std::vector<Change> changes;
+        // below f<mid>, calls only see the functions above them
+        replace(source, changes, defOf(source, mid + 1), "def",
+                "def g(x) { f" + std::to_string(mid) + "(x, x + 1); }\ndef");
+        return changes;
+    }},
+    // f<mid> gets a third parameter, f<mid+1> and g pass it
+    {"signature", 3, 3, [](std::string& source, size_t mid){
+        std::vector<Change> changes;
+        std::string n = std::to_string(mid);
+        replace(source, changes, defOf(source, mid), "(a, b)", "(a, b, d)");
+        replace(source, changes, defOf(source, mid + 1), "f" + n + "(a, c)", "f" + n + "(a, c, 2)");
+        replace(source, changes, source.find("def g("), "(x, x + 1)", "(x, x + 1, x)");
+        return changes;
+    }},
+    {"remove", 0, 0, [](std::string& source, size_t){
+        size_t at = source.find("def g(");
+        size_t end = source.find('\n', at) + 1;
+        source.erase(at, end - at);
+        return std::vector<Change>{{at, end, ""}};
+    }},
+};
+
+// edits that leave a program a full compile fails on
+static const Edit Rejected[] = {
+    // the body of f<mid> never closes, the next def ends up inside it
+    {"unclosed", 0, 0, [](std::string& source, size_t mid){
+        std::vector<Change> changes;
+        size_t eol = source.find('\n', defOf(source, mid));
+        replace(source, changes, eol - 2, " }\n", "\n");
+        return changes;
+    }},
+    // a call to a function that doesn't exist
+    {"unknown", 0, 0, [](std::string& source, size_t mid){
+        std::vector<Change> changes;
+        replace(source, changes, defOf(source, mid), "c; }", "nope(c); }");
+        return changes;
+    }},
+    // and to one that is only defined further down
+    {"below", 0, 0, [](std::string& source, size_t mid){
+        std::vector<Change> changes;
+        replace(source, changes, defOf(source, mid), "c; }", "f" + std::to_string(mid + 1) + "(c, c); }");
+        return changes;
+    }},
+};
+
+// the changes that take source back from changes, in reverse order
+static std::vector<Change> undoOf(std::string before, const std::vector<Change>& changes){
+    std::vector<Change> undo;
+    for(auto& c : changes){
+        undo.insert(undo.begin(), {c.begin, c.begin + c.text.size(),
+                                   before.substr(c.begin, c.end - c.begin)});
+        before.replace(c.begin, c.end - c.begin, c.text);
+    }
+    return undo;
+}
+
+static bool fullCompileFails(const std::string& source){
+    Lexer lexer(source);
+    Parser parser(lexer);
+    auto program = parser.parseProgram();
+    return !program || !CallGraph().build(*program);
+}
+
+static std::string printed(llvm::Function& fn){
+    std::string s;
+    llvm::raw_string_ostream os(s);
+    fn.print(os);
+    return os.str();
+}
+
+int main(int argc, char** argv){
+    size_t sizeMB = 8;
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if(arg == "--size" && i + 1 < argc) sizeMB = std::max(1, std::atoi(argv[++i]));
+    }
+
+    std::printf("%-10s %8s %10s %10s %7s %9s  %s\n", "edit", "MB", "full ms", "edit ms",
+                "items", "functions", "result");
+    bool allOk = true;
+    // edit + generate time per edit at the smallest and the largest size
+    std::vector<double> smallest(std::size(Edits), -1), largest(std::size(Edits));
+    for(size_t div = 8; div >= 1; div /= 2){
+        size_t size = sizeMB * 1024 * 1024 / div;
+        std::string text;
+        size_t count = 0;
+        while(text.size() < size)
+            text += function(count++);
+        double mb = text.size() / 1048576.0;
+
+        auto start = std::chrono::steady_clock::now();
+        IncrementalFrontend fe(text, "edit");
+        bool ok = fe.generate();
+        double fullMs = msSince(start);
+        if(!ok){
+            std::printf("%-10s %8.1f  full compile failed\n", "-", mb);
+            return 1;
+        }
+        // an empty edit where the others go: the first edit pays once for
+        // malloc tidying up after the full compile, and the first one in a
+        // new place for moving the item offsets in between (see
+        // incremental.h). Neither is what is measured here.
+        size_t mid = defOf(text, count / 2);
+        fe.edit(mid, mid, "");
+        fe.generate();
+
+        for(size_t e = 0; e < std::size(Edits); e++){
+            const Edit& edit = Edits[e];
+            // finding the places in text is not timed, only fe's work
+            std::string before = text;
+            std::vector<Change> changes = edit.apply(text, count / 2);
+            std::vector<Change> undo = undoOf(before, changes);
+            double ms = 0;
+            bool generated = true;
+            for(int round = 0; round < 3; round++){
+                if(round > 0){
+                    for(auto& c : undo)
+                        fe.edit(c.begin, c.end, c.text);
+                    fe.generate();
+                }
+                start = std::chrono::steady_clock::now();
+                for(auto& c : changes)
+                    fe.edit(c.begin, c.end, c.text);
+                generated = fe.generate() && generated;
+                double t = msSince(start);
+                ms = round == 0 ? t : std::min(ms, t);
+            }
+            bool within = fe.LastGenerate.Items <= edit.maxItems
+                       && fe.LastGenerate.Functions <= edit.maxFunctions;
+            const char* outcome = !generated ? "FAILED" : !within ? "REDID TOO MUCH" : "ok";
+            allOk = allOk && generated && within;
+            std::printf("%-10s %8.1f %10.1f %10.2f %7zu %9zu  %s\n", edit.name, mb, fullMs, ms,
+                        fe.LastGenerate.Items, fe.LastGenerate.Functions, outcome);
+            if(smallest[e] < 0) smallest[e] = ms;
+            largest[e] = ms;
+        }
+
+        // the same as compiling the edited text from scratch
+        Lexer lexer(text);
+        Parser parser(lexer);
+        auto program = parser.parseProgram();
+        CodeGen fresh("fresh");
+        bool same = fe.text() == text && program;
+        if(same)
+            for(auto& fn : program->Functions)
+                same = same && fresh.codegenFunction(fn.get());
+        same = same && fresh.TheModule->size() == fe.module().size();
+        for(llvm::Function& fn : *fresh.TheModule){
+            if(!same) break;
+            llvm::Function* other = fe.module().getFunction(fn.getName());
+            same = other && printed(fn) == printed(*other);
+        }
+        if(!same){
+            std::printf("%-10s %8.1f  differs from a full compile\n", "-", mb);
+            allOk = false;
+        }
+
+        // once is enough, they aren't timed (and the errors go to stderr)
+        if(div != 8) continue;
+        for(const Edit& edit : Rejected){
+            std::string edited = text;
+            std::vector<Change> changes = edit.apply(edited, count / 2);
+            std::vector<Change> undo = undoOf(text, changes);
+            bool expected = fullCompileFails(edited);
+            for(auto& c : changes)
+                fe.edit(c.begin, c.end, c.text);
+            bool rejected = !fe.generate();
+            for(auto& c : undo)
+                fe.edit(c.begin, c.end, c.text);
+            bool recovered = fe.generate() && fe.text() == text;
+            const char* outcome = !expected ? "FULL COMPILE ACCEPTS IT"
+                                : !rejected ? "ACCEPTED"
+                                : !recovered ? "NOT RECOVERED" : "rejected";
+            allOk = allOk && expected && rejected && recovered;
+            std::printf("%-10s %8.1f %10s %10s %7s %9s  %s\n", edit.name, mb, "-", "-", "-", "-",
+                        outcome);
+        }
+    }
+    for(size_t e = 0; e < std::size(Edits); e++)
+        if(largest[e] > 4 * smallest[e] + 1){
+            std::printf("%-10s time grows with the file size\n", Edits[e].name);
+            allOk = false;
+        }
+    return allOk ? 0 : 1;
+}
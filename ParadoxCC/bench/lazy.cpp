@@ -0,0 +1,99 @@
+// Lazy JIT benchmark: startup time of a generated program with 1/8, 1/4,
+// 1/2 and all of --functions defs (default 2000), of which a run only calls
+// a handful.
+//
+// Startup is compile() plus the first call, once with every function
+// compiled up front and once with Session::Lazy. Reported: milliseconds for
+// both, and how many functions each one compiled. The run fails if the
+// results differ, if lazy mode compiled anything that wasn't called, or if
+// it didn't start faster than eager mode at the largest size.
+//
+// usage: paradox_lazy [--functions N] [-O level]
+#include "paradox/paradox.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+static double msSince(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// a loop each, and a call to the function before it, so the optimizer and
+// the backend have something to do
+static std::string program(size_t count){
+    std::string s;
+    for(size_t n = 0; n < count; n++){
+        std::string i = std::to_string(n);
+        s += "def f" + i + "(n, x) {\n"
+             "    s = 0;\n"
+             "    cycle (n > 0) {\n"
+             "        s = s + x * " + i + " / (n + 1);\n"
+             "        n = n - 1;\n"
+             "    }\n";
+        if(n == 0)
+            s += "    s;\n}\n";
+        else
+            s += "    if (x > 0) { s + f" + std::to_string(n - 1) + "(10, x - 1); } else { s; }\n}\n";
+    }
+    return s;
+}
+
+struct Startup {
+    double ms = 0;
+    double result = 0;
+    size_t compiled = 0;
+    bool ok = false;
+};
+
+// f<count-1> calls down the chain while x > 0, so x + 1 functions run
+static Startup start(const std::string& source, size_t count, bool lazy, unsigned optLevel,
+                     double x){
+    Startup s;
+    auto begin = std::chrono::steady_clock::now();
+    paradox::Session session;
+    session.Lazy = lazy;
+    session.OptLevel = optLevel;
+    if(!session.compile(source)) return s;
+    auto fn = session.get<double(double, double)>("f" + std::to_string(count - 1));
+    if(!fn) return s;
+    s.result = fn(10, x);
+    s.ms = msSince(begin);
+    s.compiled = session.compiledFunctions();
+    s.ok = true;
+    return s;
+}
+
+int main(int argc, char** argv){
+    size_t functions = 2000;
+    unsigned optLevel = 2;
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if(arg == "--functions" && i + 1 < argc) functions = std::max(8, std::atoi(argv[++i]));
+        else if(arg == "-O" && i + 1 < argc) optLevel = std::atoi(argv[++i]);
+    }
+
+    const double x = 3;
+    std::printf("%10s %12s %10s %12s %10s  %s\n", "functions", "eager ms", "compiled",
+                "lazy ms", "compiled", "result");
+    bool allOk = true;
+    Startup eager, lazy;
+    for(size_t div = 8; div >= 1; div /= 2){
+        size_t count = functions / div;
+        std::string source = program(count);
+        eager = start(source, count, false, optLevel, x);
+        lazy = start(source, count, true, optLevel, x);
+        bool ok = eager.ok && lazy.ok && eager.result == lazy.result
+               && lazy.compiled == (size_t)x + 1;
+        allOk = allOk && ok;
+        std::printf("%10zu %12.1f %10zu %12.1f %10zu  %s\n", count, eager.ms, eager.compiled,
+                    lazy.ms, lazy.compiled, ok ? "ok" : "FAILED");
+    }
+    if(lazy.ms >= eager.ms){
+        std::printf("lazy startup is no faster than eager\n");
+        allOk = false;
+    }
+    return allOk ? 0 : 1;
+}
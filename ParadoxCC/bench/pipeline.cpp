@@ -0,0 +1,124 @@
+// Pipelined compile benchmark: a generated source of --functions defs
+// (default 40000, ~4 MB) compiled to IR text once phase after phase, the
+// way paradoxCC does without --pipeline (lex + parse, check calls, codegen,
+// print), and once through compilePipelined() with 1, 2, 4, ... workers up
+// to --workers (default: what the pipeline picks on this machine).
+//
+// Reported: wall milliseconds of each, and for the pipelined runs the busy
+// time of every stage, the lower bound the wall time approaches with
+// enough cores. The run fails if any pipelined output differs from the
+// serial one; it doesn't fail on time, which depends on the cores there are.
+//
+// usage: paradox_pipeline [--functions N] [--workers N]
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+#include "analysis/callgraph.h"
+#include "codegen/codegen.h"
+#include "pipeline/pipeline.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+static double msSince(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// a loop and a branch each, most calling one of the few functions before
+static std::string program(size_t count){
+    std::string s;
+    for(size_t n = 0; n < count; n++){
+        std::string i = std::to_string(n);
+        s += "def f" + i + "(n, x) {\n"
+             "    s = 0;\n"
+             "    cycle (n > 0) { s = s + x * " + i + " / (n + 1); n = n - 1; }\n";
+        if(n % 100 == 0)
+            s += "    if (x > 1) { s; } else { s * 2; }\n}\n";
+        else
+            s += "    s + f" + std::to_string(n - 1 - std::min(n - 1, n % 7)) + "(n, x);\n}\n";
+    }
+    return s;
+}
+
+static bool serial(const std::string& source, const std::string& path){
+    Lexer lexer(source);
+    Parser parser(lexer);
+    auto program = parser.parseProgram();
+    CallGraph graph;
+    if(!program || !graph.build(*program)) return false;
+    CodeGen cg(path);
+    if(!cg.setTarget(TargetSpec())) return false;
+    for(auto& ext : program->Externs)
+        cg.codegenPrototype(ext.get());
+    for(auto& fn : program->Functions)
+        cg.codegenFunction(fn.get());
+    std::error_code EC;
+    llvm::raw_fd_ostream out(path, EC);
+    if(EC) return false;
+    cg.TheModule->print(out, nullptr);
+    return true;
+}
+
+static std::string readFile(const std::string& path){
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+int main(int argc, char** argv){
+    size_t functions = 40000;
+    unsigned maxWorkers = 0;
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if(arg == "--functions" && i + 1 < argc) functions = std::max(1, std::atoi(argv[++i]));
+        else if(arg == "--workers" && i + 1 < argc) maxWorkers = std::atoi(argv[++i]);
+    }
+    if(maxWorkers == 0){
+        unsigned cores = std::thread::hardware_concurrency();
+        maxWorkers = cores > 4 ? cores - 3 : 1;
+    }
+
+    std::string source = program(functions);
+    std::printf("%zu functions, %.1f MB, %u core(s)\n", functions, source.size() / 1e6,
+                std::thread::hardware_concurrency());
+
+    // both outputs carry the module name, so it has to be the same path
+    const std::string path = "/tmp/paradox_pipeline.ll";
+    auto begin = std::chrono::steady_clock::now();
+    if(!serial(source, path)){
+        std::printf("serial compile failed\n");
+        return 1;
+    }
+    double serialMs = msSince(begin);
+    std::string expected = readFile(path);
+
+    std::printf("%8s %10s %8s %8s %8s %8s %8s  %s\n", "workers", "wall ms", "speedup",
+                "lex", "parse", "codegen", "emit", "output");
+    std::printf("%8s %10.1f %8s\n", "serial", serialMs, "1.00x");
+    bool allOk = true;
+    for(unsigned workers = 1;; workers = std::min(workers * 2, maxWorkers)){
+        PipelineOptions opts;
+        opts.Workers = workers;
+        opts.ModuleName = path;
+        opts.Output = path;
+        PipelineStats stats;
+        begin = std::chrono::steady_clock::now();
+        bool ok = compilePipelined(source, opts, &stats);
+        double ms = msSince(begin);
+        ok = ok && readFile(path) == expected;
+        allOk = allOk && ok;
+        std::printf("%8u %10.1f %7.2fx %8.1f %8.1f %8.1f %8.1f  %s\n", workers, ms,
+                    serialMs / ms, stats.LexMs, stats.ParseMs, stats.CodegenMs / workers,
+                    stats.EmitMs, ok ? "same" : "DIFFERENT");
+        if(workers == maxWorkers) break;
+    }
+    std::remove(path.c_str());
+    return allOk ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+/* C reference implementations of the kernels in bench/kernels.
+ * ref_<name> mirrors its Paradox version operation for operation, so the
+ * results have to match bit for bit at the same FP settings. */
+
+double ref_loopsum(double n, double x) {
+    double s = 0;
+    for (double i = 0; i < n; i = i + 1)
+        s = s + i * x;
+    return s;
+}
+
+double ref_fib(double n, double x) {
+    double r = n;
+    if (n > 1)
+        r = ref_fib(n - 1, x) + ref_fib(n - 2, x);
+    return r;
+}
+
+double ref_harmonic(double n, double x) {
+    double s = 0;
+    for (double i = 1; i < n + 1; i = i + 1)
+        s = s + x / i;
+    return s;
+}
+
+double ref_branchy(double n, double x) {
+    double s = 0;
+    for (double i = 0; i < n; i = i + 1) {
+        double t = i * x;
+        while (t > 10)
+            t = t - 10;
+        if (t > 5)
+            s = s + t;
+        else
+            s = s - 1;
+    }
+    return s;
+}
+
+static double ref_cell(double i, double j) {
+    return (i * j) / (i + j + 1);
+}
+
+double ref_nested(double n, double x) {
+    double s = 0;
+    for (double i = 0; i < n; i = i + 1)
+        for (double j = 0; j < n; j = j + 1)
+            s = s + ref_cell(i, j) * x;
+    return s;
+}
+
+/* written as a branch on purpose: gcc keeps it a jump, so the random
+ * (r = 3.99) run pays for mispredictions the predictable one doesn't */
+double ref_logistic(double n, double r) {
+    double x = 0.3, s = 0;
+    for (double i = 0; i < n; i = i + 1) {
+        x = r * x * (1 - x);
+        if (x > 0.5)
+            s = s + x;
+        else
+            s = s - x;
+    }
+    return s;
+}
+
+/* long double versions of the reductions: the "exact" value the FP modes
+ * are compared against (80 bit on x86, plenty for these sums) */
+double exact_loopsum(double n, double x) {
+    long double s = 0;
+    for (long double i = 0; i < n; i = i + 1)
+        s = s + i * x;
+    return (double)s;
+}
+
+double exact_harmonic(double n, double x) {
+    long double s = 0;
+    for (long double i = 1; i < n + 1; i = i + 1)
+        s = s + x / i;
+    return (double)s;
+}
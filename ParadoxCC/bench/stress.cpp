@@ -0,0 +1,285 @@
+// Frontend stress test: generated sources of up to --size MB (default 100)
+// in the shapes that break naive compilers. Long comment blocks, one huge
+// line, operator chains millions of terms long, nesting right at the
+// limits, and inputs nested far beyond them that have to be rejected.
+//
+// Every scenario runs at 1/64, 1/32, ... 1/2 and all of the size, each in
+// a forked child (a crash is reported, not fatal) on a thread with a small
+// stack (--stack, KB). Lexing + parsing is timed, and code generation (IR +
+// verifier) for sizes up to --codegen-size MB: LLVM IR takes around 100
+// bytes per source byte, more than the frontend itself. Generating the
+// source is not timed; peak memory includes the source (1 B/byte).
+// A scenario fails when it crashes, gives the wrong outcome, when time per
+// MB of a stage at its largest size is more than twice that at the smallest
+// (not linear), or when peak memory per input byte grows the same way.
+//
+// With --parse-threads N the frontend is the parallel one (split at
+// top-level defs, see frontend/); its workers get default thread stacks.
+//
+// usage: paradox_stress [--size MB] [--codegen-size MB] [--stack KB]
+//                       [--parse-threads N] [name...]
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+#include "frontend/frontend.h"
+#include "codegen/codegen.h"
+#include "llvm/IR/Verifier.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// appends text until out is size bytes long (or a bit more)
+static void fill(std::string& out, size_t size, const std::string& text){
+    out.reserve(size + text.size() + 64);
+    while(out.size() < size)
+        out += text;
+}
+
+static std::string nested(const std::string& open, const std::string& inner,
+                          const std::string& close, unsigned depth){
+    std::string s;
+    for(unsigned i = 0; i < depth; i++) s += open;
+    s += inner;
+    for(unsigned i = 0; i < depth; i++) s += close;
+    return s;
+}
+
+struct Scenario {
+    const char* name;
+    bool valid;     // false: the parser has to reject it
+    std::string (*generate)(size_t size);
+};
+
+static const Scenario Scenarios[] = {
+    // used to be one recursive lexer call per comment line
+    {"comments", true, [](size_t size){
+        std::string s;
+        fill(s, size, "# " + std::string(77, '-') + "\n");
+        return s + "def f(x) { x; }\n";
+    }},
+    {"one-line", true, [](size_t size){
+        std::string s = "def f(x) { x; } #";
+        fill(s, size, std::string(1000, 'z'));
+        return s + "\ndef g(x) { x; }\n";
+    }},
+    // a single left-deep tree as deep as the input is long
+    {"chain", true, [](size_t size){
+        std::string s = "def f(value) { ";
+        fill(s, size, "value + value * value - ");
+        return s + "value; }\n";
+    }},
+    // right-nested parentheses at the limit, over and over
+    {"parens", true, [](size_t size){
+        std::string stmt = "x = " + nested("x - (", "x", ")", DefaultMaxNesting - 1) + ";\n";
+        std::string s = "def f(x) {\n";
+        fill(s, size, stmt);
+        return s + "x; }\n";
+    }},
+    {"calls", true, [](size_t size){
+        std::string stmt = nested("g(", "x", ")", DefaultMaxNesting) + ";\n";
+        std::string s = "def g(a) { a; }\ndef f(x) {\n";
+        fill(s, size, stmt);
+        return s + "x; }\n";
+    }},
+    // functions with ifs nested to the block limit
+    {"blocks", true, [](size_t size){
+        std::string s;
+        std::string body = nested("if (x > 0) { x = x - 1; ", "x;", " }", DefaultMaxNesting - 1);
+        for(size_t n = 0; s.size() < size; n++)
+            s += "def f" + std::to_string(n) + "(x) { " + body + " }\n";
+        return s;
+    }},
+    {"functions", true, [](size_t size){
+        std::string s;
+        for(size_t n = 0; s.size() < size; n++)
+            s += "def f" + std::to_string(n) + "(a, b) { c = a * b + " + std::to_string(n)
+               + "; if (c > a) { c; } else { a - c; } }\n";
+        return s;
+    }},
+    // adversarial: far beyond the limits, rejected early
+    {"deep-parens", false, [](size_t size){
+        std::string s = "def f(x) { ";
+        fill(s, size, "((((((((((");
+        return s;
+    }},
+    {"deep-calls", false, [](size_t size){
+        std::string s = "def f(x) { ";
+        fill(s, size, "f(f(f(f(f(");
+        return s;
+    }},
+    {"deep-blocks", false, [](size_t size){
+        std::string s = "def f(x) { ";
+        fill(s, size, "if (x) { ");
+        return s;
+    }},
+};
+
+struct Options {
+    size_t sizeMB = 100;
+    size_t codegenMB = 16;
+    size_t stackKB = 1024;
+    unsigned parseThreads = 1;
+    std::vector<std::string> only;
+};
+
+struct Result {
+    bool parsed = false;
+    bool generated = false;
+    double parseMs = 0, codegenMs = 0;
+    long peakKB = 0;
+};
+
+struct Job {
+    bool codegen;
+    unsigned parseThreads;
+    std::string source;
+    Result result;
+};
+
+static double msSince(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// the whole frontend, on the small stack
+static void* runJob(void* arg){
+    Job& job = *static_cast<Job*>(arg);
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<ProgramAST> program;
+    if(job.parseThreads != 1)
+        program = parseParallel(job.source, job.parseThreads);
+    else{
+        Lexer lexer(std::move(job.source));
+        Parser parser(lexer);
+        program = parser.parseProgram();
+    }
+    job.result.parseMs = msSince(start);
+    job.result.parsed = program != nullptr;
+    if(!program || !job.codegen) return nullptr;
+
+    start = std::chrono::steady_clock::now();
+    CodeGen cg("stress");
+    bool ok = true;
+    for(auto& fn : program->Functions)
+        ok = ok && cg.codegenFunction(fn.get());
+    job.result.generated = ok && !llvm::verifyModule(*cg.TheModule, &llvm::errs());
+    job.result.codegenMs = msSince(start);
+    return nullptr;
+}
+
+// runs one size in a child process, false if it crashed
+static bool runChild(const Options& opts, const Scenario& sc, size_t size, Result& out){
+    int fds[2];
+    if(pipe(fds) != 0) return false;
+    std::fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0){
+        close(fds[0]);
+        // the expected "nested too deep" errors would drown the table
+        if(!sc.valid){
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, 2);
+        }
+        Job job{size <= opts.codegenMB * 1024 * 1024, opts.parseThreads, sc.generate(size), {}};
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, opts.stackKB * 1024);
+        pthread_t thread;
+        if(pthread_create(&thread, &attr, runJob, &job) != 0)
+            _exit(2);
+        pthread_join(thread, nullptr);
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        job.result.peakKB = usage.ru_maxrss;
+        ssize_t n = write(fds[1], &job.result, sizeof(job.result));
+        _exit(n == (ssize_t)sizeof(job.result) ? 0 : 2);
+    }
+    close(fds[1]);
+    ssize_t n = read(fds[0], &out, sizeof(out));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if(WIFSIGNALED(status))
+        std::printf("    (killed by signal %d)\n", WTERMSIG(status));
+    return n == (ssize_t)sizeof(out) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// time per MB at the smallest and the largest size a stage ran at
+struct Trend {
+    double first = 0, last = 0;
+    void add(double v){
+        if(first == 0) first = v;
+        last = v;
+    }
+    bool linear() const { return last <= 2 * first; }
+};
+
+int main(int argc, char** argv){
+    Options opts;
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if(arg == "--size" && i + 1 < argc) opts.sizeMB = std::max(1, std::atoi(argv[++i]));
+        else if(arg == "--codegen-size" && i + 1 < argc) opts.codegenMB = std::atoi(argv[++i]);
+        else if(arg == "--stack" && i + 1 < argc) opts.stackKB = std::max(64, std::atoi(argv[++i]));
+        else if(arg == "--parse-threads" && i + 1 < argc) opts.parseThreads = std::atoi(argv[++i]);
+        else opts.only.push_back(arg);
+    }
+
+    std::printf("%-12s %8s %10s %8s %10s %8s %8s %7s  %s\n", "scenario", "MB", "parse ms",
+                "ms/MB", "codegen ms", "ms/MB", "peak MB", "B/byte", "result");
+    bool allOk = true;
+    for(const Scenario& sc : Scenarios){
+        if(!opts.only.empty()
+           && std::find(opts.only.begin(), opts.only.end(), sc.name) == opts.only.end())
+            continue;
+
+        bool ok = true;
+        // memory per byte with and without IR, they differ a lot
+        Trend parseTime, codegenTime, memory, codegenMemory;
+        for(size_t div = 64; div >= 1; div /= 2){
+            size_t size = opts.sizeMB * 1024 * 1024 / div;
+            double mb = size / 1048576.0;
+            Result r;
+            if(!runChild(opts, sc, size, r)){
+                std::printf("%-12s %8.1f  crashed\n", sc.name, mb);
+                ok = false;
+                break;
+            }
+            bool codegen = sc.valid && size <= opts.codegenMB * 1024 * 1024;
+            const char* outcome = sc.valid ? "ok" : "rejected (ok)";
+            if(r.parsed != sc.valid) outcome = sc.valid ? "REJECTED" : "ACCEPTED";
+            else if(codegen && !r.generated) outcome = "CODEGEN FAILED";
+            ok = ok && r.parsed == sc.valid && (!codegen || r.generated);
+
+            double bytesPer = r.peakKB * 1024.0 / size;
+            parseTime.add(r.parseMs / mb);
+            (codegen ? codegenMemory : memory).add(bytesPer);
+            std::printf("%-12s %8.1f %10.1f %8.2f ", sc.name, mb, r.parseMs, r.parseMs / mb);
+            if(codegen){
+                codegenTime.add(r.codegenMs / mb);
+                std::printf("%10.1f %8.2f ", r.codegenMs, r.codegenMs / mb);
+            }
+            else
+                std::printf("%10s %8s ", "-", "-");
+            std::printf("%8.1f %7.2f  %s\n", r.peakKB / 1024.0, bytesPer, outcome);
+        }
+        // rejected inputs stop at the limit: their time is tiny and noisy
+        if(ok && sc.valid && !(parseTime.linear() && codegenTime.linear())){
+            std::printf("%-12s time grows faster than the input\n", sc.name);
+            ok = false;
+        }
+        if(ok && !(memory.linear() && codegenMemory.linear())){
+            std::printf("%-12s memory grows faster than the input\n", sc.name);
+            ok = false;
+        }
+        allOk = allOk && ok;
+    }
+    return allOk ? 0 : 1;
+}
@@ -3,16 +3,129 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Type.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Target/TargetMachine.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
-llvm::LLVMContext TheContext;
-llvm::IRBuilder<> Builder(TheContext);
-llvm::Module TheModule("paradoxCC",TheContext);
-std::map<std::string,llvm::Value*> NamedValues;
+CodeGen::CodeGen(const std::string& moduleName)
+    : TheContext(std::make_unique<llvm::LLVMContext>()),
+      TheModule(std::make_unique<llvm::Module>(moduleName, *TheContext)),
+      Builder(*TheContext) {}
+
+void CodeGen::setFPOptions(const FPOptions& fp){
+    FP = fp;
+    //every fadd/fmul/fcmp/... the builder creates carries these
+    Builder.setFastMathFlags(fastMathFlags(fp));
+}
+
+bool CodeGen::setTarget(const TargetSpec& spec){
+    std::unique_ptr<llvm::TargetMachine> tm = createTargetMachine(spec, FP);
+    if(!tm) return false;
+    Target = spec;
+    TheModule->setTargetTriple(tm->getTargetTriple().str());
+    TheModule->setDataLayout(tm->createDataLayout());
+    return true;
+}
+
+void CodeGen::enableDebugInfo(const std::string& sourcePath){
+    DBuilder = std::make_unique<llvm::DIBuilder>(*TheModule);
+    llvm::SmallString<128> path(sourcePath);
+    llvm::sys::fs::make_absolute(path);
+    DebugFile = DBuilder->createFile(llvm::sys::path::filename(path),
+                                     llvm::sys::path::parent_path(path));
+    //there is no DWARF language code for Paradox, C is the closest
+    DBuilder->createCompileUnit(llvm::dwarf::DW_LANG_C, DebugFile, "paradoxCC",
+                                /*isOptimized*/ true, "", 0);
+    TheModule->addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                             llvm::DEBUG_METADATA_VERSION);
+    TheModule->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+}
+
+void CodeGen::finalizeDebugInfo(){
+    if(DBuilder) DBuilder->finalize();
+}
+
+//every paradox function is number(number, ...); outlined bodies are marked
+//artificial and get no signature
+llvm::DISubprogram* CodeGen::createDebugFunction(llvm::Function* fn, const std::string& name,
+                                                 unsigned line, bool artificial){
+    llvm::SmallVector<llvm::Metadata*, 8> types;
+    if(!artificial)
+        types.assign(fn->arg_size() + 1, debugNumberType());
+    llvm::DISubprogram* sp = DBuilder->createFunction(
+        DebugFile, name, fn->getName(), DebugFile, line,
+        DBuilder->createSubroutineType(DBuilder->getOrCreateTypeArray(types)), line,
+        artificial ? llvm::DINode::FlagArtificial : llvm::DINode::FlagPrototyped,
+        llvm::DISubprogram::SPFlagDefinition);
+    fn->setSubprogram(sp);
+    return sp;
+}
+
+llvm::DIType* CodeGen::debugNumberType(){
+    if(FP.F32)
+        return DBuilder->createBasicType("float", 32, llvm::dwarf::DW_ATE_float);
+    return DBuilder->createBasicType("double", 64, llvm::dwarf::DW_ATE_float);
+}
+
+void CodeGen::setDebugLocation(SourceLoc loc){
+    Builder.SetCurrentDebugLocation(
+        llvm::DILocation::get(*TheContext, loc.Line, loc.Col, DebugScope));
+}
+
+void CodeGen::setFunctionAttributes(llvm::Function* fn){
+    applyFPAttributes(FP, *fn);
+    applyTargetAttributes(Target, *fn);
+}
+
+//allocas must sit in the entry block, otherwise mem2reg won't promote them
+llvm::AllocaInst* CodeGen::createEntryAlloca(llvm::Function* fn, const std::string& name,
+                                             unsigned argNo){
+    llvm::IRBuilder<> entry(&fn->getEntryBlock(), fn->getEntryBlock().begin());
+    llvm::AllocaInst* slot = entry.CreateAlloca(numberType(), nullptr, name);
+    if(!DebugScope) return slot;
+
+    //tell the debugger the variable lives here
+    const llvm::DebugLoc& at = Builder.getCurrentDebugLocation();
+    unsigned line = at ? at.getLine() : 0;
+    llvm::DIType* type = debugNumberType();
+    llvm::DILocalVariable* var = argNo
+        ? DBuilder->createParameterVariable(DebugScope, name, argNo, DebugFile, line, type, true)
+        : DBuilder->createAutoVariable(DebugScope, name, DebugFile, line, type, true);
+    llvm::DILocation* loc = llvm::DILocation::get(*TheContext, line, 0, DebugScope);
+    if(llvm::Instruction* next = slot->getNextNode())
+        DBuilder->insertDeclare(slot, var, DBuilder->createExpression(), loc, next);
+    else
+        DBuilder->insertDeclare(slot, var, DBuilder->createExpression(), loc, slot->getParent());
+    return slot;
+}
+
+//a Paradox number: double, or float with --precision=f32
+llvm::Type* CodeGen::numberType(){
+    return FP.F32 ? llvm::Type::getFloatTy(*TheContext) : llvm::Type::getDoubleTy(*TheContext);
+}
+
+//externs, public signatures and the runtime always take doubles. these
+//convert numbers to that and back, and do nothing for doubles.
+static llvm::Value* widen(llvm::IRBuilder<>& B, llvm::Value* v){
+    if(v && v->getType()->isFloatTy())
+        return B.CreateFPExt(v, B.getDoubleTy(), "wide");
+    return v;
+}
+
+static llvm::Value* narrow(llvm::IRBuilder<>& B, llvm::Value* v, llvm::Type* to){
+    if(v && v->getType() != to)
+        return B.CreateFPTrunc(v, to, "narrow");
+    return v;
+}
 
 //creates constant in llvm
-llvm::Value* codegenNumber(NumberExprAST* node){
-    return llvm::ConstantFP::get(TheContext,llvm::APFloat(node->value));
+llvm::Value* CodeGen::codegenNumber(NumberExprAST* node){
+    return llvm::ConstantFP::get(numberType(), node->value);
     /* consider 42 as value
         llvm::APFloat() -> wraps 42 into llvms float type
         get() is static function in constantfp class, it internally handles object creation
@@ -20,22 +133,90 @@ llvm::Value* codegenNumber(NumberExprAST* node){
 }
 
 
-llvm::Value* codegenVariable(VariableExprAST* node){
-    llvm::Value* val = NamedValues[node->name];
-    if(!val){
+llvm::Value* CodeGen::codegenVariable(VariableExprAST* node){
+    llvm::AllocaInst* slot = NamedValues[node->name];
+    if(!slot){
         std::cerr << "Unknown variable : "<<node->name<<"/n";
         return nullptr;
     }
-    return val;
+    return Builder.CreateLoad(slot->getAllocatedType(), slot, node->name);
+}
+
+
+llvm::Value* CodeGen::codegenBinary(BinaryExprAST* node) {
+    return codegenExpr(node);
 }
 
+llvm::Value* CodeGen::codegenCall(CallExprAST* node) {
+    return codegenExpr(node);
+}
 
-llvm::Value* codegenBinary(BinaryExprAST* node) {
-    llvm::Value* L = codegen(node->lhs.get()); // this get() is to get a raw pointer of lhs node type
-    llvm::Value* R = codegen(node->rhs.get());
-    if (!L || !R) return nullptr;
+//operators and calls are generated from an explicit stack: a chain like
+//a + b + c + ... is as deep as it is long, and would take a native stack
+//frame per level otherwise. Everything else goes through codegen().
+llvm::Value* CodeGen::codegenExpr(ASTNode* root) {
+    struct Pending {
+        ASTNode* node;
+        size_t done; // children already generated, their values are on values
+    };
+    std::vector<Pending> work{{root, 0}};
+    std::vector<llvm::Value*> values;
+    llvm::DebugLoc outer = Builder.getCurrentDebugLocation();
+
+    while (!work.empty()) {
+        Pending p = work.back();
+        llvm::Value* v = nullptr;
+        if (auto* n = dynamic_cast<BinaryExprAST*>(p.node)) {
+            if (p.done < 2) {
+                work.back().done++;
+                work.push_back({p.done == 0 ? n->lhs.get() : n->rhs.get(), 0});
+                continue;
+            }
+            llvm::Value* R = values.back();
+            values.pop_back();
+            llvm::Value* L = values.back();
+            values.pop_back();
+            if (DebugScope && n->Loc.Line) setDebugLocation(n->Loc);
+            v = emitBinary(n->op, L, R);
+        }
+        else if (auto* n = dynamic_cast<CallExprAST*>(p.node)) {
+            if (p.done == 0 && !TheModule->getFunction(n->Callee)) {
+                std::cerr << "Unknown function: " << n->Callee << "\n";
+                v = nullptr;
+            }
+            else if (p.done < n->Args.size()) {
+                work.back().done++;
+                work.push_back({n->Args[p.done].get(), 0});
+                continue;
+            }
+            else {
+                std::vector<llvm::Value*> args;
+                for (auto it = values.end() - n->Args.size(); it != values.end(); ++it)
+                    args.push_back(widen(Builder, *it));
+                values.resize(values.size() - n->Args.size());
+                if (DebugScope && n->Loc.Line) setDebugLocation(n->Loc);
+                //every call goes to the double signature, see createF32Body
+                v = narrow(Builder, Builder.CreateCall(TheModule->getFunction(n->Callee), args, "calltmp"),
+                           numberType());
+            }
+        }
+        else {
+            v = codegen(p.node);
+        }
+        if (!v) {
+            Builder.SetCurrentDebugLocation(outer);
+            return nullptr;
+        }
+        work.pop_back();
+        //operands and arguments are all numbers, comparisons give i1
+        values.push_back(work.empty() ? v : toNumber(v));
+    }
+    Builder.SetCurrentDebugLocation(outer);
+    return values.back();
+}
 
-    switch (node->op) {
+llvm::Value* CodeGen::emitBinary(char op, llvm::Value* L, llvm::Value* R) {
+    switch (op) {
         case '+': return Builder.CreateFAdd(L, R, "addtmp");
         case '-': return Builder.CreateFSub(L, R, "subtmp");
         case '*': return Builder.CreateFMul(L, R, "multmp");
@@ -48,42 +229,30 @@ llvm::Value* codegenBinary(BinaryExprAST* node) {
     }
 }
 
-llvm::Value* codegenCall(CallExprAST* node) {
-    llvm::Function* fn = TheModule.getFunction(node->Callee);
-    if (!fn) {
-        std::cerr << "Unknown function: " << node->Callee << "\n";
-        return nullptr;
-    }
-
-    std::vector<llvm::Value*> args;
-    for (auto& arg : node->Args) {
-        llvm::Value* v = codegen(arg.get());
-        if (!v) return nullptr;
-        args.push_back(v);
-    }
-
-    return Builder.CreateCall(fn, args, "calltmp");
-}
-
-llvm::Value* codegenAssign(AssignExprAST* node){
-    llvm::Value* val = codegen(node->Value.get());
+llvm::Value* CodeGen::codegenAssign(AssignExprAST* node){
+    llvm::Value* val = toNumber(codegen(node->Value.get()));
     if(!val) return nullptr;
-    NamedValues[node->Name] = val;
+    llvm::AllocaInst*& slot = NamedValues[node->Name];
+    if(!slot)
+        slot = createEntryAlloca(Builder.GetInsertBlock()->getParent(), node->Name);
+    Builder.CreateStore(val, slot);
     return val;
 }
 
-llvm::Function* codegenPrototype(PrototypeAST* node){
+llvm::Function* CodeGen::codegenPrototype(PrototypeAST* node){
     //in codegencall our args are of type value*,
     //here its type*, because in call we just pass values
     //but in prototype we tell the args type!
-    //llvm::Type::getDoubleTy(TheContext) -> returns LLVM's representation of the double type
-    std::vector<llvm::Type*> doubles(node->Args.size(),llvm::Type::getDoubleTy(TheContext));
+    //llvm::Type::getDoubleTy(*TheContext) -> returns LLVM's representation of the double type
+    //this is the signature callers see, double even with --precision=f32
+    std::vector<llvm::Type*> doubles(node->Args.size(),llvm::Type::getDoubleTy(*TheContext));
 
     //returns a funtiontype ptr with specif return type and no of args, false tells function i defined are not variadic
     // eg for variadic func : printf("hello"); printf("hello %s", name);      
-    llvm::FunctionType* ft = llvm::FunctionType::get(llvm::Type::getDoubleTy(TheContext),doubles,false);
+    llvm::FunctionType* ft = llvm::FunctionType::get(llvm::Type::getDoubleTy(*TheContext),doubles,false);
 
-    llvm::Function* fn = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, node->Name, TheModule);
+    llvm::Function* fn = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, node->Name, *TheModule);
+    setFunctionAttributes(fn);
 
     //this is for readability in IR
     //without this vars will be like %0, %1 .. instead of %x, %y
@@ -94,45 +263,267 @@ llvm::Function* codegenPrototype(PrototypeAST* node){
     return fn;
 }
 
-llvm::Function* codegenFunction(FunctionAST* node){
+llvm::Function* CodeGen::codegenFunction(FunctionAST* node){
     //check whether func declaration is built or not
-    llvm::Function* fn = TheModule.getFunction(node->Proto->getName());
+    llvm::Function* fn = TheModule->getFunction(node->Proto->getName());
     if(!fn){
         fn = codegenPrototype(node->Proto.get());
     }
     if(!fn) return nullptr;
 
+    //counted: fn reads the perf counters around <name>.body, which is
+    //what fn would have been otherwise
+    //f32: fn converts, the body goes into <name>.f32
+    //memoized: fn becomes the caching wrapper, the body goes into <name>.impl
+    llvm::Function* pub = fn;
+    if(PerfCalls.count(node->Proto->getName()))
+        fn = createCounted(fn, node->Proto->getName());
+    if(FP.F32)
+        fn = createF32Body(fn);
+    if(Memoize.count(node->Proto->getName()))
+        fn = createMemoized(fn, node->Proto->getName());
+
+    if(DBuilder){
+        DebugScope = createDebugFunction(fn, node->Proto->getName(), node->Loc.Line, false);
+        setDebugLocation(node->Loc);
+    }
+
     //build entry basic block
-    llvm::BasicBlock* bb = llvm::BasicBlock::Create(TheContext,"entry",fn);
+    llvm::BasicBlock* bb = llvm::BasicBlock::Create(*TheContext,"entry",fn);
     Builder.SetInsertPoint(bb);
 
     NamedValues.clear();
     for(auto& arg : fn->args()){
-        NamedValues[std::string(arg.getName())] = &arg;
+        llvm::AllocaInst* slot = createEntryAlloca(fn, std::string(arg.getName()), arg.getArgNo() + 1);
+        Builder.CreateStore(&arg, slot);
+        NamedValues[std::string(arg.getName())] = slot;
     }
 
-    //codegen for each statement in func body
+    //codegen for each statement in func body. a statement that fails has
+    //said why, the half built function fails the whole compile (or item)
     llvm::Value* last = nullptr;
     for(auto& stmt : node->Body){
         last = codegen(stmt.get());
+        if(!last){
+            DebugScope = nullptr;
+            Builder.SetCurrentDebugLocation(llvm::DebugLoc());
+            return nullptr;
+        }
     }
 
-    if(last) Builder.CreateRet(last);
-    else Builder.CreateRet(llvm::ConstantFP::get(TheContext, llvm::APFloat(0.0)));
+    if(last) Builder.CreateRet(toNumber(last));
+    else Builder.CreateRet(llvm::ConstantFP::get(numberType(), 0.0));
 
-    return fn;
+    if(DebugScope){
+        DBuilder->finalizeSubprogram(DebugScope);
+        DebugScope = nullptr;
+        Builder.SetCurrentDebugLocation(llvm::DebugLoc());
+    }
+
+    return pub;
+}
+
+//f32: the body works on floats in the returned <name>.f32, fn keeps the
+//double signature callers, externs and embedders see and only converts.
+//fn is always inlined, between Paradox functions the conversions cancel.
+llvm::Function* CodeGen::createF32Body(llvm::Function* fn){
+    llvm::LLVMContext& C = *TheContext;
+    llvm::Type* flt = llvm::Type::getFloatTy(C);
+    std::vector<llvm::Type*> floats(fn->arg_size(), flt);
+    llvm::Function* body = llvm::Function::Create(llvm::FunctionType::get(flt, floats, false),
+        llvm::Function::InternalLinkage, fn->getName() + ".f32", *TheModule);
+    setFunctionAttributes(body);
+    for(unsigned i = 0; i < fn->arg_size(); i++)
+        body->getArg(i)->setName(fn->getArg(i)->getName());
+
+    fn->addFnAttr(llvm::Attribute::AlwaysInline);
+    llvm::IRBuilder<> B(llvm::BasicBlock::Create(C, "entry", fn));
+    // the wrapper's FP calls and ops carry the same flags as the body
+    B.setFastMathFlags(Builder.getFastMathFlags());
+    std::vector<llvm::Value*> args;
+    for(auto& arg : fn->args())
+        args.push_back(narrow(B, &arg, flt));
+    B.CreateRet(widen(B, B.CreateCall(body, args, "val")));
+    return body;
+}
+
+//fills fn with a call of the returned <name>.body between paradox_perf_enter
+//and paradox_perf_exit (runtime/perf.cpp), which read this thread's
+//counters around the outermost call. the body call is never inlined, so
+//none of its code gets scheduled outside the two reads.
+llvm::Function* CodeGen::createCounted(llvm::Function* fn, const std::string& name){
+    llvm::LLVMContext& C = *TheContext;
+    llvm::Type* voidTy = llvm::Type::getVoidTy(C);
+    llvm::PointerType* ptr = llvm::PointerType::getUnqual(llvm::Type::getInt8Ty(C));
+
+    llvm::Function* body = llvm::Function::Create(fn->getFunctionType(),
+        llvm::Function::InternalLinkage, name + ".body", *TheModule);
+    setFunctionAttributes(body);
+    for(unsigned i = 0; i < fn->arg_size(); i++)
+        body->getArg(i)->setName(fn->getArg(i)->getName());
+
+    //the runtime creates the record when the first call returns and publishes it here
+    auto* slot = new llvm::GlobalVariable(*TheModule, ptr, false,
+        llvm::GlobalValue::InternalLinkage, llvm::ConstantPointerNull::get(ptr), name + ".perf");
+    llvm::FunctionCallee perfEnter = TheModule->getOrInsertFunction("paradox_perf_enter",
+        llvm::FunctionType::get(voidTy, false));
+    llvm::FunctionCallee perfExit = TheModule->getOrInsertFunction("paradox_perf_exit",
+        llvm::FunctionType::get(voidTy, {llvm::PointerType::getUnqual(ptr), ptr}, false));
+
+    llvm::IRBuilder<> B(llvm::BasicBlock::Create(C, "entry", fn));
+    B.setFastMathFlags(Builder.getFastMathFlags());
+    std::vector<llvm::Value*> args;
+    for(auto& arg : fn->args())
+        args.push_back(&arg);
+    B.CreateCall(perfEnter);
+    llvm::CallInst* val = B.CreateCall(body, args, "val");
+    val->addFnAttr(llvm::Attribute::NoInline);
+    B.CreateCall(perfExit, {slot, B.CreateGlobalStringPtr(name)});
+    B.CreateRet(val);
+    return body;
+}
+
+//fills fn with a lookup in a memo table (runtime/memo.cpp) keyed on the
+//argument bits; misses call the returned <name>.impl and store its result.
+//recursive calls go through fn, so they hit the table too. the table
+//holds doubles, f32 arguments and results are converted.
+llvm::Function* CodeGen::createMemoized(llvm::Function* fn, const std::string& name){
+    llvm::LLVMContext& C = *TheContext;
+    llvm::Type* dbl = llvm::Type::getDoubleTy(C);
+    llvm::Type* i32 = llvm::Type::getInt32Ty(C);
+    llvm::PointerType* ptr = llvm::PointerType::getUnqual(llvm::Type::getInt8Ty(C));
+    llvm::PointerType* dblPtr = llvm::PointerType::getUnqual(dbl);
+
+    llvm::Function* impl = llvm::Function::Create(fn->getFunctionType(),
+        llvm::Function::InternalLinkage, name + ".impl", *TheModule);
+    setFunctionAttributes(impl);
+    for(unsigned i = 0; i < fn->arg_size(); i++)
+        impl->getArg(i)->setName(fn->getArg(i)->getName());
+
+    //the runtime creates the table on the first call and publishes it here.
+    //it goes into the set named paradox_memo_tables, which the JIT binds to
+    //its own one (see runtime.h)
+    auto* slot = new llvm::GlobalVariable(*TheModule, ptr, false,
+        llvm::GlobalValue::InternalLinkage, llvm::ConstantPointerNull::get(ptr), name + ".memo");
+    llvm::Constant* tables = TheModule->getOrInsertGlobal("paradox_memo_tables", llvm::Type::getInt8Ty(C));
+    llvm::FunctionCallee memoGet = TheModule->getOrInsertFunction("paradox_memo_get",
+        llvm::FunctionType::get(ptr, {ptr, llvm::PointerType::getUnqual(ptr), ptr, i32}, false));
+    llvm::FunctionCallee memoLookup = TheModule->getOrInsertFunction("paradox_memo_lookup",
+        llvm::FunctionType::get(i32, {ptr, dblPtr, dblPtr}, false));
+    llvm::FunctionCallee memoStore = TheModule->getOrInsertFunction("paradox_memo_store",
+        llvm::FunctionType::get(llvm::Type::getVoidTy(C), {ptr, dblPtr, dbl}, false));
+
+    llvm::BasicBlock* entryBB = llvm::BasicBlock::Create(C, "entry", fn);
+    llvm::BasicBlock* initBB = llvm::BasicBlock::Create(C, "init", fn);
+    llvm::BasicBlock* lookupBB = llvm::BasicBlock::Create(C, "lookup", fn);
+    llvm::BasicBlock* hitBB = llvm::BasicBlock::Create(C, "hit", fn);
+    llvm::BasicBlock* missBB = llvm::BasicBlock::Create(C, "miss", fn);
+    llvm::IRBuilder<> B(entryBB);
+    B.setFastMathFlags(Builder.getFastMathFlags());
+
+    llvm::ArrayType* argsTy = llvm::ArrayType::get(dbl, std::max<size_t>(fn->arg_size(), 1));
+    llvm::Value* args = B.CreateConstInBoundsGEP2_32(argsTy, B.CreateAlloca(argsTy, nullptr, "key"), 0, 0);
+    std::vector<llvm::Value*> callArgs;
+    for(auto& arg : fn->args()){
+        B.CreateStore(widen(B, &arg), B.CreateConstInBoundsGEP1_32(dbl, args, arg.getArgNo()));
+        callArgs.push_back(&arg);
+    }
+    llvm::Value* result = B.CreateAlloca(dbl, nullptr, "cached");
+    llvm::LoadInst* table = B.CreateAlignedLoad(ptr, slot, llvm::MaybeAlign(8), "table");
+    table->setAtomic(llvm::AtomicOrdering::Acquire);
+    B.CreateCondBr(B.CreateIsNull(table), initBB, lookupBB);
+
+    B.SetInsertPoint(initBB);
+    llvm::Value* created = B.CreateCall(memoGet,
+        {tables, slot, B.CreateGlobalStringPtr(name), llvm::ConstantInt::get(i32, fn->arg_size())});
+    B.CreateBr(lookupBB);
+
+    B.SetInsertPoint(lookupBB);
+    llvm::PHINode* tab = B.CreatePHI(ptr, 2, "tab");
+    tab->addIncoming(table, entryBB);
+    tab->addIncoming(created, initBB);
+    llvm::Value* hit = B.CreateCall(memoLookup, {tab, args, result});
+    B.CreateCondBr(B.CreateICmpNE(hit, llvm::ConstantInt::get(i32, 0)), hitBB, missBB);
+
+    B.SetInsertPoint(hitBB);
+    B.CreateRet(narrow(B, B.CreateLoad(dbl, result), fn->getReturnType()));
+
+    B.SetInsertPoint(missBB);
+    llvm::Value* val = B.CreateCall(impl, callArgs, "val");
+    B.CreateCall(memoStore, {tab, args, widen(B, val)});
+    B.CreateRet(val);
+
+    return impl;
+}
+
+//comparisons give i1, everything else in Paradox is a number
+llvm::Value* CodeGen::toNumber(llvm::Value* v){
+    if(v && v->getType()->isIntegerTy(1))
+        return Builder.CreateUIToFP(v, numberType(), "booltmp");
+    return v;
+}
+
+//any non zero number counts as true
+llvm::Value* CodeGen::toCondition(llvm::Value* v){
+    if(!v || v->getType()->isIntegerTy(1)) return v;
+    return Builder.CreateFCmpONE(v, llvm::ConstantFP::get(v->getType(), 0.0), "condtmp");
 }
 
-llvm::Value* codegenIf(IfStmtAST* node){
-    llvm::Value* cond = codegen(node->Condition.get());
+//value of a block is its last statement, an empty block gives 0.0
+llvm::Value* CodeGen::codegenBlock(std::vector<std::unique_ptr<ASTNode>>& stmts){
+    llvm::Value* last = llvm::ConstantFP::get(numberType(), 0.0);
+    for (auto& stmt : stmts){
+        last = codegen(stmt.get());
+        if(!last) return nullptr;
+    }
+    return toNumber(last);
+}
+
+//an if arm can be evaluated unconditionally when it only reads variables:
+//no calls (could be slow or recurse), no assignments, no loops. budget
+//caps how much work we are willing to do speculatively.
+static bool isCheapAndPure(ASTNode* node, int& budget){
+    if(--budget < 0) return false;
+    if(dynamic_cast<NumberExprAST*>(node) || dynamic_cast<VariableExprAST*>(node))
+        return true;
+    if(auto* n = dynamic_cast<BinaryExprAST*>(node))
+        return isCheapAndPure(n->lhs.get(), budget) && isCheapAndPure(n->rhs.get(), budget);
+    if(auto* n = dynamic_cast<IfStmtAST*>(node)){
+        if(!isCheapAndPure(n->Condition.get(), budget)) return false;
+        for(auto& s : n->Then) if(!isCheapAndPure(s.get(), budget)) return false;
+        for(auto& s : n->Else) if(!isCheapAndPure(s.get(), budget)) return false;
+        return true;
+    }
+    return false;
+}
+
+static bool canSelect(IfStmtAST* node){
+    int budget = 16; // AST nodes over both arms
+    for(auto& s : node->Then) if(!isCheapAndPure(s.get(), budget)) return false;
+    for(auto& s : node->Else) if(!isCheapAndPure(s.get(), budget)) return false;
+    return true;
+}
+
+//if is an expression: its value is the value of the arm that ran
+llvm::Value* CodeGen::codegenIf(IfStmtAST* node){
+    llvm::Value* cond = toCondition(codegen(node->Condition.get()));
     if(!cond) return nullptr;
 
+    //both arms are cheap and side effect free: compute both and pick one.
+    //no branch to mispredict, and select can be vectorized inside loops
+    if(canSelect(node)){
+        llvm::Value* thenV = codegenBlock(node->Then);
+        llvm::Value* elseV = codegenBlock(node->Else);
+        if(!thenV || !elseV) return nullptr;
+        return Builder.CreateSelect(cond, thenV, elseV, "iftmp");
+    }
+
     llvm::Function* fn = Builder.GetInsertBlock()->getParent();
 
     //add then block to fn imediately after its creation, thats what fn in below arg tells
-    llvm::BasicBlock* thenBB = llvm::BasicBlock::Create(TheContext,"then",fn);
-    llvm::BasicBlock* elseBB = llvm::BasicBlock::Create(TheContext,"else");
-    llvm::BasicBlock* mergeBB = llvm::BasicBlock::Create(TheContext,"merge");
+    llvm::BasicBlock* thenBB = llvm::BasicBlock::Create(*TheContext,"then",fn);
+    llvm::BasicBlock* elseBB = llvm::BasicBlock::Create(*TheContext,"else");
+    llvm::BasicBlock* mergeBB = llvm::BasicBlock::Create(*TheContext,"merge");
 
     //branch to blocks based on condition
     Builder.CreateCondBr(cond, thenBB, elseBB);
@@ -141,34 +532,40 @@ llvm::Value* codegenIf(IfStmtAST* node){
     //direct builder to write into then block
     Builder.SetInsertPoint(thenBB);
 
-    for (auto& stmt : node->Then)
-        codegen(stmt.get());
+    llvm::Value* thenV = codegenBlock(node->Then);
+    if(!thenV) return nullptr;
     Builder.CreateBr(mergeBB);
+    //nested ifs/cycles move the builder, the phi needs the block we ended in
+    thenBB = Builder.GetInsertBlock();
 
     fn->insert(fn->end(), elseBB);
     Builder.SetInsertPoint(elseBB);
-    for (auto& stmt : node->Else)
-        codegen(stmt.get());
+    llvm::Value* elseV = codegenBlock(node->Else);
+    if(!elseV) return nullptr;
     Builder.CreateBr(mergeBB);
+    elseBB = Builder.GetInsertBlock();
 
     fn->insert(fn->end(), mergeBB);
     Builder.SetInsertPoint(mergeBB);
 
-    return llvm::ConstantFP::get(TheContext, llvm::APFloat(0.0));
+    llvm::PHINode* phi = Builder.CreatePHI(numberType(), 2, "iftmp");
+    phi->addIncoming(thenV, thenBB);
+    phi->addIncoming(elseV, elseBB);
+    return phi;
 }
 
-llvm::Value* codegenCycle(CycleStmtAST* node){
+llvm::Value* CodeGen::codegenCycle(CycleStmtAST* node){
 
     llvm::Function* fn = Builder.GetInsertBlock()->getParent();
 
-    llvm::BasicBlock* condBB  = llvm::BasicBlock::Create(TheContext, "cond", fn);
-    llvm::BasicBlock* bodyBB  = llvm::BasicBlock::Create(TheContext, "body");
-    llvm::BasicBlock* afterBB = llvm::BasicBlock::Create(TheContext, "after");
+    llvm::BasicBlock* condBB  = llvm::BasicBlock::Create(*TheContext, "cond", fn);
+    llvm::BasicBlock* bodyBB  = llvm::BasicBlock::Create(*TheContext, "body");
+    llvm::BasicBlock* afterBB = llvm::BasicBlock::Create(*TheContext, "after");
 
     Builder.CreateBr(condBB);
 
     Builder.SetInsertPoint(condBB);
-    llvm::Value* cond = codegen(node->Condition.get());
+    llvm::Value* cond = toCondition(codegen(node->Condition.get()));
     if (!cond) return nullptr;
     Builder.CreateCondBr(cond, bodyBB, afterBB);
 
@@ -181,10 +578,192 @@ llvm::Value* codegenCycle(CycleStmtAST* node){
     fn->insert(fn->end(), afterBB);
     Builder.SetInsertPoint(afterBB);
 
-    return llvm::ConstantFP::get(TheContext, llvm::APFloat(0.0));
+    return llvm::ConstantFP::get(numberType(), 0.0);
+}
+
+static double reductionIdentity(char op){
+    switch(op){
+        case '*': return 1.0;
+        case '<': return HUGE_VAL;
+        case '>': return -HUGE_VAL;
+        default:  return 0.0;
+    }
+}
+
+//pcycle: the body is outlined into <fn>.pcycle.N(env, lo, hi, red), a
+//plain loop over iterations [lo, hi) with its own copy of every variable.
+//paradox_pfor (runtime/parallel.cpp) calls it on chunks from its threads.
+//env holds every variable visible here plus the start value, red the
+//reduction variables (in/out around the call, per chunk inside the body).
+llvm::Value* CodeGen::codegenPCycle(PCycleStmtAST* node){
+    llvm::LLVMContext& C = *TheContext;
+    llvm::Type* dbl = llvm::Type::getDoubleTy(C);
+    llvm::Type* num = numberType();
+    llvm::Type* i64 = llvm::Type::getInt64Ty(C);
+    llvm::PointerType* dblPtr = llvm::PointerType::getUnqual(dbl);
+    llvm::Function* parent = Builder.GetInsertBlock()->getParent();
+
+    //env and red are doubles for the runtime, f32 numbers are converted
+    llvm::Value* start = widen(Builder, toNumber(codegen(node->Start.get())));
+    llvm::Value* end = widen(Builder, toNumber(codegen(node->End.get())));
+    if(!start || !end) return nullptr;
+
+    //a reduction variable that doesn't exist yet starts at the identity
+    for(auto& [op, name] : node->Reductions){
+        llvm::AllocaInst*& slot = NamedValues[name];
+        if(slot) continue;
+        slot = createEntryAlloca(parent, name);
+        Builder.CreateStore(llvm::ConstantFP::get(num, reductionIdentity(op)), slot);
+    }
+    std::vector<std::string> captured;
+    for(auto& [name, slot] : NamedValues)
+        if(slot) captured.push_back(name);
+
+    //outlined body, generated with a fresh symbol table
+    llvm::FunctionType* bodyTy = llvm::FunctionType::get(llvm::Type::getVoidTy(C),
+        {dblPtr, i64, i64, dblPtr}, false);
+    llvm::Function* body = llvm::Function::Create(bodyTy, llvm::Function::InternalLinkage,
+        parent->getName() + ".pcycle." + std::to_string(PCycleCount++), *TheModule);
+    setFunctionAttributes(body);
+    llvm::Value* env = body->getArg(0);
+    llvm::Value* lo = body->getArg(1);
+    llvm::Value* hi = body->getArg(2);
+    llvm::Value* red = body->getArg(3);
+    env->setName("env");
+    lo->setName("lo");
+    hi->setName("hi");
+    red->setName("red");
+
+    llvm::BasicBlock* resume = Builder.GetInsertBlock();
+    std::map<std::string, llvm::AllocaInst*> outer = std::move(NamedValues);
+    NamedValues.clear();
+    llvm::DISubprogram* outerScope = DebugScope;
+    llvm::DebugLoc outerLoc = Builder.getCurrentDebugLocation();
+    if(DBuilder){
+        DebugScope = createDebugFunction(body, body->getName().str(), node->Loc.Line, true);
+        setDebugLocation(node->Loc);
+    }
+
+    Builder.SetInsertPoint(llvm::BasicBlock::Create(C, "entry", body));
+    for(size_t k = 0; k < captured.size(); k++){
+        llvm::AllocaInst* slot = createEntryAlloca(body, captured[k]);
+        Builder.CreateStore(narrow(Builder, Builder.CreateLoad(dbl,
+            Builder.CreateConstInBoundsGEP1_64(dbl, env, k)), num), slot);
+        NamedValues[captured[k]] = slot;
+    }
+    llvm::Value* base = Builder.CreateLoad(dbl,
+        Builder.CreateConstInBoundsGEP1_64(dbl, env, captured.size()), "base");
+    for(size_t k = 0; k < node->Reductions.size(); k++)
+        Builder.CreateStore(narrow(Builder, Builder.CreateLoad(dbl,
+                                Builder.CreateConstInBoundsGEP1_64(dbl, red, k)), num),
+                            NamedValues[node->Reductions[k].second]);
+    llvm::AllocaInst*& var = NamedValues[node->Var];
+    if(!var) var = createEntryAlloca(body, node->Var);
+    llvm::AllocaInst* iv = llvm::IRBuilder<>(&body->getEntryBlock(),
+        body->getEntryBlock().begin()).CreateAlloca(i64, nullptr, "idx");
+    Builder.CreateStore(lo, iv);
+
+    llvm::BasicBlock* condBB = llvm::BasicBlock::Create(C, "cond", body);
+    llvm::BasicBlock* loopBB = llvm::BasicBlock::Create(C, "body", body);
+    llvm::BasicBlock* exitBB = llvm::BasicBlock::Create(C, "exit", body);
+    Builder.CreateBr(condBB);
+
+    Builder.SetInsertPoint(condBB);
+    llvm::Value* idx = Builder.CreateLoad(i64, iv, "i");
+    Builder.CreateCondBr(Builder.CreateICmpSLT(idx, hi), loopBB, exitBB);
+
+    Builder.SetInsertPoint(loopBB);
+    Builder.CreateStore(narrow(Builder, Builder.CreateFAdd(base, Builder.CreateSIToFP(idx, dbl)), num),
+                        NamedValues[node->Var]);
+    bool ok = true;
+    for(auto& stmt : node->Body)
+        if(!codegen(stmt.get())){
+            ok = false;
+            break;
+        }
+    if(ok){
+        Builder.CreateStore(Builder.CreateAdd(idx, llvm::ConstantInt::get(i64, 1)), iv);
+        Builder.CreateBr(condBB);
+
+        Builder.SetInsertPoint(exitBB);
+        for(size_t k = 0; k < node->Reductions.size(); k++)
+            Builder.CreateStore(widen(Builder, Builder.CreateLoad(num, NamedValues[node->Reductions[k].second])),
+                                Builder.CreateConstInBoundsGEP1_64(dbl, red, k));
+        Builder.CreateRetVoid();
+    }
+
+    NamedValues = std::move(outer);
+    Builder.SetInsertPoint(resume);
+    if(DBuilder){
+        DBuilder->finalizeSubprogram(DebugScope);
+        DebugScope = outerScope;
+        Builder.SetCurrentDebugLocation(outerLoc);
+    }
+    if(!ok){
+        body->eraseFromParent();
+        return nullptr;
+    }
+
+    //snapshot the variables and call into the runtime
+    llvm::IRBuilder<> entry(&parent->getEntryBlock(), parent->getEntryBlock().begin());
+    llvm::ArrayType* envTy = llvm::ArrayType::get(dbl, captured.size() + 1);
+    llvm::ArrayType* redTy = llvm::ArrayType::get(dbl, std::max<size_t>(node->Reductions.size(), 1));
+    llvm::Value* envArr = Builder.CreateConstInBoundsGEP2_32(envTy, entry.CreateAlloca(envTy, nullptr, "env"), 0, 0);
+    llvm::Value* redArr = Builder.CreateConstInBoundsGEP2_32(redTy, entry.CreateAlloca(redTy, nullptr, "red"), 0, 0);
+    for(size_t k = 0; k < captured.size(); k++)
+        Builder.CreateStore(widen(Builder, Builder.CreateLoad(num, NamedValues[captured[k]])),
+                            Builder.CreateConstInBoundsGEP1_64(dbl, envArr, k));
+    Builder.CreateStore(start, Builder.CreateConstInBoundsGEP1_64(dbl, envArr, captured.size()));
+    std::string ops;
+    for(size_t k = 0; k < node->Reductions.size(); k++){
+        ops += node->Reductions[k].first;
+        Builder.CreateStore(widen(Builder, Builder.CreateLoad(num, NamedValues[node->Reductions[k].second])),
+                            Builder.CreateConstInBoundsGEP1_64(dbl, redArr, k));
+    }
+
+    //trip count: ceil(end - start) when positive, like cycle(i < end).
+    //span goes into range before the conversion, fptosi of NaN or of
+    //anything past i64 is poison: NaN (no ordered compare holds) and <= 0
+    //run nothing, and it stops at 2^53, past which i + 1 == i and the
+    //serial loop wouldn't end either
+    llvm::Value* span = Builder.CreateFSub(end, start, "span");
+    llvm::Value* positive = Builder.CreateSelect(
+        Builder.CreateFCmpOGT(span, llvm::ConstantFP::get(dbl, 0.0)),
+        span, llvm::ConstantFP::get(dbl, 0.0), "positive");
+    llvm::Value* bounded = Builder.CreateMinNum(positive, llvm::ConstantFP::get(dbl, 0x1p53), "bounded");
+    llvm::Value* count = Builder.CreateFPToSI(
+        Builder.CreateUnaryIntrinsic(llvm::Intrinsic::ceil, bounded), i64, "count");
+
+    llvm::Type* i32 = llvm::Type::getInt32Ty(C);
+    llvm::PointerType* i8Ptr = llvm::PointerType::getUnqual(llvm::Type::getInt8Ty(C));
+    llvm::FunctionCallee pfor = TheModule->getOrInsertFunction("paradox_pfor",
+        llvm::FunctionType::get(llvm::Type::getVoidTy(C),
+            {llvm::PointerType::getUnqual(bodyTy), dblPtr, i64, i32, i8Ptr, dblPtr}, false));
+    Builder.CreateCall(pfor, {body, envArr, count,
+        llvm::ConstantInt::get(i32, node->Reductions.size()),
+        Builder.CreateGlobalStringPtr(ops, "pcycle.ops"), redArr});
+
+    for(size_t k = 0; k < node->Reductions.size(); k++)
+        Builder.CreateStore(narrow(Builder, Builder.CreateLoad(dbl,
+                                Builder.CreateConstInBoundsGEP1_64(dbl, redArr, k)), num),
+                            NamedValues[node->Reductions[k].second]);
+
+    return llvm::ConstantFP::get(num, 0.0);
+}
+
+//with debug info, instructions get the location of the innermost node being
+//generated; it is restored afterwards, so the fadd of a + b points at '+'
+llvm::Value* CodeGen::codegen(ASTNode* node) {
+    if (!DebugScope || !node->Loc.Line)
+        return codegenNode(node);
+    llvm::DebugLoc outer = Builder.getCurrentDebugLocation();
+    setDebugLocation(node->Loc);
+    llvm::Value* v = codegenNode(node);
+    Builder.SetCurrentDebugLocation(outer);
+    return v;
 }
 
-llvm::Value* codegen(ASTNode* node) {
+llvm::Value* CodeGen::codegenNode(ASTNode* node) {
     if (auto* n = dynamic_cast<NumberExprAST*>(node))
         return codegenNumber(n);
     if (auto* n = dynamic_cast<VariableExprAST*>(node))
@@ -199,6 +778,8 @@ llvm::Value* codegen(ASTNode* node) {
         return codegenIf(n);
     if (auto* n = dynamic_cast<CycleStmtAST*>(node))
         return codegenCycle(n);
+    if (auto* n = dynamic_cast<PCycleStmtAST*>(node))
+        return codegenPCycle(n);
 
     std::cerr << "Unknown AST node\n";
     return nullptr;
@@ -1,35 +1,103 @@
 #pragma once
 
 #include "../parser/parser.h"
+#include "debug.h"
+#include "../target/target.h"
+#include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Value.h"
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
 
-//All LLVM objects (types, constants, functions) are stored inside it. 
-// just pass it to everything that needs to create something
-extern llvm::LLVMContext TheContext;
-// generates the IR
-extern llvm::IRBuilder<> Builder;
-// holds all our functions. At the end we print this to get your IR.
-extern llvm::Module TheModule;
-
-// Symbol table
-extern std::map<std::string, llvm::Value*> NamedValues;
-
-// One function per AST node
-//Value* is a pointer to the result of any computation in LLVM.
-llvm::Value*    codegenNumber   (NumberExprAST*   node);
-llvm::Value*    codegenVariable (VariableExprAST* node);
-llvm::Value*    codegenBinary   (BinaryExprAST*   node);
-llvm::Value*    codegenCall     (CallExprAST*      node);
-llvm::Value*    codegenAssign   (AssignExprAST*   node);
-llvm::Value*    codegenIf       (IfStmtAST*        node);
-llvm::Value*    codegenCycle    (CycleStmtAST*    node);
-llvm::Function* codegenPrototype(PrototypeAST*    node);
-llvm::Function* codegenFunction (FunctionAST*     node);
-
-//calls the right function based on node type
-llvm::Value* codegen(ASTNode* node);
+// Code generator state for one module.
+// Nothing is shared between CodeGen objects, so each one can be used on its
+// own thread; a single CodeGen is not thread-safe.
+class CodeGen {
+public:
+    //All LLVM objects (types, constants, functions) are stored inside it.
+    // just pass it to everything that needs to create something
+    std::unique_ptr<llvm::LLVMContext> TheContext;
+    // holds all our functions. At the end we print this to get your IR.
+    // can be moved out (together with TheContext) e.g. into the JIT
+    std::unique_ptr<llvm::Module> TheModule;
+    // generates the IR
+    llvm::IRBuilder<> Builder;
+
+    // Symbol table
+    // every variable (params included) lives in an entry block alloca, so loops
+    // and branches can reassign it. mem2reg turns them back into SSA values.
+    std::map<std::string, llvm::AllocaInst*> NamedValues;
+
+    // functions to wrap with a memo table (must be pure, see analysis/purity.h)
+    std::set<std::string> Memoize;
+    // functions to measure with performance counters on every call from
+    // outside Paradox code (see --perf-calls, runtime/perf.h)
+    std::set<std::string> PerfCalls;
+
+    explicit CodeGen(const std::string& moduleName = "paradoxCC");
+
+    // FP semantics for everything generated from now on (default strict)
+    void setFPOptions(const FPOptions& fp);
+    // sets the module's triple and data layout for spec, and target-cpu /
+    // target-features on every function generated from now on. false (and
+    // reports) if no TargetMachine can be made for it.
+    bool setTarget(const TargetSpec& spec);
+
+    // DWARF for everything generated from now on: a subprogram per function,
+    // source lines on every instruction and the variables. sourcePath is the
+    // file the AST's locations refer to. Call finalizeDebugInfo() when done.
+    void enableDebugInfo(const std::string& sourcePath);
+    void finalizeDebugInfo();
+
+    // One function per AST node
+    //Value* is a pointer to the result of any computation in LLVM.
+    llvm::Value*    codegenNumber   (NumberExprAST*   node);
+    llvm::Value*    codegenVariable (VariableExprAST* node);
+    llvm::Value*    codegenBinary   (BinaryExprAST*   node);
+    llvm::Value*    codegenCall     (CallExprAST*      node);
+    llvm::Value*    codegenAssign   (AssignExprAST*   node);
+    llvm::Value*    codegenIf       (IfStmtAST*        node);
+    llvm::Value*    codegenCycle    (CycleStmtAST*    node);
+    llvm::Value*    codegenPCycle   (PCycleStmtAST*   node);
+    llvm::Function* codegenPrototype(PrototypeAST*    node);
+    llvm::Function* codegenFunction (FunctionAST*     node);
+
+    //calls the right function based on node type
+    llvm::Value* codegen(ASTNode* node);
+
+private:
+    llvm::Value* codegenNode(ASTNode* node);
+    llvm::Value* codegenExpr(ASTNode* root);
+    llvm::Value* emitBinary(char op, llvm::Value* L, llvm::Value* R);
+    // argNo > 0 marks a parameter for the debug info
+    llvm::AllocaInst* createEntryAlloca(llvm::Function* fn, const std::string& name,
+                                        unsigned argNo = 0);
+    // double, or float with --precision=f32 (FPOptions::F32)
+    llvm::Type* numberType();
+    llvm::DIType* debugNumberType();
+    llvm::Value* toNumber(llvm::Value* v);
+    llvm::Value* toCondition(llvm::Value* v);
+    llvm::Value* codegenBlock(std::vector<std::unique_ptr<ASTNode>>& stmts);
+    llvm::Function* createF32Body(llvm::Function* fn);
+    llvm::Function* createMemoized(llvm::Function* fn, const std::string& name);
+    llvm::Function* createCounted(llvm::Function* fn, const std::string& name);
+    // per function settings (FP mode, ...) on every function we create
+    void setFunctionAttributes(llvm::Function* fn);
+
+    FPOptions FP;
+    TargetSpec Target;
+
+    std::unique_ptr<llvm::DIBuilder> DBuilder;
+    llvm::DIFile* DebugFile = nullptr;
+    llvm::DISubprogram* DebugScope = nullptr;  // function being generated
+    llvm::DISubprogram* createDebugFunction(llvm::Function* fn, const std::string& name,
+                                            unsigned line, bool artificial);
+    void setDebugLocation(SourceLoc loc);
+
+    // numbers the outlined pcycle bodies
+    unsigned PCycleCount = 0;
+};
@@ -0,0 +1,9 @@
+#pragma once
+
+// Debugger / profiler support (-g, --perf).
+// CodeGen emits the debug info, the JIT registers the code it loads.
+struct DebugOptions {
+    bool DebugInfo = false;  // DWARF line tables and variables in the IR
+    bool GDB = false;        // JIT: register code with GDB's JIT interface
+    bool Perf = false;       // JIT: write a jitdump and /tmp/perf-<pid>.map
+};
@@ -0,0 +1,139 @@
+#include "frontend.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <iostream>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedSource::~MappedSource() {
+    if (Data) munmap(const_cast<char*>(Data), Size);
+}
+
+bool MappedSource::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Cannot open " << path << "\n";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        std::cerr << "Cannot stat " << path << "\n";
+        close(fd);
+        return false;
+    }
+    // an empty file can't be mapped, and has nothing to map anyway
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "Cannot map " << path << "\n";
+        return false;
+    }
+    // read front to back, once per pass
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    Data = static_cast<const char*>(p);
+    Size = st.st_size;
+    return true;
+}
+
+// chunks smaller than this aren't worth a thread
+static constexpr size_t MinChunkBytes = 256 * 1024;
+
+bool isDefinitionAt(std::string_view src, size_t i) {
+    return src.compare(i, 3, "def") == 0
+        && (i == 0 || !isalnum((unsigned char)src[i - 1]))
+        && (i + 3 == src.size() || !isalnum((unsigned char)src[i + 3]));
+}
+
+std::vector<SourceChunk> splitAtDefinitions(std::string_view src, size_t maxChunks) {
+    SourceChunk whole;
+    whole.End = src.size();
+    if (maxChunks <= 1) return {whole};
+
+    // one serial pass over the bytes: much cheaper than lexing them, and the
+    // only way to know the brace depth (and line) at any point
+    std::vector<SourceChunk> chunks{whole};
+    size_t target = src.size() / maxChunks;
+    size_t nextCut = target;
+    long depth = 0;
+    unsigned line = 1;
+    size_t lineStart = 0;
+    for (size_t i = 0; i < src.size(); i++) {
+        char c = src[i];
+        if (c == '\n') {
+            line++;
+            lineStart = i + 1;
+        }
+        else if (c == '#') {
+            // comment: braces and defs in it don't count
+            while (i + 1 < src.size() && src[i + 1] != '\n' && src[i + 1] != '\r') i++;
+        }
+        else if (c == '{') {
+            depth++;
+        }
+        else if (c == '}') {
+            if (--depth < 0) return {whole};
+        }
+        else if (c == 'd' && depth == 0 && i >= nextCut && isDefinitionAt(src, i)) {
+            chunks.back().End = i;
+            SourceChunk next;
+            next.Begin = i;
+            next.Line = line;
+            next.Col = i - lineStart + 1;
+            chunks.push_back(next);
+            nextCut = i + target;
+        }
+    }
+    if (depth != 0) return {whole};
+    chunks.back().End = src.size();
+    return chunks;
+}
+
+static std::unique_ptr<ProgramAST> parseChunk(std::string_view src, const SourceChunk& chunk,
+                                              unsigned maxNesting) {
+    Lexer lexer(src.substr(chunk.Begin, chunk.End - chunk.Begin), chunk.Line, chunk.Col);
+    Parser parser(lexer);
+    parser.MaxExprNesting = parser.MaxBlockNesting = maxNesting;
+    return parser.parseProgram();
+}
+
+std::unique_ptr<ProgramAST> parseParallel(std::string_view src, unsigned threads,
+                                          unsigned maxNesting) {
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    // a few chunks per thread, so one slow chunk doesn't hold up the rest
+    size_t wanted = std::min<size_t>(threads == 1 ? 1 : threads * 4,
+                                     src.size() / MinChunkBytes + 1);
+    std::vector<SourceChunk> chunks = splitAtDefinitions(src, wanted);
+
+    std::vector<std::unique_ptr<ProgramAST>> parts(chunks.size());
+    std::atomic<size_t> next{0};
+    auto work = [&] {
+        for (size_t c; (c = next++) < chunks.size();)
+            parts[c] = parseChunk(src, chunks[c], maxNesting);
+    };
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < std::min<size_t>(threads, chunks.size()); t++)
+        workers.emplace_back(work);
+    work();
+    for (auto& w : workers)
+        w.join();
+
+    for (auto& part : parts)
+        if (!part) return nullptr;
+    std::unique_ptr<ProgramAST> program = std::move(parts[0]);
+    for (size_t c = 1; c < parts.size(); c++) {
+        for (auto& fn : parts[c]->Functions)
+            program->addFunction(std::move(fn));
+        for (auto& ext : parts[c]->Externs)
+            program->addExtern(std::move(ext));
+    }
+    return program;
+}
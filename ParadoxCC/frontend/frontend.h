@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../parser/parser.h"
+
+// A source file mapped read-only, so a huge generated file is lexed in
+// place instead of being read into a string first.
+class MappedSource {
+    const char* Data = nullptr;
+    size_t Size = 0;
+
+public:
+    MappedSource() = default;
+    ~MappedSource();
+    MappedSource(const MappedSource&) = delete;
+    MappedSource& operator=(const MappedSource&) = delete;
+
+    // false (and reports) if the file can't be opened or mapped
+    bool open(const std::string& path);
+    std::string_view text() const { return {Data, Size}; }
+};
+
+// "def" as a whole token at src[i], the same way the lexer would see it
+bool isDefinitionAt(std::string_view src, size_t i);
+
+// [Begin, End) of a source, starting at Line / Col
+struct SourceChunk {
+    size_t Begin = 0, End = 0;
+    unsigned Line = 1, Col = 1;
+};
+
+// cuts src into about maxChunks pieces, each starting at a top-level 'def'
+// (brace depth 0, not in a comment). A single chunk if there is no such
+// place or the braces don't balance: then the parser reports the error
+// just like it would for the whole file.
+std::vector<SourceChunk> splitAtDefinitions(std::string_view src, size_t maxChunks);
+
+// lexes and parses src on threads (0 = one per core): the chunks from
+// splitAtDefinitions are parsed independently and their functions and
+// externs concatenated in source order. Small sources are parsed on the
+// calling thread. nullptr (errors go to stderr) if any chunk fails.
+std::unique_ptr<ProgramAST> parseParallel(std::string_view src, unsigned threads,
+                                          unsigned maxNesting = DefaultMaxNesting);
@@ -0,0 +1,454 @@
+#include "incremental.h"
+#include "frontend.h"
+#include "../analysis/callgraph.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+
+IncrementalFrontend::IncrementalFrontend(std::string source, const std::string& moduleName,
+                                         unsigned maxNesting)
+    : MaxNesting(maxNesting), CG(moduleName) {
+    // an empty item to replace, so the first parse is just a big edit
+    Item* seed = new Item;
+    seed->AST = std::make_unique<ProgramAST>();
+    Items.push_back(seed);
+    Offsets.push_back(0);
+    LineNumbers.push_back(1);
+    replaceItems(0, 0, std::move(source));
+}
+
+IncrementalFrontend::~IncrementalFrontend() {
+    for (Item* item : Items)
+        delete item;
+}
+
+size_t IncrementalFrontend::size() const {
+    return offset(Items.size() - 1) + Items.back()->Text.size();
+}
+
+std::string IncrementalFrontend::text() const {
+    std::string s;
+    s.reserve(size());
+    for (auto& item : Items)
+        s += item->Text;
+    return s;
+}
+
+std::vector<FunctionAST*> IncrementalFrontend::functions() const {
+    std::vector<FunctionAST*> fns;
+    for (auto& item : Items)
+        if (item->AST)
+            for (auto& fn : item->AST->Functions)
+                fns.push_back(fn.get());
+    return fns;
+}
+
+size_t IncrementalFrontend::itemAt(size_t offset) const {
+    // the first item starting after offset, minus one
+    size_t lo = 0, hi = Items.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (this->offset(mid) <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo == 0 ? 0 : lo - 1;
+}
+
+bool IncrementalFrontend::edit(size_t begin, size_t end, std::string_view text) {
+    size_t total = size();
+    if (begin > end || end > total) {
+        std::cerr << "Edit [" << begin << ", " << end << ") is outside the source ("
+                  << total << " bytes)\n";
+        return false;
+    }
+    // from the item holding the byte before the edit (the edit may continue
+    // its last token) to the one holding the byte after it. The first byte
+    // of the region is never edited, so it still starts where an item can.
+    size_t first = itemAt(begin ? begin - 1 : 0), last = itemAt(end);
+    size_t regionBegin = offset(first);
+    std::string region;
+    for (size_t i = first; i <= last; i++)
+        region += Items[i]->Text;
+    region.replace(begin - regionBegin, end - begin, text);
+    // a region ending mid-line could run into the next item (an unclosed
+    // comment, an identifier touching its 'def'): take that one in as well
+    while (last + 1 < Items.size() && !region.empty() && region.back() != '\n')
+        region += Items[++last]->Text;
+    replaceItems(first, last, std::move(region));
+    return true;
+}
+
+void IncrementalFrontend::replaceItems(size_t first, size_t last, std::string region) {
+    size_t begin = offset(first);
+    unsigned line = this->line(first), col = Items[first]->Col;
+    size_t oldSize = offset(last) + Items[last]->Text.size() - begin;
+
+    // an item at every 'def' that isn't in a comment
+    std::vector<size_t> starts{0};
+    for (size_t i = 0; i < region.size(); i++) {
+        if (region[i] == '#') {
+            while (i + 1 < region.size() && region[i + 1] != '\n' && region[i + 1] != '\r') i++;
+        }
+        else if (region[i] == 'd' && i > 0 && isDefinitionAt(region, i)) {
+            starts.push_back(i);
+        }
+    }
+    starts.push_back(region.size());
+    size_t pieces = starts.size() - 1;
+    auto piece = [&](size_t s) {
+        return std::string_view(region).substr(starts[s], starts[s + 1] - starts[s]);
+    };
+    // line / col after text that starts at line / col
+    auto skip = [&](std::string_view text) {
+        line += std::count(text.begin(), text.end(), '\n');
+        size_t nl = text.rfind('\n');
+        col = nl == std::string_view::npos ? col + text.size() : text.size() - nl;
+    };
+
+    // old items at either end that come out the same are kept as they are
+    // (an edit at the start of an item also takes in the one before it).
+    // Kept items at the end must start a line, or their columns change.
+    size_t oldCount = last - first + 1, front = 0, back = 0;
+    while (front < std::min(pieces, oldCount) && piece(front) == Items[first + front]->Text)
+        front++;
+    while (back < std::min(pieces, oldCount) - front
+           && piece(pieces - 1 - back) == Items[last - back]->Text
+           && Items[last - back]->Col == 1
+           && starts[pieces - 1 - back] > 0 && region[starts[pieces - 1 - back] - 1] == '\n')
+        back++;
+
+    long lineDelta = 0;
+    for (size_t i = first + front; i + back <= last; i++) {
+        lineDelta -= Items[i]->Lines;
+        retire(*Items[i]);
+    }
+    for (size_t s = 0; s < front; s++)
+        skip(piece(s));
+
+    std::vector<Item*> fresh;
+    std::vector<size_t> offsets;
+    std::vector<unsigned> lines;
+    for (size_t s = front; s + back < pieces; s++) {
+        Item* item = new Item;
+        item->Text = piece(s);
+        item->Col = col;
+        item->Lines = std::count(item->Text.begin(), item->Text.end(), '\n');
+        offsets.push_back(begin + starts[s]);
+        lines.push_back(line);
+        skip(item->Text);
+        lineDelta += item->Lines;
+        fresh.push_back(item);
+    }
+
+    size_t at = first + front, count = fresh.size(), removed = last + 1 - back - at;
+    // entries before the ones below the edit have to be exact
+    shift(at + removed, 0, 0);
+    for (size_t i = at; i < at + removed; i++)
+        delete Items[i];
+    // the same number of items (the usual case) is replaced in place
+    size_t same = std::min(count, removed);
+    std::copy(fresh.begin(), fresh.begin() + same, Items.begin() + at);
+    std::copy(offsets.begin(), offsets.begin() + same, Offsets.begin() + at);
+    std::copy(lines.begin(), lines.begin() + same, LineNumbers.begin() + at);
+    if (removed > count) {
+        Items.erase(Items.begin() + at + same, Items.begin() + at + removed);
+        Offsets.erase(Offsets.begin() + at + same, Offsets.begin() + at + removed);
+        LineNumbers.erase(LineNumbers.begin() + at + same, LineNumbers.begin() + at + removed);
+    }
+    else if (count > removed) {
+        Items.insert(Items.begin() + at + same, fresh.begin() + same, fresh.end());
+        Offsets.insert(Offsets.begin() + at + same, offsets.begin() + same, offsets.end());
+        LineNumbers.insert(LineNumbers.begin() + at + same, lines.begin() + same, lines.end());
+    }
+    ShiftFrom = ShiftFrom - removed + count;
+    // the ones below keep their AST, only their position moves
+    shift(at + count, (long)region.size() - (long)oldSize, lineDelta);
+
+    number(at, count);
+    LastEdit = {0, count, 0};
+    for (size_t i = at; i < at + count; i++) {
+        parseItem(*Items[i]);
+        LastEdit.Bytes += Items[i]->Text.size();
+    }
+}
+
+void IncrementalFrontend::shift(size_t from, long bytes, long lines) {
+    // the pending shift moves to from, adding this one; only the entries
+    // between the two are written (they may wrap around for a while)
+    for (size_t i = from; i < ShiftFrom && i < Items.size(); i++) {
+        Offsets[i] -= ShiftBytes;
+        LineNumbers[i] -= ShiftLines;
+    }
+    for (size_t i = ShiftFrom; i < from && i < Items.size(); i++) {
+        Offsets[i] += ShiftBytes;
+        LineNumbers[i] += ShiftLines;
+    }
+    ShiftFrom = from;
+    ShiftBytes += bytes;
+    ShiftLines += lines;
+}
+
+void IncrementalFrontend::number(size_t at, size_t count) {
+    uint64_t lo = at > 0 ? Items[at - 1]->Order : 0;
+    uint64_t hi = at + count < Items.size() ? Items[at + count]->Order : UINT64_MAX;
+    uint64_t step = (hi - lo) / (count + 1);
+    if (step == 0) {
+        // no room left between the neighbours: spread everything out again
+        // (relative order stays the same, so Pending stays sorted)
+        step = UINT64_MAX / (Items.size() + 1);
+        for (size_t i = 0; i < Items.size(); i++)
+            Items[i]->Order = (i + 1) * step;
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+        Items[at + i]->Order = lo + (i + 1) * step;
+}
+
+void IncrementalFrontend::parseItem(Item& item) {
+    Lexer lexer(std::string_view(item.Text), 1, item.Col);
+    Parser parser(lexer);
+    parser.MaxExprNesting = parser.MaxBlockNesting = MaxNesting;
+    item.AST = parser.parseProgram();
+    if (!item.AST) {
+        Broken++;
+        return;
+    }
+    for (auto& fn : item.AST->Functions) {
+        for (auto& callee : collectCallees(*fn))
+            item.Callees.insert(callee);
+        Defined[fn->Proto->getName()].insert(&item);
+        Redefined.insert(fn->Proto->getName());
+    }
+    for (auto& callee : item.Callees)
+        Callers[callee].insert(&item);
+    for (auto& ext : item.AST->Externs)
+        if (Externs[ext->getName()]++ == 0) Redefined.insert(ext->getName());
+    Pending.insert(&item);
+}
+
+void IncrementalFrontend::retire(Item& item) {
+    for (auto& callee : item.Callees) {
+        auto it = Callers.find(callee);
+        it->second.erase(&item);
+        if (it->second.empty()) Callers.erase(it);
+    }
+    if (!item.AST) {
+        Broken--;
+    }
+    else {
+        for (auto& ext : item.AST->Externs)
+            if (--Externs[ext->getName()] == 0) {
+                Externs.erase(ext->getName());
+                Redefined.insert(ext->getName());
+            }
+        for (auto& fn : item.AST->Functions) {
+            auto it = Defined.find(fn->Proto->getName());
+            it->second.erase(&item);
+            if (it->second.empty()) Defined.erase(it);
+            Redefined.insert(fn->Proto->getName());
+        }
+    }
+    for (llvm::Function* fn : item.Functions) {
+        auto it = Definitions.find(fn->getName().str());
+        if (it != Definitions.end() && it->second == &item) Definitions.erase(it);
+    }
+    // their bodies go at the next generate(), when it's known which
+    // signatures changed
+    RetiredFunctions.insert(RetiredFunctions.end(), item.Functions.begin(), item.Functions.end());
+    RetiredHelpers.insert(RetiredHelpers.end(), item.Helpers.begin(), item.Helpers.end());
+    Pending.erase(&item);
+}
+
+// puts a declaration in fn's place (callers are moved over) and deletes
+// fn. A body generated into a fresh function gets the same value names as
+// in a full compile, deleteBody() would keep counting them up.
+static llvm::Function* redeclare(llvm::Function* fn) {
+    llvm::Function* decl = llvm::Function::Create(fn->getFunctionType(), fn->getLinkage(), "");
+    fn->getParent()->getFunctionList().insert(fn->getIterator(), decl);
+    decl->takeName(fn);
+    decl->copyAttributesFrom(fn);
+    fn->replaceAllUsesWith(decl);
+    fn->eraseFromParent();
+    return decl;
+}
+
+void IncrementalFrontend::dropGenerated(Item& item) {
+    for (llvm::Function* fn : item.Functions) {
+        auto it = Definitions.find(fn->getName().str());
+        if (it != Definitions.end() && it->second == &item) Definitions.erase(it);
+        redeclare(fn);
+    }
+    // only called from the bodies just deleted
+    for (llvm::Function* helper : item.Helpers)
+        helper->eraseFromParent();
+    item.Functions.clear();
+    item.Helpers.clear();
+    item.Unresolved.clear();
+    item.Dirty = true;
+    Pending.insert(&item);
+}
+
+bool IncrementalFrontend::visible(const std::string& name, const Item& item) const {
+    if (Externs.count(name)) return true;
+    auto it = Defined.find(name);
+    return it != Defined.end() && (*it->second.begin())->Order <= item.Order;
+}
+
+bool IncrementalFrontend::generate() {
+    LastGenerate = {};
+    if (Broken) {
+        std::cerr << Broken << " definition(s) with syntax errors, nothing generated\n";
+        return false;
+    }
+    llvm::Module& M = *CG.TheModule;
+
+    // what replaced items generated: bodies go, the declarations stay for
+    // now (other functions may call them)
+    std::map<std::string, size_t> before, now;
+    for (llvm::Function* fn : RetiredFunctions) {
+        before[fn->getName().str()] = fn->arg_size();
+        redeclare(fn);
+    }
+    for (llvm::Function* helper : RetiredHelpers)
+        helper->eraseFromParent();
+    RetiredFunctions.clear();
+    RetiredHelpers.clear();
+
+    for (Item* item : Pending)
+        for (auto& fn : item->AST->Functions)
+            now[fn->Proto->getName()] = fn->Proto->Args.size();
+    // functions that are gone, new or take a different number of
+    // parameters: every call to them has to be generated again
+    std::set<std::string> changed;
+    for (auto& [name, arity] : before) {
+        auto it = now.find(name);
+        if (it == now.end() || it->second != arity) changed.insert(name);
+    }
+    for (auto& [name, arity] : now) {
+        llvm::Function* fn = M.getFunction(name);
+        if (!fn || fn->arg_size() != arity) changed.insert(name);
+    }
+    for (auto& name : changed) {
+        auto it = Callers.find(name);
+        if (it == Callers.end()) continue;
+        for (Item* caller : it->second)
+            if (!caller->Dirty) dropGenerated(*caller);
+    }
+    // a definition that moved above or below a caller, an extern that came
+    // or went: the call resolves now and didn't before, or the other way
+    for (auto& name : Redefined) {
+        auto it = Callers.find(name);
+        if (it == Callers.end()) continue;
+        for (Item* caller : it->second) {
+            bool resolvesNow = visible(name, *caller);
+            bool resolvedBefore = caller->Unresolved.count(name) == 0;
+            if (!caller->Dirty && resolvesNow != resolvedBefore)
+                dropGenerated(*caller);
+        }
+    }
+    Redefined.clear();
+    // nothing calls these any more, they are declared again if needed
+    for (auto& name : changed) {
+        llvm::Function* fn = M.getFunction(name);
+        if (fn && fn->isDeclaration() && fn->use_empty() && !Externs.count(name))
+            fn->eraseFromParent();
+    }
+
+    // in source order, so a fresh module comes out like a full compile
+    std::vector<Item*> pending(Pending.begin(), Pending.end());
+    // declared first, so every item finds its own and the ones above it;
+    // the ones below are hidden while it's generated
+    for (Item* item : pending) {
+        for (auto& ext : item->AST->Externs)
+            if (!M.getFunction(ext->getName()))
+                CG.codegenPrototype(ext.get());
+        for (auto& fn : item->AST->Functions) {
+            llvm::Function* decl = M.getFunction(fn->Proto->getName());
+            if (!decl)
+                CG.codegenPrototype(fn->Proto.get());
+            else if (decl->isDeclaration() && decl->arg_size() == fn->Proto->Args.size())
+                for (auto& arg : decl->args())
+                    arg.setName(fn->Proto->Args[arg.getArgNo()]);
+        }
+    }
+
+    bool ok = true;
+    for (Item* item : pending) {
+        llvm::Function* mark = M.empty() ? nullptr : &M.getFunctionList().back();
+        bool itemOk = true;
+        // out of the symbol table while item is generated, like in a full
+        // compile where they don't exist yet
+        std::vector<std::pair<llvm::Function*, std::string>> hidden;
+        for (auto& callee : item->Callees) {
+            if (visible(callee, *item)) continue;
+            item->Unresolved.insert(callee);
+            if (llvm::Function* fn = M.getFunction(callee)) {
+                hidden.push_back({fn, callee});
+                fn->setName("");
+            }
+        }
+        // a full compile fails on these before any IR is generated (see
+        // analysis/callgraph.h), codegen alone would just leave the call out
+        for (auto& fn : item->AST->Functions)
+            for (auto& callee : collectCallees(*fn))
+                if (item->Unresolved.count(callee)) {
+                    std::cerr << "Unknown function: " << callee << " (called from "
+                              << fn->Proto->getName()
+                              << (Defined.count(callee) ? "; it is only defined below" : "")
+                              << ")\n";
+                    itemOk = false;
+                }
+        for (auto& fn : item->AST->Functions) {
+            if (!itemOk) break;
+            const std::string& name = fn->Proto->getName();
+            llvm::Function* decl = M.getFunction(name);
+            auto owner = Definitions.find(name);
+            if (owner != Definitions.end() && owner->second != item) {
+                std::cerr << "Redefinition of '" << name << "'\n";
+                itemOk = false;
+                break;
+            }
+            if (!decl) {
+                itemOk = false;
+                break;
+            }
+            if (decl->arg_size() != fn->Proto->Args.size()) {
+                std::cerr << "'" << name << "' is declared with " << decl->arg_size()
+                          << " parameter(s) elsewhere\n";
+                itemOk = false;
+                break;
+            }
+            Definitions[name] = item;
+            item->Functions.push_back(decl);
+            if (!CG.codegenFunction(fn.get())) {
+                itemOk = false;
+                break;
+            }
+        }
+        for (auto& [fn, name] : hidden)
+            fn->setName(name);
+        // whatever codegen added after mark with a body: pcycle bodies
+        for (auto it = mark ? std::next(mark->getIterator()) : M.begin(); it != M.end(); ++it)
+            if (!it->isDeclaration())
+                item->Helpers.push_back(&*it);
+        for (llvm::Function* fn : item->Functions)
+            itemOk = itemOk && !llvm::verifyFunction(*fn, &llvm::errs());
+        for (llvm::Function* helper : item->Helpers)
+            itemOk = itemOk && !llvm::verifyFunction(*helper, &llvm::errs());
+
+        if (!itemOk) {
+            // leave declarations only, it's tried again next time
+            dropGenerated(*item);
+            ok = false;
+            continue;
+        }
+        item->Dirty = false;
+        Pending.erase(item);
+        LastGenerate.Bytes += item->Text.size();
+        LastGenerate.Items++;
+        LastGenerate.Functions += item->Functions.size();
+    }
+    return ok;
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../codegen/codegen.h"
+
+// A source kept in memory across edits, for editors and watch modes.
+//
+// The text is stored as a list of top-level items. Each one starts at a
+// 'def' (the only place a def can be in a valid program, so no brace
+// counting is needed) and runs up to the next one, comments and externs
+// included. A body still open at the end of its item is a syntax error,
+// as it is in a full compile, where the next 'def' would end up inside it.
+// edit() re-lexes and re-parses just the items the edited range touches;
+// generate() regenerates just their functions, plus the callers of
+// any function that appeared, disappeared or changed its parameter count,
+// in a module that lives as long as this object. Every other llvm::Function
+// is kept as it is, so both steps take time in proportion to the edit and
+// not to the file.
+//
+// Lines in an item's AST count from the item's first line (see line()), so
+// an edit that adds or removes lines doesn't touch the items below it. No
+// debug info is generated.
+class IncrementalFrontend {
+public:
+    struct Item {
+        std::string Text;
+        unsigned Col = 1;           // column Text starts at
+        unsigned Lines = 0;         // newlines in Text
+        std::unique_ptr<ProgramAST> AST;  // nullptr: syntax error
+        std::set<std::string> Callees;
+        // callees it couldn't see when generated: defined further down (a
+        // full compile only sees what's above) or nowhere
+        std::set<std::string> Unresolved;
+        bool Dirty = true;          // not generated since it was parsed
+        // what generate() put in the module for it
+        std::vector<llvm::Function*> Functions;
+        std::vector<llvm::Function*> Helpers;  // outlined pcycle bodies
+        // increases in source order, keeps Pending sorted
+        uint64_t Order = 0;
+    };
+
+    // how much the last edit() / generate() had to redo
+    struct UpdateStats {
+        size_t Bytes = 0;      // re-lexed
+        size_t Items = 0;      // re-parsed / regenerated
+        size_t Functions = 0;  // regenerated
+    };
+
+    explicit IncrementalFrontend(std::string source,
+                                 const std::string& moduleName = "paradoxCC",
+                                 unsigned maxNesting = DefaultMaxNesting);
+    ~IncrementalFrontend();
+    IncrementalFrontend(const IncrementalFrontend&) = delete;
+    IncrementalFrontend& operator=(const IncrementalFrontend&) = delete;
+
+    // replaces bytes [begin, end) of the source with text. false (and
+    // reports) if the range isn't inside the source; syntax errors in the
+    // result are reported but don't fail the edit, see ok().
+    bool edit(size_t begin, size_t end, std::string_view text);
+
+    // true if every item parsed
+    bool ok() const { return Broken == 0; }
+    size_t size() const;
+    std::string text() const;
+    const std::vector<Item*>& items() const { return Items; }
+    // where item i starts: byte offset and line
+    size_t offset(size_t i) const { return Offsets[i] + (i >= ShiftFrom ? ShiftBytes : 0); }
+    unsigned line(size_t i) const { return LineNumbers[i] + (i >= ShiftFrom ? ShiftLines : 0); }
+    // every function, in source order
+    std::vector<FunctionAST*> functions() const;
+
+    // brings the module up to date with the source. false (errors go to
+    // stderr) if there are syntax errors, a call to a function that isn't
+    // declared above it or one that fails to generate; what failed is
+    // tried again next time.
+    bool generate();
+    // configure it (FP mode, target) before the first generate()
+    CodeGen& codegen() { return CG; }
+    llvm::Module& module() { return *CG.TheModule; }
+
+    UpdateStats LastEdit, LastGenerate;
+
+private:
+    void replaceItems(size_t first, size_t last, std::string region);
+    // the item holding byte offset (the last one for offset == size())
+    size_t itemAt(size_t offset) const;
+    void parseItem(Item& item);
+    // Order for the count items from index at, between their neighbours'
+    void number(size_t at, size_t count);
+    // moves every item from index from on by bytes / lines
+    void shift(size_t from, long bytes, long lines);
+    void retire(Item& item);
+    // takes what item generated out of the module, it is generated again
+    void dropGenerated(Item& item);
+    // whether a full compile would resolve a call to name from item
+    bool visible(const std::string& name, const Item& item) const;
+
+    struct SourceOrder {
+        bool operator()(const Item* a, const Item* b) const { return a->Order < b->Order; }
+    };
+
+    // owned; plain pointers, so making room for an item in the middle is a
+    // memmove even in an unoptimized build
+    std::vector<Item*> Items;
+    // where each item starts. Entries from ShiftFrom on are still off by
+    // ShiftBytes / ShiftLines: an edit only updates the ones between it and
+    // the edit before, not everything below it.
+    std::vector<size_t> Offsets;
+    std::vector<unsigned> LineNumbers;
+    size_t ShiftFrom = 1;
+    long ShiftBytes = 0, ShiftLines = 0;
+    unsigned MaxNesting;
+    size_t Broken = 0;
+    // generated functions of items replaced since the last generate()
+    std::vector<llvm::Function*> RetiredFunctions, RetiredHelpers;
+    // items parsed but not generated yet
+    std::set<Item*, SourceOrder> Pending;
+    // callee name -> items calling it, item defining each generated
+    // function, how many items declare each extern
+    std::map<std::string, std::set<Item*>> Callers;
+    std::map<std::string, Item*> Definitions;
+    std::map<std::string, size_t> Externs;
+    // items defining each function, parsed or not; the first one counts
+    std::map<std::string, std::set<Item*, SourceOrder>> Defined;
+    // names whose first definition or extern came or went since the last
+    // generate(): their callers may see them differently now
+    std::set<std::string> Redefined;
+    CodeGen CG;
+};
@@ -0,0 +1,323 @@
+#include "jit.h"
+#include "../optimizer/optimizer.h"
+#include "../runtime/runtime.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <unistd.h>
+
+namespace {
+
+// perf's fallback for JIT code without a jitdump: /tmp/perf-<pid>.map, one
+// "start size name" line (hex) per function. Good enough for perf report
+// and perf top, no annotation. Shared by every JIT in the process.
+class PerfMapListener : public llvm::JITEventListener {
+    std::mutex Lock;
+    FILE* Map = nullptr;
+
+public:
+    PerfMapListener(){
+        std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+        Map = std::fopen(path.c_str(), "a");
+        if(!Map)
+            std::cerr << "JIT: cannot write " << path << "\n";
+    }
+
+    void notifyObjectLoaded(ObjectKey, const llvm::object::ObjectFile& obj,
+                            const llvm::RuntimeDyld::LoadedObjectInfo& info) override {
+        if(!Map) return;
+        // the debug copy has the symbols at their final addresses
+        llvm::object::OwningBinary<llvm::object::ObjectFile> loaded =
+            info.getObjectForDebug(obj);
+        const llvm::object::ObjectFile* o = loaded.getBinary();
+        if(!o) return;
+
+        std::lock_guard<std::mutex> guard(Lock);
+        for(auto& [sym, size] : llvm::object::computeSymbolSizes(*o)){
+            auto type = sym.getType();
+            auto name = sym.getName();
+            auto addr = sym.getAddress();
+            if(!type || !name || !addr){
+                llvm::consumeError(type.takeError());
+                llvm::consumeError(name.takeError());
+                llvm::consumeError(addr.takeError());
+                continue;
+            }
+            if(*type != llvm::object::SymbolRef::ST_Function || size == 0)
+                continue;
+            std::fprintf(Map, "%llx %llx %s\n", (unsigned long long)*addr,
+                         (unsigned long long)size, name->str().c_str());
+        }
+        std::fflush(Map);
+    }
+};
+
+// RTDyld linking layer with the listeners debug asks for
+llvm::Expected<std::unique_ptr<llvm::orc::ObjectLayer>>
+createLinkingLayer(llvm::orc::ExecutionSession& ES, const DebugOptions& debug){
+    auto layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(
+        ES, [](auto&&...){ return std::make_unique<llvm::SectionMemoryManager>(); });
+    if(debug.GDB)
+        layer->registerJITEventListener(*llvm::JITEventListener::createGDBRegistrationListener());
+    if(debug.Perf){
+        // both are process wide: one jitdump file and one map file per pid
+        static llvm::JITEventListener* jitdump = llvm::JITEventListener::createPerfJITEventListener();
+        static PerfMapListener perfMap;
+        if(jitdump)
+            layer->registerJITEventListener(*jitdump);
+        else
+            std::cerr << "JIT: LLVM was built without perf support, writing a perf map only\n";
+        layer->registerJITEventListener(perfMap);
+    }
+    return layer;
+}
+
+} // namespace
+
+std::unique_ptr<ParadoxJIT> ParadoxJIT::create(const FPOptions& fp,
+                                               const TargetSpec& target,
+                                               const DebugOptions& debug){
+    // target registration touches global registries, sessions on other
+    // threads may be creating JITs at the same time
+    static std::once_flag targetsReady;
+    std::call_once(targetsReady, []{
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        llvm::InitializeNativeTargetAsmParser();
+    });
+
+    auto jtmb = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if(!jtmb){
+        std::cerr << "JIT: " << llvm::toString(jtmb.takeError()) << "\n";
+        return nullptr;
+    }
+    applyFPOptions(fp, jtmb->getOptions());
+    // an explicit CPU brings its own features instead of the host's
+    if(!target.CPU.empty()){
+        jtmb->setCPU(target.CPU);
+        jtmb->getFeatures() = llvm::SubtargetFeatures(target.Features);
+    }
+    else if(!target.Features.empty())
+        jtmb->addFeatures({target.Features});
+    auto tm = jtmb->createTargetMachine();
+    if(!tm){
+        std::cerr << "JIT: " << llvm::toString(tm.takeError()) << "\n";
+        return nullptr;
+    }
+    llvm::orc::LLJITBuilder builder;
+    builder.setJITTargetMachineBuilder(*jtmb);
+    if(debug.GDB || debug.Perf)
+        builder.setObjectLinkingLayerCreator([debug](llvm::orc::ExecutionSession& ES, auto&&...){
+            return createLinkingLayer(ES, debug);
+        });
+    auto lljit = builder.create();
+    if(!lljit){
+        std::cerr << "JIT: " << llvm::toString(lljit.takeError()) << "\n";
+        return nullptr;
+    }
+
+    // optimized code may call libc (memset, memcpy, ...), resolve those
+    // from the host process
+    auto host = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        (*lljit)->getDataLayout().getGlobalPrefix());
+    if(!host){
+        std::cerr << "JIT: " << llvm::toString(host.takeError()) << "\n";
+        return nullptr;
+    }
+    (*lljit)->getMainJITDylib().addGenerator(std::move(*host));
+
+    auto jit = std::make_unique<ParadoxJIT>();
+    jit->MemoTables = paradox_memo_create();
+
+    // the runtime (memo tables, ...) is part of this binary but usually not
+    // exported dynamically, so hand its addresses to the JIT directly. Memo
+    // tables go into this JIT's own set rather than the process wide one.
+    llvm::orc::SymbolMap runtime;
+    for(const RuntimeSymbol* s = runtimeSymbols(); s->name; s++){
+#if LLVM_VERSION_MAJOR >= 17
+        runtime[(*lljit)->mangleAndIntern(s->name)] = {
+            llvm::orc::ExecutorAddr::fromPtr(s->addr), llvm::JITSymbolFlags::Exported};
+#else
+        runtime[(*lljit)->mangleAndIntern(s->name)] = llvm::JITEvaluatedSymbol(
+            llvm::pointerToJITTargetAddress(s->addr), llvm::JITSymbolFlags::Exported);
+#endif
+    }
+#if LLVM_VERSION_MAJOR >= 17
+    runtime[(*lljit)->mangleAndIntern("paradox_memo_tables")] = {
+        llvm::orc::ExecutorAddr::fromPtr(jit->MemoTables), llvm::JITSymbolFlags::Exported};
+#else
+    runtime[(*lljit)->mangleAndIntern("paradox_memo_tables")] = llvm::JITEvaluatedSymbol(
+        llvm::pointerToJITTargetAddress(jit->MemoTables), llvm::JITSymbolFlags::Exported);
+#endif
+    if(llvm::Error err = (*lljit)->getMainJITDylib().define(
+           llvm::orc::absoluteSymbols(std::move(runtime)))){
+        std::cerr << "JIT: " << llvm::toString(std::move(err)) << "\n";
+        return nullptr;
+    }
+
+    jit->J = std::move(*lljit);
+    jit->TM = std::move(*tm);
+    return jit;
+}
+
+// no code of this JIT runs any more, its tables can go
+ParadoxJIT::~ParadoxJIT(){
+    paradox_memo_destroy(MemoTables);
+}
+
+void ParadoxJIT::prepareModule(llvm::Module& M, unsigned level){
+    M.setTargetTriple(TM->getTargetTriple().str());
+    M.setDataLayout(J->getDataLayout());
+    optimizeModule(M, TM.get(), level);
+}
+
+bool ParadoxJIT::addModule(std::unique_ptr<llvm::Module> M,
+                           std::unique_ptr<llvm::LLVMContext> Ctx){
+    prepareModule(*M);
+    llvm::orc::ThreadSafeModule tsm(std::move(M), std::move(Ctx));
+    if(llvm::Error err = J->addIRModule(std::move(tsm))){
+        std::cerr << "JIT: " << llvm::toString(std::move(err)) << "\n";
+        return false;
+    }
+    return true;
+}
+
+// the body of one lazy function: generated, optimized and compiled the
+// first time its stub calls through to it
+class ParadoxJIT::LazyBody : public llvm::orc::MaterializationUnit {
+    ParadoxJIT& JIT;
+    std::string Name;
+    unsigned Level;
+    LazyGenerator Generate;
+
+public:
+    LazyBody(ParadoxJIT& jit, llvm::orc::SymbolStringPtr sym, std::string name,
+             unsigned level, LazyGenerator generate)
+        : MaterializationUnit(Interface(
+              llvm::orc::SymbolFlagsMap{
+                  {sym, llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable}},
+              nullptr)),
+          JIT(jit), Name(std::move(name)), Level(level), Generate(std::move(generate)) {}
+
+    llvm::StringRef getName() const override { return "paradox.lazy"; }
+
+    void materialize(std::unique_ptr<llvm::orc::MaterializationResponsibility> R) override {
+        std::lock_guard<std::mutex> guard(JIT.CompileLock);
+        llvm::orc::ThreadSafeModule tsm = Generate(Name);
+        if(!tsm){
+            std::cerr << "JIT: '" << Name << "' failed to compile, calls to it return NaN\n";
+            R->failMaterialization();
+            return;
+        }
+        tsm.withModuleDo([&](llvm::Module& M){ JIT.prepareModule(M, Level); });
+        JIT.LazyCompiled++;
+        // compiles right here; other functions it calls resolve to their
+        // stubs in the main dylib
+        JIT.J->getIRCompileLayer().emit(std::move(R), std::move(tsm));
+    }
+
+private:
+    void discard(const llvm::orc::JITDylib&, const llvm::orc::SymbolStringPtr&) override {}
+};
+
+// where calls to a lazy function that failed to compile end up, with the
+// arguments it was called with
+static double lazyCompileFailed(){
+    return std::numeric_limits<double>::quiet_NaN();
+}
+
+bool ParadoxJIT::addLazy(const std::vector<std::string>& names, LazyGenerator generate){
+    if(!Bodies){
+        llvm::orc::ExecutionSession& ES = J->getExecutionSession();
+        const llvm::Triple& triple = J->getTargetTriple();
+#if LLVM_VERSION_MAJOR >= 15
+        auto failed = llvm::orc::ExecutorAddr::fromPtr(&lazyCompileFailed);
+#else
+        auto failed = llvm::pointerToJITTargetAddress(&lazyCompileFailed);
+#endif
+        auto callThrough = llvm::orc::createLocalLazyCallThroughManager(triple, ES, failed);
+        if(!callThrough){
+            std::cerr << "JIT: " << llvm::toString(callThrough.takeError()) << "\n";
+            return false;
+        }
+        auto stubs = llvm::orc::createLocalIndirectStubsManagerBuilder(triple);
+        if(!stubs){
+            std::cerr << "JIT: no lazy compilation for " << triple.str() << "\n";
+            return false;
+        }
+        auto bodies = J->createJITDylib("paradox.bodies");
+        if(!bodies){
+            std::cerr << "JIT: " << llvm::toString(bodies.takeError()) << "\n";
+            return false;
+        }
+        // bodies only see the main dylib: a call to another function goes
+        // to its stub, instead of compiling its body right away
+        bodies->setLinkOrder({{&J->getMainJITDylib(),
+                               llvm::orc::JITDylibLookupFlags::MatchExportedSymbolsOnly}},
+                             false);
+        CallThrough = std::move(*callThrough);
+        Stubs = stubs();
+        Bodies = &*bodies;
+    }
+
+    llvm::orc::SymbolAliasMap aliases;
+    for(auto& name : names){
+        llvm::orc::SymbolStringPtr sym = J->mangleAndIntern(name);
+        if(llvm::Error err = Bodies->define(
+               std::make_unique<LazyBody>(*this, sym, name, OptLevel, generate))){
+            std::cerr << "JIT: " << llvm::toString(std::move(err)) << "\n";
+            return false;
+        }
+        aliases[sym] = {sym, llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable};
+    }
+    if(llvm::Error err = J->getMainJITDylib().define(
+           llvm::orc::lazyReexports(*CallThrough, *Stubs, *Bodies, std::move(aliases)))){
+        std::cerr << "JIT: " << llvm::toString(std::move(err)) << "\n";
+        return false;
+    }
+    return true;
+}
+
+void* ParadoxJIT::lookup(const std::string& name){
+    // may compile eager modules, see CompileLock
+    std::lock_guard<std::mutex> guard(CompileLock);
+    auto sym = J->lookup(name);
+    if(!sym){
+        std::cerr << "JIT: " << llvm::toString(sym.takeError()) << "\n";
+        return nullptr;
+    }
+#if LLVM_VERSION_MAJOR >= 15
+    return sym->toPtr<void*>();
+#else
+    return reinterpret_cast<void*>(sym->getAddress());
+#endif
+}
+
+std::unique_ptr<llvm::Module> cloneToContext(const llvm::Module& M,
+                                             llvm::LLVMContext& Ctx){
+    llvm::SmallVector<char, 0> buf;
+    {
+        llvm::raw_svector_ostream os(buf);
+        llvm::WriteBitcodeToFile(M, os);
+    }
+    auto mod = llvm::parseBitcodeFile(
+        llvm::MemoryBufferRef(llvm::StringRef(buf.data(), buf.size()),
+                              M.getModuleIdentifier()), Ctx);
+    if(!mod){
+        std::cerr << "Cloning module failed: " << llvm::toString(mod.takeError()) << "\n";
+        return nullptr;
+    }
+    return std::move(*mod);
+}
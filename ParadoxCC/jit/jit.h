@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/LazyReexports.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+#include "../codegen/debug.h"
+#include "../target/target.h"
+
+struct paradox_memo_set;
+
+// Small wrapper around ORC's LLJIT for the host machine.
+// Modules handed to addModule are optimized first (at OptLevel) with the
+// host TargetMachine, so the vectorizer sees the real hardware.
+class ParadoxJIT {
+    std::unique_ptr<llvm::orc::LLJIT> J;
+    std::unique_ptr<llvm::TargetMachine> TM;
+    // lazy functions: stubs live in the main dylib, bodies in their own one
+    // (see addLazy), created on first use
+    std::unique_ptr<llvm::orc::LazyCallThroughManager> CallThrough;
+    std::unique_ptr<llvm::orc::IndirectStubsManager> Stubs;
+    llvm::orc::JITDylib* Bodies = nullptr;
+    // the optimizer and the compiler share TM, lookups and lazy compiles on
+    // different threads take turns
+    std::mutex CompileLock;
+    std::atomic<size_t> LazyCompiled{0};
+    paradox_memo_set* MemoTables = nullptr;
+
+    class LazyBody;
+
+public:
+    unsigned OptLevel = 3;
+
+    ~ParadoxJIT();
+
+    // fp sets the TargetMachine's FP options; the IR's own flags and
+    // function attributes are what really decide, this just matches them.
+    // target defaults to the host CPU with all its features. debug.GDB and
+    // debug.Perf announce every loaded object to gdb / perf.
+    static std::unique_ptr<ParadoxJIT> create(const FPOptions& fp = FPOptions(),
+                                              const TargetSpec& target = TargetSpec(),
+                                              const DebugOptions& debug = DebugOptions());
+
+    // sets the module's triple/data layout to the JIT's and optimizes it
+    void prepareModule(llvm::Module& M) { prepareModule(M, OptLevel); }
+    void prepareModule(llvm::Module& M, unsigned level);
+
+    bool addModule(std::unique_ptr<llvm::Module> M,
+                   std::unique_ptr<llvm::LLVMContext> Ctx);
+
+    // returns the module defining name (and whatever it needs besides
+    // external functions), an empty one (after reporting) if it can't
+    using LazyGenerator = std::function<llvm::orc::ThreadSafeModule(const std::string& name)>;
+
+    // every name gets a stub right away. generate(name) runs when the stub
+    // is first called, on the calling thread, and only then is the module
+    // optimized (at the OptLevel of this call) and compiled. Calls between
+    // lazy functions go through the stubs too, so they are never inlined
+    // into each other. A function that fails to generate returns NaN.
+    bool addLazy(const std::vector<std::string>& names, LazyGenerator generate);
+
+    // lazy functions generated and compiled so far
+    size_t lazyCompiled() const { return LazyCompiled; }
+
+    // address of a JIT'd symbol, nullptr (and reports) if not found
+    void* lookup(const std::string& name);
+
+    // where --memoize tables of the code added here go (the name
+    // paradox_memo_tables resolves to it, see runtime.h), freed with the
+    // JIT. paradox_memo_report() prints their hit rates.
+    paradox_memo_set* memoTables() const { return MemoTables; }
+};
+
+// copies M into Ctx (through an in-memory bitcode round trip), the JIT
+// needs modules whose context it can own
+std::unique_ptr<llvm::Module> cloneToContext(const llvm::Module& M,
+                                             llvm::LLVMContext& Ctx);
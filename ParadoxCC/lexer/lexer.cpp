@@ -1,28 +1,54 @@
 #include "lexer.h"
 #include <cctype>
+#include <utility>
 
-Lexer::Lexer(const std::string &src)
-    : Source(src), Index(0), LastChar(' ') {}
+Lexer::Lexer(std::string src)
+    : Owned(std::move(src)), Source(Owned), Index(0), LastChar(' ') {}
+
+Lexer::Lexer(std::string_view src, unsigned line, unsigned col)
+    : Source(src), Index(0), LastChar(' '), Line(line), Col(col - 1) {}
 
 std::vector<TokenInfo> Lexer::makeTokens() {
     std::vector<TokenInfo> tokens;
     while (true) {
-        TokenInfo tok = getNextToken();
-        tokens.push_back(tok);
-        if (tok.type == tok_eof)
+        tokens.push_back(next());
+        if (tokens.back().type == tok_eof)
             break;
     }
     return tokens;
 }
 
+TokenInfo Lexer::next() {
+    TokenInfo tok = getNextToken();
+    tok.line = TokLine;
+    tok.col = TokCol;
+    return tok;
+}
+
 char Lexer::getChar() {
+    // LastChar is the previous character, a newline moves us to the next line
+    if (LastChar == '\n') {
+        Line++;
+        Col = 1;
+    }
+    else
+        Col++;
     if (Index >= Source.size()) return '\0';
     return Source[Index++];
 }
 
 TokenInfo Lexer::getNextToken() {
 
-    while (isspace(LastChar)) LastChar = getChar();
+    // whitespace and comments, a comment runs to the end of the line.
+    // a loop, not a call per comment: generated files can have millions
+    while (true) {
+        while (isspace(LastChar)) LastChar = getChar();
+        if (LastChar != '#') break;
+        do { LastChar = getChar(); }
+        while (LastChar != '\0' && LastChar != '\n' && LastChar != '\r');
+    }
+    TokLine = Line;
+    TokCol = Col;
 
     if (LastChar == '\0') return {tok_eof, "", 0};
 
@@ -38,6 +64,7 @@ TokenInfo Lexer::getNextToken() {
         if (IdStr == "if") return {tok_if, IdStr, 0};
         if (IdStr == "else") return {tok_else, IdStr, 0};
         if (IdStr == "cycle") return {tok_cycle, IdStr, 0};
+        if (IdStr == "pcycle") return {tok_pcycle, IdStr, 0};
 
         return {tok_identifier, IdStr, 0};
     }
@@ -58,12 +85,6 @@ TokenInfo Lexer::getNextToken() {
         return {tok_number, NumStr, val};
     }
 
-    if (LastChar == '#') {
-        do { LastChar = getChar(); }
-        while (LastChar != '\0' && LastChar != '\n' && LastChar != '\r');
-        if (LastChar != '\0') return getNextToken();
-    }
-
     char ThisChar = LastChar;
     LastChar = getChar();
 
@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
 
 enum Token{
@@ -12,22 +13,38 @@ enum Token{
     tok_cycle=-7,
     tok_identifier=-8,
     tok_number=-9,
+    tok_pcycle=-10,
 };
 
 struct TokenInfo{
     Token type;
     std::string txt;
     double numberValue;
+    // where the token starts, 1-based
+    unsigned line = 0;
+    unsigned col = 0;
 };
 
 class Lexer {
-    std::string Source;
+    std::string Owned;
+    std::string_view Source;
     size_t Index;
     char LastChar;
+    // position of LastChar and of the token being lexed
+    unsigned Line = 1, Col = 0;
+    unsigned TokLine = 1, TokCol = 1;
 
 public:
-    Lexer(const std::string &src);
+    Lexer(std::string src);
+    // lexes a piece of a bigger text without copying it (src has to outlive
+    // the lexer); line / col is where src starts, for the token locations
+    Lexer(std::string_view src, unsigned line, unsigned col);
+    Lexer(const Lexer&) = delete;
+    Lexer& operator=(const Lexer&) = delete;
+    // every token up to and including tok_eof
     std::vector<TokenInfo> makeTokens();
+    // the next token, tok_eof (again) once the source is exhausted
+    TokenInfo next();
 
 private:
     char getChar();
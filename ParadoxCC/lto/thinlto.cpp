@@ -0,0 +1,163 @@
+#include "thinlto.h"
+#include "llvm/Analysis/ModuleSummaryAnalysis.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/LTO/LTO.h"
+#include "llvm/Support/Caching.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include <iostream>
+#include <set>
+
+static void initNativeTarget(){
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+}
+
+bool emitThinLTOBitcode(llvm::Module& M, const std::string& path){
+    initNativeTarget();
+
+    // LTO picks the backend from the module triple, so it can't stay empty
+    if(M.getTargetTriple().empty()){
+        std::unique_ptr<llvm::TargetMachine> tm = createTargetMachine(TargetSpec(), FPOptions());
+        if(!tm) return false;
+        M.setTargetTriple(tm->getTargetTriple().str());
+        M.setDataLayout(tm->createDataLayout());
+    }
+
+    if(llvm::verifyModule(M, &llvm::errs())){
+        std::cerr << "Refusing to write bitcode for an invalid module\n";
+        return false;
+    }
+
+    std::error_code EC;
+    llvm::raw_fd_ostream out(path, EC, llvm::sys::fs::OF_None);
+    if(EC){
+        std::cerr << "Cannot open " << path << ": " << EC.message() << "\n";
+        return false;
+    }
+    // the summary is what the thin link reads instead of the whole module
+    llvm::ProfileSummaryInfo psi(M);
+    llvm::ModuleSummaryIndex index = llvm::buildModuleSummaryIndex(M, nullptr, &psi);
+    llvm::WriteBitcodeToFile(M, out, false, &index, true);
+    return true;
+}
+
+static bool runTool(const char* tool, const std::vector<std::string>& args){
+    auto prog = llvm::sys::findProgramByName(tool);
+    if(!prog){
+        std::cerr << "Cannot find '" << tool << "' in PATH\n";
+        return false;
+    }
+    std::vector<llvm::StringRef> argv{*prog};
+    for(auto& a : args) argv.push_back(a);
+    if(llvm::sys::ExecuteAndWait(*prog, argv) != 0){
+        std::cerr << tool << " failed\n";
+        return false;
+    }
+    return true;
+}
+
+bool thinLink(const ThinLinkOptions& opts){
+    initNativeTarget();
+
+    llvm::lto::Config conf;
+    conf.RelocModel = llvm::Reloc::PIC_;
+    conf.CPU = opts.Target.CPU;
+    llvm::SmallVector<llvm::StringRef, 16> attrs;
+    llvm::StringRef(opts.Target.Features).split(attrs, ',', -1, false);
+    for(llvm::StringRef a : attrs)
+        conf.MAttrs.push_back(a.str());
+    llvm::lto::LTO lto(std::move(conf), llvm::lto::createInProcessThinBackend(
+                           llvm::heavyweight_hardware_concurrency(opts.Jobs)));
+
+    std::set<std::string> exports(opts.Exports.begin(), opts.Exports.end());
+    std::set<std::string> defined;
+    // input files only reference the buffers, keep them alive until run()
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> buffers;
+
+    for(auto& path : opts.Inputs){
+        auto buf = llvm::MemoryBuffer::getFile(path);
+        if(!buf){
+            std::cerr << "Cannot read " << path << ": " << buf.getError().message() << "\n";
+            return false;
+        }
+        auto file = llvm::lto::InputFile::create((*buf)->getMemBufferRef());
+        if(!file){
+            std::cerr << path << ": " << llvm::toString(file.takeError()) << "\n";
+            return false;
+        }
+        buffers.push_back(std::move(*buf));
+
+        std::vector<llvm::lto::SymbolResolution> res;
+        for(const auto& sym : (*file)->symbols()){
+            llvm::lto::SymbolResolution r;
+            std::string name = sym.getName().str();
+            if(!sym.isUndefined()){
+                if(!defined.insert(name).second){
+                    std::cerr << "Duplicate definition of '" << name
+                              << "' in " << path << "\n";
+                    return false;
+                }
+                r.Prevailing = true;
+                r.FinalDefinitionInLinkageUnit = true;
+            }
+            r.VisibleToRegularObj = exports.empty() || exports.count(name);
+            res.push_back(r);
+        }
+        if(llvm::Error err = lto.add(std::move(*file), res)){
+            std::cerr << path << ": " << llvm::toString(std::move(err)) << "\n";
+            return false;
+        }
+    }
+
+    // one object per backend task, named after the final output
+    std::vector<std::string> objects(lto.getMaxTasks());
+    auto addStream = [&](unsigned task, auto&&...)
+        -> llvm::Expected<std::unique_ptr<llvm::CachedFileStream>> {
+        std::string path = opts.Output + ".lto." + std::to_string(task) + ".o";
+        std::error_code EC;
+        auto os = std::make_unique<llvm::raw_fd_ostream>(path, EC, llvm::sys::fs::OF_None);
+        if(EC) return llvm::errorCodeToError(EC);
+        objects[task] = path;
+        return std::make_unique<llvm::CachedFileStream>(std::move(os), path);
+    };
+    if(llvm::Error err = lto.run(addStream)){
+        std::cerr << "ThinLTO failed: " << llvm::toString(std::move(err)) << "\n";
+        return false;
+    }
+
+    std::vector<std::string> linkArgs;
+    for(auto& o : objects)
+        if(!o.empty()) linkArgs.push_back(o);
+    std::vector<std::string> temps = linkArgs;
+    linkArgs.insert(linkArgs.end(), opts.Objects.begin(), opts.Objects.end());
+
+    const std::string& out = opts.Output;
+    bool relocatable = out.size() > 2 && out.compare(out.size() - 2, 2, ".o") == 0;
+    linkArgs.push_back("-o");
+    linkArgs.push_back(opts.Output);
+    if(relocatable) linkArgs.insert(linkArgs.begin(), "-r");
+    // the runtime (memo tables, pcycle thread pool) is C++
+    bool runtime = false;
+    for(auto& o : opts.Objects)
+        if(llvm::sys::path::filename(o) == "libparadoxrt.a") runtime = true;
+    if(runtime && !relocatable){
+        linkArgs.push_back("-lstdc++");
+        linkArgs.push_back("-lpthread");
+        linkArgs.push_back("-lm");
+    }
+    bool ok = runTool(relocatable ? "ld" : "cc", linkArgs);
+
+    for(auto& t : temps)
+        llvm::sys::fs::remove(t);
+    return ok;
+}
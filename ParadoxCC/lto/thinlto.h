@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "llvm/IR/Module.h"
+#include "../target/target.h"
+
+// ThinLTO support
+// Every source file is compiled on its own into a bitcode module that
+// carries a ThinLTO summary (--emit-bc). The link step (--thinlto-link)
+// reads all summaries, decides which functions to import across modules
+// and then optimizes + codegens every module in parallel.
+
+struct ThinLinkOptions {
+    std::vector<std::string> Inputs;   // .bc files from --emit-bc
+    std::vector<std::string> Objects;  // plain objects passed to the final link
+    std::string Output;                // *.o -> relocatable object, else executable
+    // symbols that must stay visible after the link. empty keeps every
+    // definition, otherwise everything else is internalized and unused
+    // functions are dropped.
+    std::vector<std::string> Exports;
+    unsigned Jobs = 0;                 // 0 -> one backend per hardware thread
+    // CPU for functions without their own target-cpu attribute
+    TargetSpec Target;
+};
+
+// sets target triple/data layout when missing, verifies the module and
+// writes bitcode with a ThinLTO module summary to path
+bool emitThinLTOBitcode(llvm::Module& M, const std::string& path);
+
+// runs the ThinLTO link and writes opts.Output
+bool thinLink(const ThinLinkOptions& opts);
@@ -1,11 +1,29 @@
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <set>
 #include <vector>
 #include "lexer/lexer.h"
 #include "parser/parser.h"
+#include "frontend/frontend.h"
 #include "codegen/codegen.h"
+#include "astfile/astfile.h"
+#include "lto/thinlto.h"
+#include "batch/batch.h"
+#include "analysis/purity.h"
+#include "analysis/consteval.h"
+#include "analysis/callgraph.h"
+#include "optimizer/report.h"
+#include "pipeline/pipeline.h"
+#include "runtime/perf.h"
+#include <chrono>
+#include <memory>
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
 #include "llvm/Support/raw_ostream.h"
 
 
@@ -20,31 +38,656 @@ std::string readContent(const std::string &fname){
     return buf.str();
 }
 
-int main(){
-    
-    std::string fcontent = readContent("input.txt");
+static void usage(){
+    std::cerr << "usage: paradoxCC [input] [options]\n"
+              << "       paradoxCC --thinlto-link <a.bc b.bc ... [x.o]> -o <out> [--export f,g] [-j N]\n"
+              << "  --emit-ast <file>  write the parsed program as a binary AST and stop\n"
+              << "  --from-ast <file>  load a binary AST instead of lexing/parsing\n"
+              << "  --emit-bc <file>   write bitcode with a ThinLTO summary instead of IR text\n"
+              << "  --thinlto-link     link --emit-bc outputs with ThinLTO; -o *.o gives a\n"
+              << "                     relocatable object, anything else an executable\n"
+              << "  --export f,g       keep only these symbols visible (others may be dropped)\n"
+              << "  -j N               number of parallel ThinLTO backends\n"
+              << "  --batch <fn>       JIT fn as a vectorized batch kernel and apply it to\n"
+              << "                     every row of --batch-input (default: stdin)\n"
+              << "  --batch-input <f>  rows of comma/space separated numbers, one per line\n"
+              << "  --threads N        split batch rows over N threads\n"
+              << "  --memoize[=f,g]    cache results of pure functions (default: every pure\n"
+              << "                     recursive one); hit rates go to stderr after --batch\n"
+              << "  --fold-budget N    steps all calls with constant arguments together may\n"
+              << "                     take to be evaluated at compile time (default 1048576)\n"
+              << "  --no-fold          leave every call for run time\n"
+              << "  --entry f,g        only generate / optimize f, g and what they call\n"
+              << "                     (default: every function; --batch fn is added)\n"
+              << "  --precision=f32    compute in float instead of double: twice the SIMD\n"
+              << "                     lanes, half the memory (--batch columns are float);\n"
+              << "                     exported functions still take and return double\n"
+              << "  --fast-math        allow every FP shortcut (reassociation, fma, no\n"
+              << "                     NaN/inf/signed zero handling, approximations)\n"
+              << "  --reassoc          allow reassociating FP math (vectorized reductions)\n"
+              << "  --fp-contract      allow fusing a * b + c into fma\n"
+              << "  --no-nans          assume FP values are never NaN\n"
+              << "  -march=<cpu>       generate code for cpu (same as -mcpu); native = this\n"
+              << "                     machine. default: generic for files, host for --batch\n"
+              << "  -mattr=+f,-g       enable / disable target features on top of the CPU's\n"
+              << "  --parse-threads N  lex + parse on N threads (0 = all cores), split at\n"
+              << "                     top-level defs; no tokens_generated.txt then\n"
+              << "  --pipeline[=N]     lex, parse, codegen (N workers) and emit concurrently,\n"
+              << "                     streaming each def through; no constant folding,\n"
+              << "                     tokens_generated.txt or whole-program options\n"
+              << "  --max-nesting N    reject parentheses / blocks nested deeper than N\n"
+              << "                     (default 256)\n"
+              << "  -O<n>              optimization level --opt-report looks at (default 2)\n"
+              << "  --opt-report[=f]   per function: IR size before / after -O<n>, inlining,\n"
+              << "                     vectorized / unrolled loops and why not, machine code\n"
+              << "                     bytes. text on stdout, or to f (.json / .yaml: as such)\n"
+              << "  -g                 emit debug info; --batch code is registered with gdb\n"
+              << "  --perf             debug info, plus a jitdump and /tmp/perf-<pid>.map for\n"
+              << "                     the --batch code (perf record -k 1, perf inject --jit)\n"
+              << "  --perf-counters[=f] cycles, instructions, branch / cache misses of every\n"
+              << "                     phase (lex, parse, codegen, ...) as JSON on stdout or\n"
+              << "                     to f; only what the machine lets perf_event_open count\n"
+              << "  --perf-calls[=f,g] also count every call into f, g (default: all) from\n"
+              << "                     outside Paradox code; --batch counts the kernel\n";
+}
+
+// --perf-counters: counters and wall time of each phase on this thread,
+// one after the other, written as JSON at the end together with the
+// --perf-calls totals
+class PhaseCounters {
+public:
+    bool enabled() const { return Counters != nullptr; }
+    void enable(){
+        Counters = std::make_unique<PerfCounters>();
+        if(!Counters->error().empty())
+            std::cerr << "note: --perf-counters: " << Counters->error() << "\n";
+    }
+    // ends the running phase, if any, and starts name
+    void begin(const char* name){
+        if(!Counters) return;
+        end();
+        Current = name;
+        Start = Counters->read();
+    }
+    void end(){
+        if(!Counters || Current.empty()) return;
+        Phases.push_back({Current, Counters->read() - Start});
+        Current.clear();
+    }
+    bool write(const std::string& path);
+
+private:
+    void sample(llvm::json::OStream& J, const PerfSample& s);
+
+    std::unique_ptr<PerfCounters> Counters;
+    std::vector<std::pair<std::string, PerfSample>> Phases;
+    std::string Current;
+    PerfSample Start;
+};
+
+// the events there are, missing ones are left out rather than given as 0
+void PhaseCounters::sample(llvm::json::OStream& J, const PerfSample& s){
+    J.attribute("wallMs", s.WallMs);
+    for(unsigned e = 0; e < PerfEventCount; e++)
+        if(Counters->has((PerfEvent)e))
+            J.attribute(perfEventName((PerfEvent)e), (int64_t)s.Value[e]);
+    if(Counters->has(PerfCycles) && Counters->has(PerfInstructions) && s.Value[PerfCycles])
+        J.attribute("ipc", (double)s.Value[PerfInstructions] / s.Value[PerfCycles]);
+}
+
+bool PhaseCounters::write(const std::string& path){
+    if(!Counters) return true;
+    end();
+    std::vector<PerfCallStats> calls = collectPerfCalls();
+
+    std::string text;
+    llvm::raw_string_ostream os(text);
+    llvm::json::OStream J(os, 2);
+    J.object([&]{
+        J.attributeArray("events", [&]{
+            for(unsigned e = 0; e < PerfEventCount; e++)
+                if(Counters->has((PerfEvent)e)) J.value(perfEventName((PerfEvent)e));
+        });
+        if(Counters->error().empty())
+            J.attribute("unavailable", nullptr);
+        else
+            J.attribute("unavailable", Counters->error());
+        J.attributeArray("phases", [&]{
+            for(auto& [name, s] : Phases)
+                J.object([&]{
+                    J.attribute("name", name);
+                    sample(J, s);
+                });
+        });
+        J.attributeArray("calls", [&]{
+            for(auto& c : calls)
+                J.object([&]{
+                    J.attribute("function", c.Name);
+                    J.attribute("calls", (int64_t)c.Calls);
+                    sample(J, c.Total);
+                });
+        });
+    });
+    os << "\n";
+    os.flush();
+
+    if(path.empty()){
+        std::cout << text;
+        return true;
+    }
+    std::ofstream out(path);
+    if(!out){
+        std::cerr << "Cannot open " << path << "\n";
+        return false;
+    }
+    out << text;
+    std::cout << "Performance counters written to " << path << "\n";
+    return true;
+}
+
+// reads rows of numbers into one vector per column
+static bool readColumns(std::istream& in, size_t arity,
+                        std::vector<std::vector<double>>& cols){
+    cols.assign(arity, {});
+    std::string line;
+    size_t lineNo = 0;
+    while(std::getline(in, line)){
+        lineNo++;
+        for(char& c : line)
+            if(c == ',') c = ' ';
+        std::stringstream ss(line);
+        std::vector<double> row;
+        double v;
+        while(ss >> v) row.push_back(v);
+        if(row.empty()) continue;
+        if(row.size() != arity){
+            std::cerr << "line " << lineNo << ": expected " << arity
+                      << " values, got " << row.size() << "\n";
+            return false;
+        }
+        for(size_t k = 0; k < arity; k++)
+            cols[k].push_back(row[k]);
+    }
+    return true;
+}
+
+static int runBatch(const llvm::Module& module, const std::string& fnName,
+                    const std::string& inputPath, unsigned threads,
+                    const FPOptions& fp, const TargetSpec& target,
+                    const DebugOptions& debug, PhaseCounters& perf){
+    // -O3 and machine code
+    perf.begin("jit");
+    auto kernel = compileBatchKernel(module, fnName, 3, fp, target, debug);
+    if(!kernel) return 1;
+
+    perf.begin("read-input");
+    std::vector<std::vector<double>> cols;
+    bool ok;
+    if(inputPath.empty()){
+        ok = readColumns(std::cin, kernel->arity(), cols);
+    }
+    else{
+        std::ifstream in(inputPath);
+        if(!in){
+            std::cerr << "Cannot open " << inputPath << "\n";
+            return 1;
+        }
+        ok = readColumns(in, kernel->arity(), cols);
+    }
+    if(!ok) return 1;
+
+    perf.begin("run");
+    size_t rows = cols.empty() ? 0 : cols[0].size();
+    std::vector<double> out(rows);
+    std::chrono::steady_clock::time_point start, stop;
+    if(kernel->f32()){
+        // the kernel reads and writes floats, converted outside the timing
+        std::vector<std::vector<float>> narrow;
+        std::vector<const float*> colPtrs;
+        for(auto& c : cols){
+            narrow.emplace_back(c.begin(), c.end());
+            colPtrs.push_back(narrow.back().data());
+        }
+        std::vector<float> res(rows);
+        start = std::chrono::steady_clock::now();
+        kernel->run(colPtrs.data(), res.data(), rows, threads);
+        stop = std::chrono::steady_clock::now();
+        out.assign(res.begin(), res.end());
+    }
+    else{
+        std::vector<const double*> colPtrs;
+        for(auto& c : cols) colPtrs.push_back(c.data());
+        start = std::chrono::steady_clock::now();
+        kernel->run(colPtrs.data(), out.data(), rows, threads);
+        stop = std::chrono::steady_clock::now();
+    }
+
+    perf.begin("write-output");
+    std::ostringstream buf;
+    for(double v : out) buf << v << "\n";
+    std::cout << buf.str();
+    std::cerr << "batch: " << rows << " rows in "
+              << std::chrono::duration<double, std::milli>(stop - start).count()
+              << " ms\n";
+    // --memoize: nothing if no function was memoized
+    kernel->memoReport(stderr);
+    return 0;
+}
+
+// --opt-report: the format follows the file's extension, text without one
+static bool writeOptReport(const llvm::Module& module, unsigned optLevel,
+                           const FPOptions& fp, const TargetSpec& target,
+                           const std::string& path){
+    std::unique_ptr<llvm::TargetMachine> tm = createTargetMachine(target, fp);
+    if(!tm) return false;
+    OptReport report;
+    if(!buildOptReport(module, *tm, optLevel, report))
+        return false;
+
+    if(path.empty()){
+        std::cout.flush();
+        printOptReport(report, ReportFormat::Text, llvm::outs());
+        llvm::outs().flush();
+        return true;
+    }
+    auto endsWith = [&](const char* ext){
+        std::string e(ext);
+        return path.size() >= e.size() && path.compare(path.size() - e.size(), e.size(), e) == 0;
+    };
+    ReportFormat format = endsWith(".json") ? ReportFormat::JSON
+                        : endsWith(".yaml") || endsWith(".yml") ? ReportFormat::YAML
+                        : ReportFormat::Text;
+    std::error_code EC;
+    llvm::raw_fd_ostream out(path, EC, llvm::sys::fs::OF_Text);
+    if(EC){
+        std::cerr << "Cannot open " << path << ": " << EC.message() << "\n";
+        return false;
+    }
+    printOptReport(report, format, out);
+    std::cout << "Optimization report written to " << path << "\n";
+    return true;
+}
+
+static std::vector<std::string> splitList(const std::string& s){
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while(std::getline(ss, item, ','))
+        if(!item.empty()) out.push_back(item);
+    return out;
+}
 
-    Lexer lexer(fcontent);
-    std::vector<TokenInfo> tokens = lexer.makeTokens();
+int main(int argc, char** argv){
 
-    // ---- Write Tokens to File ----
-    std::ofstream tokenFile("tokens_generated.txt");
-    for (const auto &token : tokens) {
-        tokenFile << "Token: " << token.txt 
-                  << " (" << static_cast<int>(token.type) << ")\n";
+    std::string inputFile = "input.txt";
+    std::string emitAst, fromAst, emitBc;
+    std::string batchFn, batchInput;
+    unsigned threads = 1;
+    bool memoize = false;
+    uint64_t foldBudget = DefaultFoldBudget;
+    std::vector<std::string> memoizeOnly;
+    std::vector<std::string> entries;
+    FPOptions fp;
+    std::string cpu, attrs;
+    DebugOptions debug;
+    unsigned maxNesting = DefaultMaxNesting;
+    unsigned parseThreads = 1;
+    bool pipeline = false;
+    unsigned pipelineWorkers = 0;
+    unsigned optLevel = 2;
+    bool optReport = false;
+    std::string optReportFile;
+    PhaseCounters perf;
+    std::string perfFile;
+    bool perfCalls = false;
+    std::vector<std::string> perfCallsOnly;
+    bool linkMode = false;
+    ThinLinkOptions link;
+    std::vector<std::string> positional;
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if((arg == "--emit-ast" || arg == "--from-ast") && i + 1 < argc){
+            (arg == "--emit-ast" ? emitAst : fromAst) = argv[++i];
+        }
+        else if(arg == "--emit-bc" && i + 1 < argc){
+            emitBc = argv[++i];
+        }
+        else if(arg == "--batch" && i + 1 < argc){
+            batchFn = argv[++i];
+        }
+        else if(arg == "--batch-input" && i + 1 < argc){
+            batchInput = argv[++i];
+        }
+        else if(arg == "--threads" && i + 1 < argc){
+            threads = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if(arg == "--memoize"){
+            memoize = true;
+        }
+        else if(arg.rfind("--memoize=", 0) == 0){
+            memoize = true;
+            memoizeOnly = splitList(arg.substr(10));
+        }
+        else if(arg == "--fold-budget" && i + 1 < argc){
+            foldBudget = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if(arg == "--no-fold"){
+            foldBudget = 0;
+        }
+        else if(arg == "--entry" && i + 1 < argc){
+            entries = splitList(argv[++i]);
+        }
+        else if(arg == "--precision=f32" || arg == "--precision=f64"){
+            fp.F32 = arg == "--precision=f32";
+        }
+        else if(arg == "--fast-math"){
+            fp.Fast = true;
+        }
+        else if(arg == "--reassoc"){
+            fp.Reassoc = true;
+        }
+        else if(arg == "--fp-contract"){
+            fp.Contract = true;
+        }
+        else if(arg == "--no-nans"){
+            fp.NoNaNs = true;
+        }
+        else if(arg.rfind("-march=", 0) == 0 || arg.rfind("-mcpu=", 0) == 0){
+            cpu = arg.substr(arg.find('=') + 1);
+        }
+        else if(arg.rfind("-mattr=", 0) == 0){
+            attrs = arg.substr(7);
+        }
+        else if(arg == "--max-nesting" && i + 1 < argc){
+            maxNesting = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if(arg == "--parse-threads" && i + 1 < argc){
+            parseThreads = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if(arg == "--pipeline" || arg.rfind("--pipeline=", 0) == 0){
+            pipeline = true;
+            if(arg.size() > 11) pipelineWorkers = std::strtoul(arg.c_str() + 11, nullptr, 10);
+        }
+        else if(arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0' && arg[2] <= '3'){
+            optLevel = arg[2] - '0';
+        }
+        else if(arg == "--opt-report"){
+            optReport = true;
+        }
+        else if(arg.rfind("--opt-report=", 0) == 0){
+            optReport = true;
+            optReportFile = arg.substr(13);
+        }
+        else if(arg == "-g"){
+            debug.DebugInfo = true;
+            debug.GDB = true;
+        }
+        else if(arg == "--perf"){
+            debug.DebugInfo = true;
+            debug.Perf = true;
+        }
+        else if(arg == "--perf-counters" || arg.rfind("--perf-counters=", 0) == 0){
+            if(!perf.enabled()) perf.enable();
+            if(arg.size() > 15) perfFile = arg.substr(16);
+        }
+        else if(arg == "--perf-calls" || arg.rfind("--perf-calls=", 0) == 0){
+            if(!perf.enabled()) perf.enable();
+            perfCalls = true;
+            if(arg.size() > 12) perfCallsOnly = splitList(arg.substr(13));
+        }
+        else if(arg == "--thinlto-link"){
+            linkMode = true;
+        }
+        else if(arg == "-o" && i + 1 < argc){
+            link.Output = argv[++i];
+        }
+        else if(arg == "--export" && i + 1 < argc){
+            link.Exports = splitList(argv[++i]);
+        }
+        else if(arg == "-j" && i + 1 < argc){
+            link.Jobs = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if(arg == "-h" || arg == "--help"){
+            usage();
+            return 0;
+        }
+        else if(!arg.empty() && arg[0] != '-'){
+            positional.push_back(arg);
+        }
+        else{
+            std::cerr << "Unknown option: " << arg << "\n";
+            usage();
+            return 1;
+        }
     }
-    tokenFile.close();
 
-    Parser parse(tokens);
-    auto program = parse.parseProgram();
-    if(!program){
-        std::cerr<<"Parsing failed\n";
+    TargetSpec target;
+    if(!makeTargetSpec(cpu, attrs, target))
         return 1;
+
+    if(linkMode){
+        link.Target = target;
+        for(auto& p : positional){
+            bool bc = p.size() > 3 && p.compare(p.size() - 3, 3, ".bc") == 0;
+            (bc ? link.Inputs : link.Objects).push_back(p);
+        }
+        if(link.Inputs.empty() || link.Output.empty()){
+            std::cerr << "--thinlto-link needs .bc inputs and -o <out>\n";
+            return 1;
+        }
+        return thinLink(link) ? 0 : 1;
+    }
+    if(positional.size() > 1){
+        std::cerr << "Only one input file per compilation (use --emit-bc + --thinlto-link)\n";
+        return 1;
+    }
+    if(!positional.empty())
+        inputFile = positional[0];
+
+    if(pipeline){
+        // every stage sees one definition at a time, so nothing that needs
+        // the whole program (or the whole token stream) first
+        const char* conflict = !fromAst.empty() ? "--from-ast"
+                             : !emitAst.empty() ? "--emit-ast"
+                             : !batchFn.empty() ? "--batch"
+                             : memoize ? "--memoize"
+                             : !entries.empty() ? "--entry"
+                             : optReport ? "--opt-report"
+                             : debug.DebugInfo ? "-g / --perf"
+                             : perf.enabled() ? "--perf-counters / --perf-calls"
+                             : parseThreads != 1 ? "--parse-threads" : nullptr;
+        if(conflict){
+            std::cerr << "--pipeline can't be combined with " << conflict << "\n";
+            return 1;
+        }
+        MappedSource source;
+        if(!source.open(inputFile))
+            return 1;
+        PipelineOptions opts;
+        opts.Workers = pipelineWorkers;
+        opts.MaxNesting = maxNesting;
+        opts.FP = fp;
+        opts.Target = target;
+        opts.ModuleName = inputFile;
+        opts.Bitcode = !emitBc.empty();
+        opts.Output = opts.Bitcode ? emitBc : "IR_generated.txt";
+        PipelineStats stats;
+        if(!compilePipelined(source.text(), opts, &stats)){
+            std::cerr << "Compilation failed\n";
+            return 1;
+        }
+        std::printf("Pipelined %zu function(s) into %zu module(s) on %u codegen worker(s)\n"
+                    "busy ms: lex %.1f, parse %.1f, codegen %.1f, emit %.1f; wall %.1f\n",
+                    stats.Functions, stats.Batches, stats.Workers, stats.LexMs,
+                    stats.ParseMs, stats.CodegenMs, stats.EmitMs, stats.WallMs);
+        if(opts.Bitcode)
+            std::cout << "Bitcode written to " << emitBc << "\n";
+        return 0;
+    }
+
+    std::unique_ptr<ProgramAST> program;
+    if(!fromAst.empty()){
+        // the view has to stay mapped only while the AST is being rebuilt
+        perf.begin("load-ast");
+        ASTFileView view;
+        if(!view.open(fromAst))
+            return 1;
+        program = materializeAST(view);
+        if(!program){
+            std::cerr<<"Loading "<<fromAst<<" failed\n";
+            return 1;
+        }
+    }
+    else if(parseThreads != 1){
+        // the file is mapped and parsed in place, in chunks
+        perf.begin("lex+parse");
+        MappedSource source;
+        if(!source.open(inputFile))
+            return 1;
+        program = parseParallel(source.text(), parseThreads, maxNesting);
+        if(!program){
+            std::cerr<<"Parsing failed\n";
+            return 1;
+        }
+        std::cout << "\nParsing completed successfully.\n";
+    }
+    else{
+        perf.begin("read-source");
+        std::string fcontent = readContent(inputFile);
+
+        perf.begin("lex");
+        Lexer lexer(std::move(fcontent));
+        std::vector<TokenInfo> tokens = lexer.makeTokens();
+
+        // ---- Write Tokens to File ----
+        perf.begin("write-tokens");
+        std::ofstream tokenFile("tokens_generated.txt");
+        for (const auto &token : tokens) {
+            tokenFile << "Token: " << token.txt
+                      << " (" << static_cast<int>(token.type) << ")\n";
+        }
+        tokenFile.close();
+
+        perf.begin("parse");
+        Parser parse(std::move(tokens));
+        parse.MaxExprNesting = parse.MaxBlockNesting = maxNesting;
+        program = parse.parseProgram();
+        if(!program){
+            std::cerr<<"Parsing failed\n";
+            return 1;
+        }
+        std::cout << "\nParsing completed successfully.\n";
+    }
+
+    if(!emitAst.empty()){
+        perf.begin("emit");
+        if(!writeASTFile(*program, emitAst))
+            return 1;
+        std::cout << "AST written to " << emitAst << "\n";
+        return perf.write(perfFile) ? 0 : 1;
     }
-    std::cout << "\nParsing completed successfully.\n";
 
-    for(auto& fn : program->Functions)
-        codegenFunction(fn.get());
+    // every call is resolved here, before any IR: a bad one fails the whole
+    // compile instead of leaving a half generated function behind
+    perf.begin("analysis");
+    CallGraph graph;
+    if(!graph.build(*program)){
+        std::cerr << "Compilation failed\n";
+        return 1;
+    }
+
+    // pure calls with constant arguments become their result
+    FoldStats folded = foldConstantCalls(*program, graph, foldBudget, fp.F32);
+    if(folded.Folded)
+        std::cout << "Folded " << folded.Folded << " constant call(s)\n";
+    if(folded.OutOfSteps)
+        std::cerr << "note: " << folded.OutOfSteps << " constant call(s) ran out of "
+                  << "--fold-budget, left for run time\n";
+    // the calls that went aren't edges any more: a function only ever
+    // called with constant arguments isn't reachable from --entry now
+    if(folded.Folded)
+        graph.build(*program);
+    std::vector<size_t> order;
+    if(!entries.empty() && !batchFn.empty())
+        entries.push_back(batchFn);
+    if(!graph.bottomUp(entries, order))
+        return 1;
+    if(!entries.empty())
+        std::cout << "Generating " << order.size() << " of " << graph.size()
+                  << " function(s) reachable from --entry\n";
+
+    perf.begin("codegen");
+    // local symbol GUIDs in ThinLTO summaries are derived from this name
+    std::string moduleName = fromAst.empty() ? inputFile : fromAst;
+    CodeGen cg(moduleName);
+    cg.setFPOptions(fp);
+    if(!cg.setTarget(target))
+        return 1;
+    cg.TheModule->setSourceFileName(moduleName);
+    // locations come from the lexer, a loaded AST has none
+    if(debug.DebugInfo)
+        cg.enableDebugInfo(moduleName);
+
+    if(memoize){
+        std::set<std::string> pure = findPureFunctions(graph);
+        std::set<std::string> wanted;
+        if(memoizeOnly.empty())
+            wanted = findRecursiveFunctions(graph);
+        else
+            wanted.insert(memoizeOnly.begin(), memoizeOnly.end());
+        for(auto& name : wanted){
+            if(pure.count(name))
+                cg.Memoize.insert(name);
+            else
+                std::cerr << "warning: '" << name << "' is not a pure function, not memoized\n";
+        }
+    }
+
+    if(perfCalls){
+        if(perfCallsOnly.empty())
+            for(auto& fn : program->Functions)
+                cg.PerfCalls.insert(fn->Proto->getName());
+        else
+            cg.PerfCalls.insert(perfCallsOnly.begin(), perfCallsOnly.end());
+    }
+
+    for(auto& ext : program->Externs)
+        if(!cg.TheModule->getFunction(ext->getName()))
+            cg.codegenPrototype(ext.get());
+
+    // a function that fails has said why; broken IR never reaches the
+    // optimizer, the JIT or a file (Session::compile does the same)
+    for(size_t i : order)
+        if(!cg.codegenFunction(program->Functions[i].get())){
+            std::cerr << "Compilation failed\n";
+            return 1;
+        }
+    cg.finalizeDebugInfo();
+    if(llvm::verifyModule(*cg.TheModule, &llvm::errs())){
+        std::cerr << "Generated invalid IR\n";
+        return 1;
+    }
+
+    // everything -O<n> and the backend do, on a copy of the module
+    if(optReport)
+        perf.begin("optimize");
+    if(optReport && !writeOptReport(*cg.TheModule, optLevel, fp, target, optReportFile))
+        return 1;
+
+    if(!batchFn.empty()){
+        int rc = runBatch(*cg.TheModule, batchFn, batchInput, threads, fp, target, debug, perf);
+        if(rc == 0 && !perf.write(perfFile))
+            rc = 1;
+        return rc;
+    }
+
+    perf.begin("emit");
+    if(!emitBc.empty()){
+        if(!emitThinLTOBitcode(*cg.TheModule, emitBc))
+            return 1;
+        std::cout << "Bitcode written to " << emitBc << "\n";
+        return perf.write(perfFile) ? 0 : 1;
+    }
 
     // ---- Write LLVM IR to File ----
     std::error_code EC;
@@ -54,8 +697,8 @@ int main(){
         return 1;
     }
 
-    TheModule.print(irFile, nullptr);
+    cg.TheModule->print(irFile, nullptr);
     irFile.close();
 
-    return 0;
+    return perf.write(perfFile) ? 0 : 1;
 }
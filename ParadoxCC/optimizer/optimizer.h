@@ -0,0 +1,8 @@
+#pragma once
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+
+// Runs LLVM's default -O<level> pipeline over M.
+// TM may be null, but without it the vectorizer and unroller have no cost
+// model for the real target and mostly stay out of the way.
+void optimizeModule(llvm::Module& M, llvm::TargetMachine* TM, unsigned level);
@@ -0,0 +1,251 @@
+#include "report.h"
+#include "optimizer.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/DiagnosticHandler.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <algorithm>
+#include <iostream>
+#include <map>
+
+namespace {
+
+// takes every remark the pipeline emits instead of printing it
+struct RemarkCollector : llvm::DiagnosticHandler {
+    std::map<std::string, FunctionReport*>& Reports;
+
+    explicit RemarkCollector(std::map<std::string, FunctionReport*>& reports)
+        : Reports(reports) {}
+
+    bool isAnalysisRemarkEnabled(llvm::StringRef) const override { return true; }
+    bool isMissedOptRemarkEnabled(llvm::StringRef) const override { return true; }
+    bool isPassedOptRemarkEnabled(llvm::StringRef) const override { return true; }
+    bool isAnyRemarkEnabled() const override { return true; }
+
+    bool handleDiagnostics(const llvm::DiagnosticInfo& DI) override {
+        auto* remark = llvm::dyn_cast<llvm::DiagnosticInfoIROptimization>(&DI);
+        // errors and warnings are printed as usual
+        if(!remark) return false;
+
+        llvm::StringRef pass = remark->getPassName();
+        bool inliner = pass == "inline" || pass == "always-inline";
+        if(!inliner && pass != "loop-vectorize" && pass != "loop-unroll"
+           && pass != "slp-vectorizer")
+            return true;
+
+        // inlining remarks are about the callee, the others about the
+        // function the code is in
+        std::string name = remark->getFunction().getName().str();
+        if(inliner)
+            for(auto& arg : remark->getArgs())
+                if(arg.Key == "Callee") name = arg.Val;
+        auto it = Reports.find(name);
+        if(it == Reports.end()) return true;
+        FunctionReport& r = *it->second;
+
+        if(remark->isPassed()){
+            if(inliner) r.InlinedInto++;
+            else if(pass == "loop-vectorize" && remark->getRemarkName() == "Vectorized")
+                r.LoopsVectorized++;
+            else if(pass == "loop-unroll") r.LoopsUnrolled++;
+            else if(pass == "slp-vectorizer") r.SLPVectorized++;
+            return true;
+        }
+        // the same remark comes again for every inlined copy / rerun
+        std::string note = pass.str() + ": " + remark->getMsg();
+        if(std::find(r.Notes.begin(), r.Notes.end(), note) == r.Notes.end())
+            r.Notes.push_back(note);
+        return true;
+    }
+};
+
+// function symbol sizes in an object emitted from M
+bool codeSizes(llvm::Module& M, llvm::TargetMachine& TM,
+               std::map<std::string, uint64_t>& sizes){
+    llvm::SmallVector<char, 0> buf;
+    llvm::raw_svector_ostream os(buf);
+    llvm::legacy::PassManager PM;
+    if(TM.addPassesToEmitFile(PM, os, nullptr, llvm::CGFT_ObjectFile)){
+        std::cerr << "Opt report: the target can't emit object files\n";
+        return false;
+    }
+    PM.run(M);
+
+    auto obj = llvm::object::ObjectFile::createObjectFile(
+        llvm::MemoryBufferRef(llvm::StringRef(buf.data(), buf.size()), "opt-report"));
+    if(!obj){
+        std::cerr << "Opt report: " << llvm::toString(obj.takeError()) << "\n";
+        return false;
+    }
+    for(auto& [sym, size] : llvm::object::computeSymbolSizes(**obj)){
+        auto type = sym.getType();
+        auto name = sym.getName();
+        if(!type || !name){
+            llvm::consumeError(type.takeError());
+            llvm::consumeError(name.takeError());
+            continue;
+        }
+        if(*type == llvm::object::SymbolRef::ST_Function)
+            sizes[name->str()] = size;
+    }
+    return true;
+}
+
+} // namespace
+
+bool buildOptReport(const llvm::Module& M, llvm::TargetMachine& TM, unsigned level,
+                    OptReport& out){
+    if(llvm::verifyModule(M, &llvm::errs())){
+        std::cerr << "Opt report: the module is invalid\n";
+        return false;
+    }
+    out.OptLevel = level;
+    out.Functions.clear();
+    for(const llvm::Function& fn : M){
+        if(fn.isDeclaration()) continue;
+        FunctionReport r;
+        r.Name = fn.getName().str();
+        r.InstrsBefore = fn.getInstructionCount();
+        r.BlocksBefore = fn.size();
+        out.Functions.push_back(std::move(r));
+    }
+    std::map<std::string, FunctionReport*> byName;
+    for(auto& r : out.Functions)
+        byName[r.Name] = &r;
+
+    std::unique_ptr<llvm::Module> copy = llvm::CloneModule(M);
+    llvm::LLVMContext& ctx = copy->getContext();
+    // the collector only for as long as the copy is optimized
+    std::unique_ptr<llvm::DiagnosticHandler> previous = ctx.getDiagnosticHandler();
+    ctx.setDiagnosticHandler(std::make_unique<RemarkCollector>(byName));
+    optimizeModule(*copy, &TM, level);
+    ctx.setDiagnosticHandler(std::move(previous));
+
+    for(auto& r : out.Functions){
+        llvm::Function* fn = copy->getFunction(r.Name);
+        r.Removed = !fn || fn->isDeclaration();
+        if(r.Removed) continue;
+        r.InstrsAfter = fn->getInstructionCount();
+        r.BlocksAfter = fn->size();
+    }
+
+    llvm::CodeGenOpt::Level cgLevel = level == 0 ? llvm::CodeGenOpt::None
+                                    : level == 1 ? llvm::CodeGenOpt::Less
+                                    : level == 2 ? llvm::CodeGenOpt::Default
+                                    : llvm::CodeGenOpt::Aggressive;
+    TM.setOptLevel(cgLevel);
+    std::map<std::string, uint64_t> sizes;
+    if(!codeSizes(*copy, TM, sizes))
+        return false;
+    for(auto& r : out.Functions){
+        auto it = sizes.find(r.Name);
+        if(it != sizes.end()) r.CodeSize = it->second;
+    }
+    return true;
+}
+
+static void printText(const OptReport& report, llvm::raw_ostream& os){
+    size_t width = 8;
+    for(auto& r : report.Functions)
+        width = std::max(width, r.Name.size());
+
+    os << "optimization report (-O" << report.OptLevel << ")\n";
+    os << llvm::left_justify("function", width)
+       << "   instrs blocks ->  instrs blocks  inlined  vectorized  unrolled    bytes\n";
+    for(auto& r : report.Functions){
+        os << llvm::left_justify(r.Name, width) << " "
+           << llvm::format_decimal(r.InstrsBefore, 8) << llvm::format_decimal(r.BlocksBefore, 7)
+           << " -> ";
+        if(r.Removed)
+            os << llvm::right_justify("removed", 14);
+        else
+            os << llvm::format_decimal(r.InstrsAfter, 7) << llvm::format_decimal(r.BlocksAfter, 7);
+        os << llvm::format_decimal(r.InlinedInto, 9)
+           << llvm::format_decimal(r.LoopsVectorized, 12)
+           << llvm::format_decimal(r.LoopsUnrolled, 10)
+           << llvm::format_decimal(r.CodeSize, 9) << "\n";
+        if(r.SLPVectorized)
+            os << "    slp-vectorizer: " << r.SLPVectorized << " straight line group(s) vectorized\n";
+        for(auto& note : r.Notes)
+            os << "    " << note << "\n";
+    }
+}
+
+static void printJSON(const OptReport& report, llvm::raw_ostream& os){
+    llvm::json::OStream J(os, 2);
+    J.object([&]{
+        J.attribute("optLevel", report.OptLevel);
+        J.attributeArray("functions", [&]{
+            for(auto& r : report.Functions)
+                J.object([&]{
+                    J.attribute("name", r.Name);
+                    J.attributeObject("before", [&]{
+                        J.attribute("instructions", (int64_t)r.InstrsBefore);
+                        J.attribute("blocks", (int64_t)r.BlocksBefore);
+                    });
+                    if(r.Removed)
+                        J.attribute("after", nullptr);
+                    else
+                        J.attributeObject("after", [&]{
+                            J.attribute("instructions", (int64_t)r.InstrsAfter);
+                            J.attribute("blocks", (int64_t)r.BlocksAfter);
+                        });
+                    J.attribute("inlinedInto", r.InlinedInto);
+                    J.attribute("loopsVectorized", r.LoopsVectorized);
+                    J.attribute("loopsUnrolled", r.LoopsUnrolled);
+                    J.attribute("slpVectorized", r.SLPVectorized);
+                    J.attribute("codeSize", (int64_t)r.CodeSize);
+                    J.attributeArray("notes", [&]{
+                        for(auto& note : r.Notes) J.value(note);
+                    });
+                });
+        });
+    });
+    os << "\n";
+}
+
+// YAML takes JSON's double quoted strings as they are
+static std::string quoted(const std::string& s){
+    std::string out;
+    llvm::raw_string_ostream os(out);
+    os << llvm::json::Value(s);
+    return os.str();
+}
+
+static void printYAML(const OptReport& report, llvm::raw_ostream& os){
+    os << "optLevel: " << report.OptLevel << "\n";
+    os << "functions:\n";
+    for(auto& r : report.Functions){
+        os << "  - name: " << quoted(r.Name) << "\n";
+        os << "    before: { instructions: " << r.InstrsBefore
+           << ", blocks: " << r.BlocksBefore << " }\n";
+        if(r.Removed)
+            os << "    after: null\n";
+        else
+            os << "    after: { instructions: " << r.InstrsAfter
+               << ", blocks: " << r.BlocksAfter << " }\n";
+        os << "    inlinedInto: " << r.InlinedInto << "\n";
+        os << "    loopsVectorized: " << r.LoopsVectorized << "\n";
+        os << "    loopsUnrolled: " << r.LoopsUnrolled << "\n";
+        os << "    slpVectorized: " << r.SLPVectorized << "\n";
+        os << "    codeSize: " << r.CodeSize << "\n";
+        os << "    notes:" << (r.Notes.empty() ? " []\n" : "\n");
+        for(auto& note : r.Notes)
+            os << "      - " << quoted(note) << "\n";
+    }
+}
+
+void printOptReport(const OptReport& report, ReportFormat format, llvm::raw_ostream& os){
+    switch(format){
+    case ReportFormat::Text: printText(report, os); break;
+    case ReportFormat::JSON: printJSON(report, os); break;
+    case ReportFormat::YAML: printYAML(report, os); break;
+    }
+}
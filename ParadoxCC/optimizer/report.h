@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+// What optimization did to each function (--opt-report).
+// Counts before are taken right after codegen, counts after once the -O<n>
+// pipeline ran. Inlining, vectorization and unrolling come from LLVM's
+// optimization remarks; the remarks saying why something did not happen
+// end up in Notes.
+struct FunctionReport {
+    std::string Name;
+    size_t InstrsBefore = 0, BlocksBefore = 0;
+    size_t InstrsAfter = 0, BlocksAfter = 0;
+    bool Removed = false;          // not in the module after optimization
+    unsigned InlinedInto = 0;      // call sites it was inlined into
+    unsigned LoopsVectorized = 0;
+    unsigned LoopsUnrolled = 0;    // fully, partially or peeled
+    unsigned SLPVectorized = 0;    // straight line code packed into vectors
+    uint64_t CodeSize = 0;         // bytes of machine code, 0 if removed
+    // "pass: message" of missed / analysis remarks, e.g. why a loop
+    // wasn't vectorized or a call wasn't inlined
+    std::vector<std::string> Notes;
+};
+
+struct OptReport {
+    unsigned OptLevel = 0;
+    std::vector<FunctionReport> Functions;  // defined functions, module order
+};
+
+// optimizes a copy of M at level with TM's cost model, compiles it to an
+// object in memory and reports on every function defined in M. M itself
+// is not touched. false (and reports) if M is invalid or the object can't
+// be emitted.
+bool buildOptReport(const llvm::Module& M, llvm::TargetMachine& TM, unsigned level,
+                    OptReport& out);
+
+enum class ReportFormat { Text, JSON, YAML };
+
+void printOptReport(const OptReport& report, ReportFormat format, llvm::raw_ostream& os);
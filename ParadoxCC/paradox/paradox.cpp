@@ -0,0 +1,223 @@
+#include "paradox.h"
+#include "../lexer/lexer.h"
+#include "../parser/parser.h"
+#include "../frontend/frontend.h"
+#include "../codegen/codegen.h"
+#include "../jit/jit.h"
+#include "../runtime/runtime.h"
+#include "../analysis/purity.h"
+#include "../analysis/consteval.h"
+#include "../analysis/callgraph.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
+#include <iostream>
+#include <set>
+#include <vector>
+
+namespace paradox {
+
+namespace {
+
+// one Lazy compile(), kept until its last function is generated
+struct LazyProgram {
+    std::unique_ptr<ProgramAST> AST;
+    // what calls can resolve to, like in the module of an eager compile():
+    // earlier compile()s, externs, and of this one the functions above
+    std::map<std::string, size_t> Earlier;
+    std::map<std::string, PrototypeAST*> Externs;
+    std::map<std::string, size_t> Position;  // index in AST->Functions
+    std::set<std::string> Memoize;
+    bool PerfCalls = false;
+    std::string ModuleName, DebugFile;
+    FPOptions FP;
+    TargetSpec Target;
+    bool DebugInfo = false;
+};
+
+// a module with just name's body and the declarations it calls
+llvm::orc::ThreadSafeModule generateLazy(const LazyProgram& p, const std::string& name){
+    size_t at = p.Position.at(name);
+    FunctionAST* fn = p.AST->Functions[at].get();
+    CodeGen cg(p.ModuleName + "." + name);
+    cg.setFPOptions(p.FP);
+    if(!p.Target.empty() && !cg.setTarget(p.Target))
+        return {};
+    if(p.DebugInfo)
+        cg.enableDebugInfo(p.DebugFile);
+    if(p.Memoize.count(name))
+        cg.Memoize.insert(name);
+    if(p.PerfCalls)
+        cg.PerfCalls.insert(name);
+
+    for(auto& callee : collectCallees(*fn)){
+        if(cg.TheModule->getFunction(callee)) continue;
+        auto earlier = p.Earlier.find(callee);
+        auto ext = p.Externs.find(callee);
+        auto pos = p.Position.find(callee);
+        if(earlier != p.Earlier.end()){
+            PrototypeAST proto(callee, std::vector<std::string>(earlier->second, "arg"));
+            cg.codegenPrototype(&proto);
+        }
+        else if(ext != p.Externs.end())
+            cg.codegenPrototype(ext->second);
+        else if(pos != p.Position.end() && pos->second < at)
+            cg.codegenPrototype(p.AST->Functions[pos->second]->Proto.get());
+    }
+    if(!cg.codegenFunction(fn))
+        return {};
+    cg.finalizeDebugInfo();
+
+    if(llvm::verifyModule(*cg.TheModule, &llvm::errs())){
+        std::cerr << "paradox: generated invalid IR for '" << name << "'\n";
+        return {};
+    }
+    return llvm::orc::ThreadSafeModule(std::move(cg.TheModule), std::move(cg.TheContext));
+}
+
+} // namespace
+
+Session::Session(const FPOptions& fp, const TargetSpec& target, const DebugOptions& debug)
+    : JIT(ParadoxJIT::create(fp, target, debug)), FP(fp), Target(target), Debug(debug) {}
+
+Session::~Session() = default;
+
+bool Session::compile(const std::string& source, const std::string& sourceName){
+    std::lock_guard<std::mutex> guard(Lock);
+    if(!JIT){
+        std::cerr << "paradox: no JIT available for this host\n";
+        return false;
+    }
+
+    unsigned maxNesting = MaxNesting ? MaxNesting : DefaultMaxNesting;
+    std::unique_ptr<ProgramAST> program;
+    if(ParseThreads != 1)
+        program = parseParallel(source, ParseThreads, maxNesting);
+    else{
+        // tokens are pulled as needed, never all in memory at once
+        Lexer lexer(source);
+        Parser parser(lexer);
+        parser.MaxExprNesting = parser.MaxBlockNesting = maxNesting;
+        program = parser.parseProgram();
+    }
+    if(!program) return false;
+
+    for(auto& fn : program->Functions)
+        if(Compiled.count(fn->Proto->getName())){
+            std::cerr << "paradox: redefinition of '" << fn->Proto->getName() << "'\n";
+            return false;
+        }
+
+    // bad calls fail the compile here, in either mode, not at first call
+    CallGraph graph;
+    if(!graph.build(*program, Compiled))
+        return false;
+    if(FoldConstants && foldConstantCalls(*program, graph, DefaultFoldBudget, FP.F32).Folded)
+        graph.build(*program, Compiled);
+    std::vector<size_t> order;
+    if(!graph.bottomUp({}, order))
+        return false;
+
+    // every compile() gets a fresh module + context, the JIT links them
+    std::string moduleName = "paradox." + std::to_string(ModuleCount++);
+    if(Lazy)
+        return compileLazy(std::move(program), graph, moduleName, sourceName);
+    CodeGen cg(moduleName);
+    cg.setFPOptions(FP);
+    if(!Target.empty() && !cg.setTarget(Target))
+        return false;
+    if(Debug.DebugInfo)
+        cg.enableDebugInfo(sourceName.empty() ? moduleName : sourceName);
+    if(Memoize){
+        std::set<std::string> pure = findPureFunctions(graph);
+        for(auto& name : findRecursiveFunctions(graph))
+            if(pure.count(name)) cg.Memoize.insert(name);
+    }
+    if(PerfCalls)
+        for(auto& fn : program->Functions)
+            cg.PerfCalls.insert(fn->Proto->getName());
+
+    // earlier modules are only visible through declarations
+    for(auto& [name, arity] : Compiled){
+        PrototypeAST proto(name, std::vector<std::string>(arity, "arg"));
+        cg.codegenPrototype(&proto);
+    }
+    for(auto& ext : program->Externs)
+        if(!cg.TheModule->getFunction(ext->getName()))
+            cg.codegenPrototype(ext.get());
+    for(size_t i : order)
+        if(!cg.codegenFunction(program->Functions[i].get()))
+            return false;
+    cg.finalizeDebugInfo();
+
+    if(llvm::verifyModule(*cg.TheModule, &llvm::errs())){
+        std::cerr << "paradox: generated invalid IR\n";
+        return false;
+    }
+
+    JIT->OptLevel = OptLevel;
+    if(!JIT->addModule(std::move(cg.TheModule), std::move(cg.TheContext)))
+        return false;
+
+    for(auto& fn : program->Functions)
+        Compiled[fn->Proto->getName()] = fn->Proto->Args.size();
+    EagerFunctions += program->Functions.size();
+    return true;
+}
+
+bool Session::compileLazy(std::unique_ptr<ProgramAST> program, const CallGraph& graph,
+                          const std::string& moduleName, const std::string& sourceName){
+    auto p = std::make_shared<LazyProgram>();
+    std::vector<std::string> names;
+    for(size_t i = 0; i < program->Functions.size(); i++){
+        const std::string& name = program->Functions[i]->Proto->getName();
+        if(!p->Position.emplace(name, i).second){
+            std::cerr << "paradox: redefinition of '" << name << "'\n";
+            return false;
+        }
+        names.push_back(name);
+    }
+    for(auto& ext : program->Externs)
+        p->Externs.emplace(ext->getName(), ext.get());
+    p->Earlier = Compiled;
+    if(Memoize){
+        std::set<std::string> pure = findPureFunctions(graph);
+        for(auto& name : findRecursiveFunctions(graph))
+            if(pure.count(name)) p->Memoize.insert(name);
+    }
+    p->PerfCalls = PerfCalls;
+    p->ModuleName = moduleName;
+    p->DebugFile = sourceName.empty() ? moduleName : sourceName;
+    p->FP = FP;
+    p->Target = Target;
+    p->DebugInfo = Debug.DebugInfo;
+    p->AST = std::move(program);
+
+    // nothing is generated yet, every function only gets its stub
+    JIT->OptLevel = OptLevel;
+    if(!JIT->addLazy(names, [p](const std::string& name){ return generateLazy(*p, name); }))
+        return false;
+    for(auto& [name, at] : p->Position)
+        Compiled[name] = p->AST->Functions[at]->Proto->Args.size();
+    return true;
+}
+
+size_t Session::compiledFunctions(){
+    std::lock_guard<std::mutex> guard(Lock);
+    return EagerFunctions + (JIT ? JIT->lazyCompiled() : 0);
+}
+
+void Session::memoReport(FILE* out){
+    std::lock_guard<std::mutex> guard(Lock);
+    if(JIT)
+        paradox_memo_report(JIT->memoTables(), out);
+}
+
+void* Session::lookup(const std::string& name, size_t arity){
+    std::lock_guard<std::mutex> guard(Lock);
+    auto it = Compiled.find(name);
+    if(it == Compiled.end() || it->second != arity)
+        return nullptr;
+    return JIT->lookup(name);
+}
+
+} // namespace paradox
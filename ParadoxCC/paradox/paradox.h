@@ -0,0 +1,128 @@
+#pragma once
+#include <cstddef>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+
+#include "../codegen/debug.h"
+#include "../target/target.h"
+
+class ParadoxJIT;
+class ProgramAST;
+class CallGraph;
+
+// libparadox: embedding API
+//
+//   paradox::Session s;
+//   if (s.compile("def max(a, b) { if (a > b) { a; } else { b; } }")) {
+//       auto max = s.get<double(double, double)>("max");
+//       double r = max(3, 4);
+//   }
+//
+// A Session owns its own JIT, LLVM contexts and symbol tables; nothing is
+// shared between sessions, so independent sessions can compile and run on
+// different threads at the same time. One session may also be shared, its
+// methods are serialized internally. Compiled code is freed with the session.
+namespace paradox {
+
+// typed handle to a JIT'd function. Paradox only has doubles, so every
+// parameter and the result are double. Valid as long as its Session lives.
+template <typename Sig> class Function;
+
+template <typename... Args>
+class Function<double(Args...)> {
+    static_assert((std::is_same_v<Args, double> && ...),
+                  "Paradox functions only take doubles");
+    using Ptr = double (*)(Args...);
+    Ptr Fn = nullptr;
+
+public:
+    static constexpr size_t Arity = sizeof...(Args);
+
+    Function() = default;
+    explicit Function(void* addr) : Fn(reinterpret_cast<Ptr>(addr)) {}
+
+    explicit operator bool() const { return Fn != nullptr; }
+    double operator()(Args... args) const { return Fn(args...); }
+};
+
+class Session {
+public:
+    // fp picks the FP semantics of everything compiled in this session,
+    // target the CPU to tune for (default: this machine, all its features),
+    // debug whether gdb / perf get to see the generated code
+    explicit Session(const FPOptions& fp = FPOptions(),
+                     const TargetSpec& target = TargetSpec(),
+                     const DebugOptions& debug = DebugOptions());
+    ~Session();
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    // optimization level for the following compile() calls
+    unsigned OptLevel = 2;
+    // cache results of pure recursive functions (see --memoize). The tables
+    // are freed with the session, memoReport() has their hit rates.
+    bool Memoize = false;
+    // measure every call into a compiled function from outside with
+    // performance counters (see --perf-calls); collectPerfCalls() in
+    // runtime/perf.h has the totals
+    bool PerfCalls = false;
+    // evaluate calls to pure functions with constant arguments at compile
+    // time (see --fold-budget). Only functions from the same compile() are
+    // run, earlier ones are just declarations here.
+    bool FoldConstants = true;
+    // deeper nested parentheses / blocks are a compile error (--max-nesting),
+    // 0 keeps the parser's default
+    unsigned MaxNesting = 0;
+    // lex + parse big sources on this many threads, 0 = one per core
+    // (see --parse-threads)
+    unsigned ParseThreads = 1;
+    // generate and compile each function only when it is first called,
+    // startup then costs what runs, not what's there. Calls between
+    // functions go through stubs and aren't inlined. Bad calls still fail
+    // compile() (see analysis/callgraph.h); other errors in a function's IR
+    // show up at its first call, which then returns NaN.
+    bool Lazy = false;
+
+    // lexes, parses, generates and JITs source. Functions from earlier
+    // compile() calls in this session can be called from it. Returns false
+    // (errors go to stderr) if any stage fails; nothing is added then.
+    // sourceName is the file name the debug info refers to (with
+    // DebugOptions::DebugInfo), by default a made up "paradox.N".
+    bool compile(const std::string& source, const std::string& sourceName = "");
+
+    // handle to a compiled function, empty if there is no function of that
+    // name or it takes a different number of parameters
+    template <typename Sig>
+    Function<Sig> get(const std::string& name) {
+        return Function<Sig>(lookup(name, Function<Sig>::Arity));
+    }
+
+    // functions generated and compiled so far: all of them, with Lazy only
+    // those that have been called
+    size_t compiledFunctions();
+
+    // calls, hits and evictions of every memo table the code compiled in
+    // this session has used so far, one line each; nothing without Memoize
+    void memoReport(FILE* out);
+
+private:
+    void* lookup(const std::string& name, size_t arity);
+    bool compileLazy(std::unique_ptr<ProgramAST> program, const CallGraph& graph,
+                     const std::string& moduleName, const std::string& sourceName);
+
+    std::mutex Lock;
+    std::unique_ptr<ParadoxJIT> JIT;
+    FPOptions FP;
+    TargetSpec Target;
+    DebugOptions Debug;
+    // name -> parameter count of every function compiled so far
+    std::map<std::string, size_t> Compiled;
+    unsigned ModuleCount = 0;
+    size_t EagerFunctions = 0;
+};
+
+} // namespace paradox
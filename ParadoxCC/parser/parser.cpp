@@ -1,8 +1,54 @@
 #include "parser.h"
+#include<algorithm>
 #include<iostream>
 
+// a + b + c + ... is as deep as it is long, and unique_ptr would free it
+// with one nested destructor call per level. Children are unlinked onto a
+// heap stack instead, so every node is destroyed without children.
+static void destroyIteratively(std::vector<std::unique_ptr<ASTNode>>& pending) {
+    while (!pending.empty()) {
+        std::unique_ptr<ASTNode> node = std::move(pending.back());
+        pending.pop_back();
+        if (auto* b = dynamic_cast<BinaryExprAST*>(node.get())) {
+            if (b->lhs) pending.push_back(std::move(b->lhs));
+            if (b->rhs) pending.push_back(std::move(b->rhs));
+        }
+        else if (auto* c = dynamic_cast<CallExprAST*>(node.get())) {
+            for (auto& arg : c->Args)
+                pending.push_back(std::move(arg));
+            c->Args.clear();
+        }
+    }
+}
+
+BinaryExprAST::~BinaryExprAST() {
+    if (!lhs && !rhs) return;
+    std::vector<std::unique_ptr<ASTNode>> pending;
+    pending.push_back(std::move(lhs));
+    pending.push_back(std::move(rhs));
+    destroyIteratively(pending);
+}
+
+CallExprAST::~CallExprAST() {
+    destroyIteratively(Args);
+}
+
 Parser::Parser(const std::vector<TokenInfo>& toks)
-    : tokens(toks), current(0) {
+    : Parser(std::vector<TokenInfo>(toks)) {}
+
+Parser::Parser(Lexer& lexer)
+    : Parser([&lexer] { return lexer.next(); }) {}
+
+Parser::Parser(std::function<TokenInfo()> next)
+    : Parser(std::vector<TokenInfo>()) {
+    tokens.clear();
+    Source = std::move(next);
+}
+
+Parser::Parser(std::vector<TokenInfo>&& toks)
+    : tokens(std::move(toks)), current(0) {
+    if (tokens.empty() || tokens.back().type != tok_eof)
+        tokens.push_back({tok_eof, "", 0});
 
     BinOpPrecedence['<'] = 10;
     BinOpPrecedence['>'] = 10;
@@ -24,20 +70,39 @@ int Parser::getTokPrecedence() {
     return prec;
 }
 
+TokenInfo& Parser::token(size_t i) {
+    while (i - Base >= tokens.size()
+           && Source && (tokens.empty() || tokens.back().type != tok_eof))
+        tokens.push_back(Source());
+    return tokens[std::min(i - Base, tokens.size() - 1)];
+}
+
 TokenInfo& Parser::peek() {
-    return tokens[current];
+    return token(current);
 }
 
 TokenInfo& Parser::previous() {
-    return tokens[current - 1];
+    return token(current - 1);
+}
+
+SourceLoc Parser::here() {
+    const TokenInfo& tok = peek();
+    return {tok.line, tok.col};
 }
 
 bool Parser::isAtEnd() {
-    return current >= tokens.size() || peek().type == tok_eof;
+    return peek().type == tok_eof;
 }
 
+// with a lexer as source, tokens before previous() are dropped now and then
 void Parser::advance() {
-    if (!isAtEnd()) current++;
+    if (isAtEnd()) return;
+    current++;
+    if (Source && current - Base > 4096) {
+        size_t drop = current - 1 - Base;
+        tokens.erase(tokens.begin(), tokens.begin() + drop);
+        Base += drop;
+    }
 }
 
 bool Parser::check(Token type) {
@@ -55,33 +120,68 @@ bool Parser::match(Token type) {
 
 std::unique_ptr<ProgramAST> Parser::parseProgram(){
     auto program = std::make_unique<ProgramAST>();
+    bool ok = parseDefinitions(
+        [&](std::unique_ptr<FunctionAST> fn){
+            program->addFunction(std::move(fn));
+            return true;
+        },
+        [&](std::unique_ptr<PrototypeAST> proto){
+            program->addExtern(std::move(proto));
+            return true;
+        });
+    if(!ok) return nullptr;
+    return program;
+}
+
+bool Parser::parseDefinitions(
+        const std::function<bool(std::unique_ptr<FunctionAST>)>& onFunction,
+        const std::function<bool(std::unique_ptr<PrototypeAST>)>& onExtern){
     while(!isAtEnd()){
         if(check(tok_def)){
             auto fn = parseFunction();
             if(!fn){
                 std::cerr << "Failed to parse function\n";
-                return nullptr;
+                return false;
             }
-            program->addFunction(std::move(fn));
+            if(!onFunction(std::move(fn))) return false;
+        }
+        else if(check(tok_extern)){
+            auto proto = parseExtern();
+            if(!proto){
+                std::cerr << "Failed to parse extern\n";
+                return false;
+            }
+            if(!onExtern(std::move(proto))) return false;
         }
         else{
             std::cerr << "Expected function definition, got: '"
                       << peek().txt << "' (" << (int)peek().type << ")\n";
-            return nullptr;
+            return false;
         }
     }
-    return program;
+    return true;
 }
 
 std::unique_ptr<FunctionAST> Parser::parseFunction(){
+    SourceLoc loc = here();
     advance();
     auto proto = parsePrototype();
     if(!proto) return nullptr;
-    auto body = parseBlock();
-    return std::make_unique<FunctionAST>(std::move(proto), std::move(body));
+    std::vector<std::unique_ptr<ASTNode>> body;
+    if(!parseBlock(body)) return nullptr;
+    return at(loc, std::make_unique<FunctionAST>(std::move(proto), std::move(body)));
+}
+
+std::unique_ptr<PrototypeAST> Parser::parseExtern(){
+    advance(); // consume 'extern'
+    auto proto = parsePrototype();
+    if(!proto) return nullptr;
+    match((Token)';'); // trailing ';' is optional
+    return proto;
 }
 
 std::unique_ptr<PrototypeAST> Parser::parsePrototype(){
+    SourceLoc loc = here();
     if (!match(tok_identifier)) {
         std::cerr << "Expected function name\n";
         return nullptr;
@@ -105,23 +205,41 @@ std::unique_ptr<PrototypeAST> Parser::parsePrototype(){
         std::cerr << "Expected ',' or ')'\n";
         return nullptr;
     }
-    return std::make_unique<PrototypeAST>(name, std::move(args));
+    return at(loc, std::make_unique<PrototypeAST>(name, std::move(args)));
 }
 
-std::vector<std::unique_ptr<ASTNode>> Parser::parseBlock() {
-    std::vector<std::unique_ptr<ASTNode>> statements;
+bool Parser::parseBlock(std::vector<std::unique_ptr<ASTNode>>& statements) {
     if (!match((Token)'{')) {
         std::cerr << "Expected '{'\n";
-        return statements;
+        return false;
     }
+    unsigned openLine = previous().line;
+    if (BlockDepth >= MaxBlockNesting) {
+        std::cerr << "Blocks nested more than " << MaxBlockNesting
+                  << " levels deep (line " << previous().line << ")\n";
+        return false;
+    }
+    BlockDepth++;
     while (!check((Token)'}') && !isAtEnd()) {
+        SourceLoc loc = here();
         auto stmt = parseStatement();
-        if (!stmt)
-            return {};
+        if (!stmt) {
+            BlockDepth--;
+            return false;
+        }
+        // expressions know where they are, statements start here
+        if (!stmt->Loc.Line)
+            stmt->Loc = loc;
         statements.push_back(std::move(stmt));
     }
-    match((Token)'}');
-    return statements;
+    BlockDepth--;
+    // running into the end of the input (or of one def, see
+    // frontend/incremental.h) is not a closed block
+    if (!match((Token)'}')) {
+        std::cerr << "Expected '}' to close the block opened on line " << openLine << "\n";
+        return false;
+    }
+    return true;
 }
 
 std::unique_ptr<ASTNode> Parser::parseStatement() {
@@ -131,9 +249,11 @@ std::unique_ptr<ASTNode> Parser::parseStatement() {
     if (check(tok_cycle))
         return parseCycleStatement();
 
+    if (check(tok_pcycle))
+        return parsePCycleStatement();
+
     // lookahead: identifier followed by '=' is an assignment
-    if (check(tok_identifier) && current + 1 < tokens.size()
-        && tokens[current + 1].type == (Token)'=')
+    if (check(tok_identifier) && token(current + 1).type == (Token)'=')
         return parseAssignment();
 
     // expression-statement
@@ -174,11 +294,11 @@ std::unique_ptr<ASTNode> Parser::parseIfStatement() {
         std::cerr << "Expected ')' after if condition\n";
         return nullptr;
     }
-    auto thenBlock = parseBlock();
-    std::vector<std::unique_ptr<ASTNode>> elseBlock;
+    std::vector<std::unique_ptr<ASTNode>> thenBlock, elseBlock;
+    if (!parseBlock(thenBlock)) return nullptr;
     if (check(tok_else)) {
         advance(); // consume 'else'
-        elseBlock = parseBlock();
+        if (!parseBlock(elseBlock)) return nullptr;
     }
     return std::make_unique<IfStmtAST>(
         std::move(cond),
@@ -202,76 +322,202 @@ std::unique_ptr<ASTNode> Parser::parseCycleStatement() {
         return nullptr;
     }
 
-    auto body = parseBlock();
+    std::vector<std::unique_ptr<ASTNode>> body;
+    if (!parseBlock(body)) return nullptr;
 
     return std::make_unique<CycleStmtAST>(
         std::move(cond),
         std::move(body));
 }
 
-std::unique_ptr<ASTNode> Parser::parsePrimary() {
-    if (check(tok_number)) {
-        double val = peek().numberValue;
-        advance();
-        return std::make_unique<NumberExprAST>(val);
-    }
-    if (check(tok_identifier))
-        return parseIdentifier();
-    if (match((Token)'(')) {
-        auto expr = parseExpression();
-        if (!match((Token)')')) {
-            std::cerr << "Expected ')'\n";
-            return nullptr;
-        }
-        return expr;
-    }
-    std::cerr << "Unknown token in expression: '"
-              << peek().txt << "' type=" << (int)peek().type << "\n";
-    return nullptr;
-}
+std::unique_ptr<ASTNode> Parser::parsePCycleStatement() {
+    advance(); // consume 'pcycle'
 
-std::unique_ptr<ASTNode> Parser::parseIdentifier() {
-    std::string name = peek().txt;
-    advance();
     if (!match((Token)'(')) {
-        return std::make_unique<VariableExprAST>(name);
+        std::cerr << "Expected '(' after 'pcycle'\n";
+        return nullptr;
     }
-    std::vector<std::unique_ptr<ASTNode>> args;
-    if (!check((Token)')')) {
-        do {
-            auto arg = parseExpression();
-            if (!arg) return nullptr;
-            args.push_back(std::move(arg));
-        } while (match((Token)','));
+    if (!match(tok_identifier)) {
+        std::cerr << "Expected loop variable in pcycle\n";
+        return nullptr;
+    }
+    std::string var = previous().txt;
+    if (!match((Token)',')) {
+        std::cerr << "Expected ',' after pcycle variable\n";
+        return nullptr;
+    }
+    auto start = parseExpression();
+    if (!start) return nullptr;
+    if (!match((Token)',')) {
+        std::cerr << "Expected ',' after pcycle start\n";
+        return nullptr;
     }
+    auto end = parseExpression();
+    if (!end) return nullptr;
     if (!match((Token)')')) {
-        std::cerr << "Expected ')'\n";
+        std::cerr << "Expected ')' after pcycle range\n";
         return nullptr;
     }
-    return std::make_unique<CallExprAST>(name, std::move(args));
+
+    // optional: reduce(+ sum, * prod, min lo, max hi)
+    // 'reduce', 'min' and 'max' are not keywords, only special here
+    std::vector<std::pair<char, std::string>> reductions;
+    if (check(tok_identifier) && peek().txt == "reduce") {
+        advance();
+        if (!match((Token)'(')) {
+            std::cerr << "Expected '(' after 'reduce'\n";
+            return nullptr;
+        }
+        do {
+            char op = 0;
+            if (match((Token)'+')) op = '+';
+            else if (match((Token)'*')) op = '*';
+            else if (check(tok_identifier) && peek().txt == "min") { advance(); op = '<'; }
+            else if (check(tok_identifier) && peek().txt == "max") { advance(); op = '>'; }
+            else {
+                std::cerr << "Expected reduction operator (+, *, min, max), got '"
+                          << peek().txt << "'\n";
+                return nullptr;
+            }
+            if (!match(tok_identifier)) {
+                std::cerr << "Expected reduction variable\n";
+                return nullptr;
+            }
+            if (previous().txt == var) {
+                std::cerr << "pcycle variable '" << var << "' cannot be reduced\n";
+                return nullptr;
+            }
+            reductions.emplace_back(op, previous().txt);
+        } while (match((Token)','));
+        if (!match((Token)')')) {
+            std::cerr << "Expected ')' after reductions\n";
+            return nullptr;
+        }
+    }
+
+    std::vector<std::unique_ptr<ASTNode>> body;
+    if (!parseBlock(body)) return nullptr;
+
+    return std::make_unique<PCycleStmtAST>(
+        var, std::move(start), std::move(end),
+        std::move(reductions), std::move(body));
 }
 
+// Expressions are parsed with explicit stacks instead of recursion: nested
+// parentheses and calls cost heap, not native stack, and a long chain of
+// operators is a loop. Shunting-yard style, an operator first folds every
+// pending operator of higher or equal precedence to its left (they are all
+// left associative), an operand always comes next.
 std::unique_ptr<ASTNode> Parser::parseExpression() {
-    auto LHS = parsePrimary();
-    if (!LHS) return nullptr;
-    return parseBinOpRHS(0, std::move(LHS));
-}
+    // an open '(' or call: operands / operators from its bases up are its own
+    struct Group {
+        bool call;
+        size_t operandBase, operatorBase;
+        std::string callee;
+        SourceLoc loc;
+        std::vector<std::unique_ptr<ASTNode>> args;
+    };
+    struct PendingOp {
+        char op;
+        int prec;
+        SourceLoc loc;
+    };
+    std::vector<std::unique_ptr<ASTNode>> operands;
+    std::vector<PendingOp> operators;
+    std::vector<Group> groups;
+
+    auto reduce = [&](int prec) {
+        size_t base = groups.empty() ? 0 : groups.back().operatorBase;
+        while (operators.size() > base && operators.back().prec >= prec) {
+            PendingOp o = operators.back();
+            operators.pop_back();
+            auto rhs = std::move(operands.back());
+            operands.pop_back();
+            auto lhs = std::move(operands.back());
+            operands.pop_back();
+            operands.push_back(at(o.loc, std::make_unique<BinaryExprAST>(
+                o.op, std::move(lhs), std::move(rhs))));
+        }
+    };
+    auto open = [&](bool call, const std::string& callee, SourceLoc loc) {
+        if (groups.size() >= MaxExprNesting) {
+            std::cerr << "Expression nested more than " << MaxExprNesting
+                      << " levels deep (line " << loc.Line << ")\n";
+            return false;
+        }
+        groups.push_back({call, operands.size(), operators.size(), callee, loc, {}});
+        return true;
+    };
 
-std::unique_ptr<ASTNode>
-Parser::parseBinOpRHS(int exprPrec, std::unique_ptr<ASTNode> LHS) {
     while (true) {
-        int tokPrec = getTokPrecedence();
-        if (tokPrec < exprPrec)
-            return LHS;
-        char binOp = peek().type;
-        advance();
-        auto RHS = parsePrimary();
-        if (!RHS) return nullptr;
-        int nextPrec = getTokPrecedence();
-        if (tokPrec < nextPrec) {
-            RHS = parseBinOpRHS(tokPrec + 1, std::move(RHS));
-            if (!RHS) return nullptr;
+        // operand
+        if (check(tok_number)) {
+            SourceLoc loc = here();
+            double val = peek().numberValue;
+            advance();
+            operands.push_back(at(loc, std::make_unique<NumberExprAST>(val)));
+        }
+        else if (check(tok_identifier)) {
+            SourceLoc loc = here();
+            std::string name = peek().txt;
+            advance();
+            if (!match((Token)'(')) {
+                operands.push_back(at(loc, std::make_unique<VariableExprAST>(name)));
+            }
+            else if (match((Token)')')) {
+                operands.push_back(at(loc, std::make_unique<CallExprAST>(
+                    name, std::vector<std::unique_ptr<ASTNode>>())));
+            }
+            else {
+                if (!open(true, name, loc)) return nullptr;
+                continue; // first argument
+            }
+        }
+        else if (check((Token)'(')) {
+            SourceLoc loc = here();
+            advance();
+            if (!open(false, "", loc)) return nullptr;
+            continue;
+        }
+        else {
+            std::cerr << "Unknown token in expression: '"
+                      << peek().txt << "' type=" << (int)peek().type << "\n";
+            return nullptr;
+        }
+
+        // after an operand: a binary operator, or the end of groups
+        while (true) {
+            int prec = getTokPrecedence();
+            if (prec > 0) {
+                reduce(prec);
+                operators.push_back({(char)peek().type, prec, here()});
+                advance();
+                break;
+            }
+            reduce(0);
+            if (groups.empty())
+                return std::move(operands.back());
+
+            Group& g = groups.back();
+            if (!g.call) {
+                if (!match((Token)')')) {
+                    std::cerr << "Expected ')'\n";
+                    return nullptr;
+                }
+                groups.pop_back(); // its value is an operand of the outer group
+                continue;
+            }
+            g.args.push_back(std::move(operands.back()));
+            operands.pop_back();
+            if (match((Token)','))
+                break;
+            if (!match((Token)')')) {
+                std::cerr << "Expected ')'\n";
+                return nullptr;
+            }
+            auto call = at(g.loc, std::make_unique<CallExprAST>(g.callee, std::move(g.args)));
+            groups.pop_back();
+            operands.push_back(std::move(call));
         }
-        LHS = std::make_unique<BinaryExprAST>(binOp, std::move(LHS), std::move(RHS));
     }
 }
@@ -1,12 +1,27 @@
 #pragma once
+#include <functional>
 #include <map>
 #include <memory>
+#include <utility>
 #include <vector>
 #include <string>
 #include "../lexer/lexer.h"
 
+// position in the source, Line 0 = unknown (e.g. loaded from a .pxa file)
+struct SourceLoc {
+    unsigned Line = 0;
+    unsigned Col = 0;
+};
+
+// how deep parentheses / call arguments may nest in one expression, and
+// blocks inside blocks (see Parser). Code walking the AST recursively relies
+// on these to bound its stack use; the one unbounded shape, the left spine
+// of a long a + b + c + ... chain, is always walked with a loop.
+constexpr unsigned DefaultMaxNesting = 256;
+
 class ASTNode {
 public:
+    SourceLoc Loc;
     virtual ~ASTNode() = default;
 };
 
@@ -30,6 +45,8 @@ public:
                   std::unique_ptr<ASTNode> lhs,
                   std::unique_ptr<ASTNode> rhs)
         : op(op), lhs(std::move(lhs)), rhs(std::move(rhs)) {}
+    // frees deep chains without recursing (see parser.cpp)
+    ~BinaryExprAST() override;
 };
 
 class CallExprAST : public ASTNode {
@@ -39,6 +56,7 @@ public:
     CallExprAST(const std::string &Callee,
                 std::vector<std::unique_ptr<ASTNode>> Args)
         : Callee(Callee), Args(std::move(Args)) {}
+    ~CallExprAST() override;
 };
 
 class PrototypeAST : public ASTNode {
@@ -63,9 +81,14 @@ public:
 class ProgramAST : public ASTNode {
 public:
     std::vector<std::unique_ptr<FunctionAST>> Functions;
+    // functions defined in another module, declared with 'extern'
+    std::vector<std::unique_ptr<PrototypeAST>> Externs;
     void addFunction(std::unique_ptr<FunctionAST> Fn) {
         Functions.push_back(std::move(Fn));
     }
+    void addExtern(std::unique_ptr<PrototypeAST> Proto) {
+        Externs.push_back(std::move(Proto));
+    }
 };
 
 class AssignExprAST : public ASTNode {
@@ -100,37 +123,87 @@ public:
           Body(std::move(Body)) {}
 };
 
+// parallel counted loop: Var takes Start, Start+1, ... while < End and the
+// iterations may run on any thread, in any order. Every variable of the
+// enclosing function is visible (by value); assignments stay inside the
+// iteration except to reduction variables, whose per-thread partial
+// results are combined into the outer variable after the loop.
+class PCycleStmtAST : public ASTNode {
+public:
+    std::string Var;
+    std::unique_ptr<ASTNode> Start, End;
+    // operator + variable, op is '+', '*', '<' (min) or '>' (max)
+    std::vector<std::pair<char, std::string>> Reductions;
+    std::vector<std::unique_ptr<ASTNode>> Body;
+    PCycleStmtAST(const std::string &Var,
+                  std::unique_ptr<ASTNode> Start,
+                  std::unique_ptr<ASTNode> End,
+                  std::vector<std::pair<char, std::string>> Reductions,
+                  std::vector<std::unique_ptr<ASTNode>> Body)
+        : Var(Var), Start(std::move(Start)), End(std::move(End)),
+          Reductions(std::move(Reductions)), Body(std::move(Body)) {}
+};
+
 
 class Parser {
+    // tokens[i] is token number Base + i. Parsing straight from a Lexer only
+    // keeps a window around the current token, so memory for tokens stays
+    // constant however big the source is.
     std::vector<TokenInfo> tokens;
     size_t current;
+    size_t Base = 0;
+    std::function<TokenInfo()> Source;
 
 public:
     Parser(const std::vector<TokenInfo>& toks);
+    Parser(std::vector<TokenInfo>&& toks);
+    explicit Parser(Lexer& lexer);
+    // pulls tokens from next (e.g. a lexer on another thread); it has to
+    // keep returning tok_eof once the input is exhausted
+    explicit Parser(std::function<TokenInfo()> next);
     std::unique_ptr<ProgramAST> parseProgram();
+    // hands out every definition as soon as it's parsed instead of
+    // collecting a ProgramAST. false on a syntax error (reported) or when a
+    // callback returns false.
+    bool parseDefinitions(const std::function<bool(std::unique_ptr<FunctionAST>)>& onFunction,
+                          const std::function<bool(std::unique_ptr<PrototypeAST>)>& onExtern);
+
+    // deeper input is rejected with an error instead of risking the stack
+    // of everything that walks the AST afterwards
+    unsigned MaxExprNesting = DefaultMaxNesting;
+    unsigned MaxBlockNesting = DefaultMaxNesting;
 
 private:
     std::map<char, int> BinOpPrecedence;
     int getTokPrecedence();
-    std::unique_ptr<ASTNode> parseBinOpRHS(int exprPrec,
-                                           std::unique_ptr<ASTNode> LHS);
+    unsigned BlockDepth = 0;
 
+    // token number i, lexed on demand; tok_eof past the end
+    TokenInfo& token(size_t i);
     TokenInfo& peek();
     TokenInfo& previous();
+    SourceLoc here();
+    // sets node's location, returns it (nullptr stays nullptr)
+    template <typename T>
+    std::unique_ptr<T> at(SourceLoc loc, std::unique_ptr<T> node) {
+        if (node) node->Loc = loc;
+        return node;
+    }
     bool isAtEnd();
     void advance();
     bool check(Token type);
     bool match(Token type);
 
     std::unique_ptr<FunctionAST> parseFunction();
+    std::unique_ptr<PrototypeAST> parseExtern();
     std::unique_ptr<PrototypeAST> parsePrototype();
-    std::vector<std::unique_ptr<ASTNode>> parseBlock();
+    // false (and reports) on a syntax error inside
+    bool parseBlock(std::vector<std::unique_ptr<ASTNode>>& statements);
 
     std::unique_ptr<ASTNode> parseStatement();
     std::unique_ptr<ASTNode> parseAssignment();
     std::unique_ptr<ASTNode> parseIfStatement();
     std::unique_ptr<ASTNode> parseCycleStatement();
+    std::unique_ptr<ASTNode> parsePCycleStatement();
     std::unique_ptr<ASTNode> parseExpression();
-    std::unique_ptr<ASTNode> parsePrimary();
-    std::unique_ptr<ASTNode> parseIdentifier();
 };
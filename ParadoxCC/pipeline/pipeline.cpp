@@ -0,0 +1,355 @@
+#include "pipeline.h"
+#include "queue.h"
+#include "../analysis/callgraph.h"
+#include "../codegen/codegen.h"
+#include "../lto/thinlto.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// tokens go from the lexer to the parser this many at a time, functions from
+// a worker to the emitter in modules of this many (every link has a fixed
+// cost on top of the module's size, smaller batches make the emitter the
+// bottleneck). Queues hold this many items each, so memory in flight is
+// bounded however big the source is.
+constexpr size_t TokenBatch = 4096;
+constexpr size_t FunctionBatch = 1024;
+constexpr size_t QueueDepth = 64;
+
+double msSince(Clock::time_point start){
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// time a stage spent blocked on its queues; busy time is the rest
+struct StageClock {
+    Clock::time_point Start = Clock::now();
+    double WaitedMs = 0;
+    double busyMs() const { return msSince(Start) - WaitedMs; }
+};
+
+// blocking push / pop. false once stop is set: some stage failed and
+// nobody is going to make room or send anything any more.
+template <typename T>
+bool put(BoundedQueue<T>& q, T value, const std::atomic<bool>& stop, StageClock& clock){
+    if(q.tryPush(value)) return true;
+    auto begin = Clock::now();
+    Backoff backoff;
+    bool ok = true;
+    while(!q.tryPush(value)){
+        if(stop.load(std::memory_order_relaxed)){
+            ok = false;
+            break;
+        }
+        backoff.wait();
+    }
+    clock.WaitedMs += msSince(begin);
+    return ok;
+}
+
+template <typename T>
+bool take(BoundedQueue<T>& q, T& out, const std::atomic<bool>& stop, StageClock& clock){
+    if(q.tryPop(out)) return true;
+    auto begin = Clock::now();
+    Backoff backoff;
+    bool ok = true;
+    while(!q.tryPop(out)){
+        if(stop.load(std::memory_order_relaxed)){
+            ok = false;
+            break;
+        }
+        backoff.wait();
+    }
+    clock.WaitedMs += msSince(begin);
+    return ok;
+}
+
+// one function for a codegen worker, nullptr Fn: no more work
+struct Work {
+    std::unique_ptr<FunctionAST> Fn;
+    // what it calls and how many arguments each takes, to declare them
+    std::map<std::string, size_t> Callees;
+};
+
+// a worker's module as bitcode (the emitter has its own LLVMContext, IR
+// can't be moved over directly). Done: that worker has finished.
+struct Batch {
+    std::string Bitcode;
+    bool Done = false;
+};
+
+} // namespace
+
+bool compilePipelined(std::string_view source, const PipelineOptions& opts,
+                      PipelineStats* stats){
+    auto begin = Clock::now();
+    unsigned workers = opts.Workers;
+    if(workers == 0){
+        // the lexer, the parser and the emitter have a thread each
+        unsigned cores = std::thread::hardware_concurrency();
+        workers = cores > 4 ? cores - 3 : 1;
+    }
+
+    // fails here rather than on every worker if the target is no good
+    CodeGen out(opts.ModuleName);
+    out.setFPOptions(opts.FP);
+    if(!out.setTarget(opts.Target))
+        return false;
+
+    BoundedQueue<std::vector<TokenInfo>> tokens(QueueDepth);
+    BoundedQueue<Work> work(QueueDepth);
+    BoundedQueue<Batch> batches(QueueDepth);
+    std::atomic<bool> stop{false};
+    std::atomic<bool> failed{false};
+    auto fail = [&]{
+        failed = true;
+        stop = true;
+    };
+
+    double lexMs = 0, parseMs = 0;
+    std::vector<double> codegenMs(workers, 0);
+
+    std::thread lexer([&]{
+        StageClock clock;
+        Lexer lex(source, 1, 1);
+        for(bool last = false; !last;){
+            std::vector<TokenInfo> batch;
+            batch.reserve(TokenBatch);
+            while(batch.size() < TokenBatch && !last){
+                batch.push_back(lex.next());
+                last = batch.back().type == tok_eof;
+            }
+            if(!put(tokens, std::move(batch), stop, clock)) break;
+        }
+        lexMs = clock.busyMs();
+    });
+
+    // filled by the parser thread, read once it's joined
+    std::vector<std::string> names;
+    std::vector<std::unique_ptr<PrototypeAST>> externs;
+    std::thread parser([&]{
+        StageClock clock;
+        std::vector<TokenInfo> batch;
+        size_t at = 0;
+        Parser parse([&]() -> TokenInfo {
+            while(at == batch.size()){
+                if(!batch.empty() && batch.back().type == tok_eof)
+                    return batch.back();
+                batch.clear();
+                at = 0;
+                if(!take(tokens, batch, stop, clock))
+                    return {tok_eof, "", 0};
+            }
+            return std::move(batch[at++]);
+        });
+        parse.MaxExprNesting = parse.MaxBlockNesting = opts.MaxNesting;
+
+        CallGraph graph;
+        graph.start();
+        bool callsOk = true;
+        // names defined or declared so far; a function calling anything
+        // else waits for the end, only an extern further down can make
+        // that call right
+        std::set<std::string> known;
+        std::vector<Work> held;
+        bool ok = parse.parseDefinitions(
+            [&](std::unique_ptr<FunctionAST> fn){
+                names.push_back(fn->Proto->getName());
+                known.insert(fn->Proto->getName());
+                Work w;
+                // a function with a bad call is reported but never
+                // generated, the compile fails at the end anyway
+                if(!graph.add(*fn, &w.Callees)){
+                    callsOk = false;
+                    return true;
+                }
+                w.Fn = std::move(fn);
+                for(auto& callee : w.Callees)
+                    if(!known.count(callee.first)){
+                        held.push_back(std::move(w));
+                        return true;
+                    }
+                return put(work, std::move(w), stop, clock);
+            },
+            [&](std::unique_ptr<PrototypeAST> proto){
+                graph.addExtern(*proto);
+                known.insert(proto->getName());
+                externs.push_back(std::move(proto));
+                return true;
+            });
+        if(ok && graph.finish() && callsOk){
+            for(auto& w : held)
+                if(!put(work, std::move(w), stop, clock)) break;
+            for(unsigned w = 0; w < workers; w++)
+                if(!put(work, Work(), stop, clock)) break;
+        }
+        else
+            fail();
+        parseMs = clock.busyMs();
+    });
+
+    std::vector<std::thread> codegen;
+    for(unsigned id = 0; id < workers; id++)
+        codegen.emplace_back([&, id]{
+            StageClock clock;
+            std::unique_ptr<CodeGen> cg;
+            size_t count = 0;
+            auto flush = [&]{
+                Batch b;
+                llvm::raw_string_ostream os(b.Bitcode);
+                llvm::WriteBitcodeToFile(*cg->TheModule, os);
+                os.flush();
+                cg.reset();
+                count = 0;
+                return put(batches, std::move(b), stop, clock);
+            };
+            for(;;){
+                Work w;
+                if(!take(work, w, stop, clock)) break;
+                if(!w.Fn){
+                    if(cg && !flush()) break;
+                    Batch done;
+                    done.Done = true;
+                    put(batches, std::move(done), stop, clock);
+                    break;
+                }
+                // a function held back by the parser may be declared here
+                // already, by a caller that went first. The declaration
+                // has made up parameter names, the body needs the real ones.
+                if(cg && cg->TheModule->getFunction(w.Fn->Proto->getName()) && !flush())
+                    break;
+                if(!cg){
+                    cg = std::make_unique<CodeGen>(opts.ModuleName);
+                    cg->setFPOptions(opts.FP);
+                    cg->setTarget(opts.Target);
+                }
+                // whatever isn't in this module is declared, the emitter's
+                // link resolves it
+                for(auto& [callee, arity] : w.Callees){
+                    if(cg->TheModule->getFunction(callee)) continue;
+                    PrototypeAST proto(callee, std::vector<std::string>(arity, "arg"));
+                    cg->codegenPrototype(&proto);
+                }
+                // like the serial driver: a function that fails has
+                // reported why and fails the compile
+                if(!cg->codegenFunction(w.Fn.get())){
+                    fail();
+                    break;
+                }
+                w.Fn.reset();
+                if(++count == FunctionBatch && !flush()) break;
+            }
+            codegenMs[id] = clock.busyMs();
+        });
+
+    // emitter: links every batch into out as it arrives. One Linker for all
+    // of them, a new one would index the whole (growing) module every time.
+    StageClock clock;
+    llvm::Linker linker(*out.TheModule);
+    size_t linked = 0;
+    for(unsigned done = 0; done < workers;){
+        Batch b;
+        if(!take(batches, b, stop, clock)) break;
+        if(b.Done){
+            done++;
+            continue;
+        }
+        auto m = llvm::parseBitcodeFile(llvm::MemoryBufferRef(b.Bitcode, opts.ModuleName),
+                                        *out.TheContext);
+        if(!m){
+            std::cerr << "pipeline: " << llvm::toString(m.takeError()) << "\n";
+            fail();
+            break;
+        }
+        if(linker.linkInModule(std::move(*m))){
+            std::cerr << "pipeline: linking generated code failed\n";
+            fail();
+            break;
+        }
+        linked++;
+    }
+    lexer.join();
+    parser.join();
+    for(auto& t : codegen)
+        t.join();
+    if(failed)
+        return false;
+
+    // close to the order the serial driver writes things in: externs, then
+    // every definition in source order followed by what codegen added for
+    // it (<name>.f32 bodies, <name>.pcycle.N), then runtime declarations
+    llvm::Module& M = *out.TheModule;
+    for(auto& ext : externs)
+        if(!M.getFunction(ext->getName()))
+            out.codegenPrototype(ext.get());
+    std::map<std::string, std::vector<llvm::Function*>> helpers;
+    for(llvm::Function& fn : M)
+        if(fn.hasInternalLinkage()){
+            llvm::StringRef name = fn.getName();
+            helpers[name.substr(0, name.find('.')).str()].push_back(&fn);
+        }
+    std::vector<llvm::Function*> order;
+    std::set<llvm::Function*> placed;
+    auto place = [&](const std::string& name){
+        if(llvm::Function* fn = M.getFunction(name))
+            if(placed.insert(fn).second) order.push_back(fn);
+        auto it = helpers.find(name);
+        if(it != helpers.end())
+            for(llvm::Function* fn : it->second)
+                if(placed.insert(fn).second) order.push_back(fn);
+    };
+    for(auto& ext : externs)
+        place(ext->getName());
+    for(auto& name : names)
+        place(name);
+    for(llvm::Function& fn : M)
+        if(!placed.count(&fn)) order.push_back(&fn);
+    for(llvm::Function* fn : order)
+        M.getFunctionList().splice(M.end(), M.getFunctionList(), fn->getIterator());
+
+    // before either output, as the serial driver does
+    if(llvm::verifyModule(M, &llvm::errs())){
+        std::cerr << "pipeline: generated invalid IR\n";
+        return false;
+    }
+
+    bool ok;
+    if(opts.Bitcode)
+        ok = emitThinLTOBitcode(M, opts.Output);
+    else{
+        std::error_code EC;
+        llvm::raw_fd_ostream file(opts.Output, EC);
+        ok = !EC;
+        if(ok)
+            M.print(file, nullptr);
+        else
+            std::cerr << "Could not open " << opts.Output << "\n";
+    }
+
+    if(stats){
+        stats->LexMs = lexMs;
+        stats->ParseMs = parseMs;
+        stats->CodegenMs = 0;
+        for(double ms : codegenMs)
+            stats->CodegenMs += ms;
+        stats->EmitMs = clock.busyMs();
+        stats->WallMs = msSince(begin);
+        stats->Functions = names.size();
+        stats->Batches = linked;
+        stats->Workers = workers;
+    }
+    return ok;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include "../parser/parser.h"
+#include "../target/target.h"
+
+// Compiling one source as a pipeline of concurrent stages instead of one
+// phase after the other:
+//
+//   lexer thread   --token batches-->  parser thread
+//   parser thread  --each def as soon as it closes-->  codegen workers
+//   codegen workers --bitcode, a batch of functions each-->  emitter
+//
+// connected by bounded lock-free queues (queue.h). The emitter (the calling
+// thread) links the batches into one module while the stages before it are
+// still running, and writes it once the last one is in. On a big file the
+// time taken approaches that of the slowest stage rather than the sum.
+//
+// Only what can be done one definition at a time is: calls are checked
+// the way CallGraph does it, but there is no constant folding, --entry or
+// --memoize (they need the whole program first), and no debug info.
+
+struct PipelineOptions {
+    unsigned Workers = 0;  // codegen threads, 0 = cores left after the other stages
+    unsigned MaxNesting = DefaultMaxNesting;
+    FPOptions FP;
+    TargetSpec Target;
+    std::string ModuleName;
+    std::string Output;    // IR text, or bitcode with a ThinLTO summary if Bitcode
+    bool Bitcode = false;
+};
+
+// where the time went: busy time of every stage, waiting on its queues not
+// counted. Codegen is summed over the workers.
+struct PipelineStats {
+    double LexMs = 0, ParseMs = 0, CodegenMs = 0, EmitMs = 0, WallMs = 0;
+    size_t Functions = 0;
+    size_t Batches = 0;   // modules handed from the workers to the emitter
+    unsigned Workers = 0;
+};
+
+// false (errors go to stderr) if any stage fails; nothing is written then
+bool compilePipelined(std::string_view source, const PipelineOptions& opts,
+                      PipelineStats* stats = nullptr);
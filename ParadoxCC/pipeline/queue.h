@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <utility>
+
+// Bounded multi-producer / multi-consumer queue without locks (Vyukov's
+// ring buffer): every slot carries a sequence number telling whether it's
+// free for the push of this lap or full for the pop of this lap, and
+// producers / consumers claim positions with a CAS on their own counter.
+// Neither side ever waits for the other while holding anything, so a
+// stalled stage can't block the rest of the pipeline beyond a full or
+// empty queue.
+template <typename T>
+class BoundedQueue {
+    struct Slot {
+        std::atomic<size_t> Seq;
+        T Value;
+    };
+    std::unique_ptr<Slot[]> Slots;
+    size_t Mask;
+    // on their own cache lines, producers and consumers don't share one
+    alignas(64) std::atomic<size_t> Head{0};  // next push
+    alignas(64) std::atomic<size_t> Tail{0};  // next pop
+
+public:
+    // capacity is rounded up to a power of two
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        Slots.reset(new Slot[size]);
+        Mask = size - 1;
+        for (size_t i = 0; i < size; i++)
+            Slots[i].Seq.store(i, std::memory_order_relaxed);
+    }
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // moves value in, false (value untouched) if the queue is full
+    bool tryPush(T& value) {
+        size_t pos = Head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = Slots[pos & Mask];
+            size_t seq = slot.Seq.load(std::memory_order_acquire);
+            auto diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+            if (diff == 0) {
+                if (Head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.Value = std::move(value);
+                    slot.Seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = Head.load(std::memory_order_relaxed);
+        }
+    }
+
+    // moves the oldest value out, false if the queue is empty
+    bool tryPop(T& out) {
+        size_t pos = Tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = Slots[pos & Mask];
+            size_t seq = slot.Seq.load(std::memory_order_acquire);
+            auto diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)(pos + 1);
+            if (diff == 0) {
+                if (Tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = std::move(slot.Value);
+                    slot.Value = T();
+                    slot.Seq.store(pos + Mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = Tail.load(std::memory_order_relaxed);
+        }
+    }
+};
+
+// waiting on a full / empty queue: spin a little (the other side is
+// usually about to get there), then give the core away, then sleep, so an
+// idle stage doesn't take CPU from the busy ones
+class Backoff {
+    unsigned Tries = 0;
+
+public:
+    void wait() {
+        if (Tries < 64)
+            ;
+        else if (Tries < 128)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        Tries++;
+    }
+};
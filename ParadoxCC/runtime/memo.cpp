@@ -0,0 +1,210 @@
+#include "runtime.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Bounded open addressing table keyed on the argument bit patterns.
+// A slot is arity + 3 words, [seq][tag][arg bits...][result], all slots in
+// one flat array, so a probe reads one or two cache lines. Probing is
+// linear inside a small window; when the window is full the home slot is
+// overwritten, so memory stays at the initial capacity.
+//
+// No lock on the way: every slot is a seqlock. seq is odd while a store
+// writes the slot; a lookup that sees it odd, or changed by the time it
+// has read the slot, takes it as a miss, and a store that finds the slot
+// being written by another thread drops its result. Either way the
+// function is just run again next time, so pcycle workers calling the same
+// memoized function never wait on each other.
+constexpr unsigned ProbeWindow = 8;
+constexpr size_t DefaultEntries = size_t(1) << 16;
+// 2^26 entries of a one argument function are 2 GB already
+constexpr size_t MaxEntries = size_t(1) << 26;
+
+using Word = std::atomic<uint64_t>;
+
+struct MemoTable {
+    std::string name;
+    uint32_t arity;
+    size_t stride;
+    size_t mask;
+    std::unique_ptr<Word[]> slots;
+    std::atomic<uint64_t> hits{0}, misses{0}, evictions{0};
+};
+
+// PARADOX_MEMO_ENTRIES overrides the per function capacity, up to
+// MaxEntries; anything that isn't a number gets the default
+size_t memoCapacity(){
+    size_t want = DefaultEntries;
+    if(const char* env = std::getenv("PARADOX_MEMO_ENTRIES")){
+        char* end;
+        errno = 0;
+        unsigned long long v = std::strtoull(env, &end, 10);
+        if(end != env && *end == 0 && errno == 0 && v > 0)
+            want = v < MaxEntries ? (size_t)v : MaxEntries;
+    }
+    size_t cap = ProbeWindow;
+    while(cap < want) cap <<= 1;
+    return cap;
+}
+
+uint64_t hashArgs(const double* args, uint32_t arity){
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ arity;
+    for(uint32_t i = 0; i < arity; i++){
+        uint64_t bits;
+        std::memcpy(&bits, &args[i], sizeof(bits));
+        h ^= bits + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    }
+    // splitmix64 finalizer
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+// reads slot s into its tag and result if no store got in the way and the
+// key is args; false otherwise
+bool readSlot(const MemoTable& t, const Word* s, const double* args,
+              uint64_t& tag, double& result){
+    uint64_t seq = s[0].load(std::memory_order_acquire);
+    if(seq & 1) return false;
+    tag = s[1].load(std::memory_order_relaxed);
+    bool same = true;
+    for(uint32_t i = 0; i < t.arity; i++){
+        uint64_t bits;
+        std::memcpy(&bits, &args[i], sizeof(bits));
+        same = same && s[2 + i].load(std::memory_order_relaxed) == bits;
+    }
+    uint64_t bits = s[2 + t.arity].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(s[0].load(std::memory_order_relaxed) != seq) return false;
+    std::memcpy(&result, &bits, sizeof(result));
+    return same;
+}
+
+} // namespace
+
+// owns its tables, they go away with it
+struct paradox_memo_set {
+    std::mutex lock;
+    std::vector<std::unique_ptr<MemoTable>> tables;
+};
+
+extern "C" {
+
+paradox_memo_set paradox_memo_tables;
+
+paradox_memo_set* paradox_memo_create(void){
+    return new paradox_memo_set();
+}
+
+void paradox_memo_destroy(paradox_memo_set* tables){
+    delete tables;
+}
+
+void* paradox_memo_get(paradox_memo_set* tables, void** slot, const char* name, uint32_t arity){
+    std::lock_guard<std::mutex> guard(tables->lock);
+    auto* published = reinterpret_cast<std::atomic<void*>*>(slot);
+    if(void* t = published->load(std::memory_order_acquire))
+        return t;
+
+    auto owned = std::make_unique<MemoTable>();
+    MemoTable* table = owned.get();
+    table->name = name;
+    table->arity = arity;
+    table->stride = arity + 3;
+    // no exceptions here (the library is built without them, and generated
+    // code couldn't take one): with too little memory for the capacity
+    // asked for, the table gets smaller
+    for(size_t cap = memoCapacity(); !table->slots && cap >= ProbeWindow; cap /= 2){
+        table->slots.reset(new (std::nothrow) Word[cap * table->stride]());
+        table->mask = cap - 1;
+    }
+    if(!table->slots){
+        std::fprintf(stderr, "memo: out of memory for the table of %s\n", name);
+        std::abort();
+    }
+
+    tables->tables.push_back(std::move(owned));
+    published->store(table, std::memory_order_release);
+    return table;
+}
+
+int paradox_memo_lookup(void* t, const double* args, double* result){
+    auto* table = static_cast<MemoTable*>(t);
+    uint64_t h = hashArgs(args, table->arity);
+    uint64_t tag = h | 1;
+    for(unsigned k = 0; k < ProbeWindow; k++){
+        const Word* s = &table->slots[((h + k) & table->mask) * table->stride];
+        uint64_t seen;
+        double value;
+        bool same = readSlot(*table, s, args, seen, value);
+        if(same && seen == tag){
+            *result = value;
+            table->hits.fetch_add(1, std::memory_order_relaxed);
+            return 1;
+        }
+        // an empty slot ends the chain; one being written is skipped
+        if(s[1].load(std::memory_order_relaxed) == 0) break;
+    }
+    table->misses.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+
+void paradox_memo_store(void* t, const double* args, double result){
+    auto* table = static_cast<MemoTable*>(t);
+    uint64_t h = hashArgs(args, table->arity);
+    uint64_t tag = h | 1;
+    Word* target = nullptr;
+    for(unsigned k = 0; k < ProbeWindow; k++){
+        Word* s = &table->slots[((h + k) & table->mask) * table->stride];
+        uint64_t seen;
+        double value;
+        if(s[1].load(std::memory_order_relaxed) == 0
+           || (readSlot(*table, s, args, seen, value) && seen == tag)){
+            target = s;
+            break;
+        }
+    }
+    if(!target){
+        target = &table->slots[(h & table->mask) * table->stride];
+        table->evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // another thread writing this slot wins, ours is dropped
+    uint64_t seq = target[0].load(std::memory_order_relaxed);
+    if((seq & 1) || !target[0].compare_exchange_strong(seq, seq + 1, std::memory_order_relaxed))
+        return;
+    std::atomic_thread_fence(std::memory_order_release);
+    target[1].store(tag, std::memory_order_relaxed);
+    for(uint32_t i = 0; i < table->arity; i++){
+        uint64_t bits;
+        std::memcpy(&bits, &args[i], sizeof(bits));
+        target[2 + i].store(bits, std::memory_order_relaxed);
+    }
+    uint64_t bits;
+    std::memcpy(&bits, &result, sizeof(bits));
+    target[2 + table->arity].store(bits, std::memory_order_relaxed);
+    target[0].store(seq + 2, std::memory_order_release);
+}
+
+void paradox_memo_report(paradox_memo_set* tables, FILE* out){
+    std::lock_guard<std::mutex> guard(tables->lock);
+    for(auto& t : tables->tables){
+        uint64_t hits = t->hits.load(std::memory_order_relaxed);
+        uint64_t calls = hits + t->misses.load(std::memory_order_relaxed);
+        std::fprintf(out, "memo: %-16s calls %10llu  hits %10llu  hit rate %5.1f%%  evictions %llu\n",
+                     t->name.c_str(), (unsigned long long)calls,
+                     (unsigned long long)hits,
+                     calls ? 100.0 * hits / calls : 0.0,
+                     (unsigned long long)t->evictions.load(std::memory_order_relaxed));
+    }
+}
+
+}
@@ -0,0 +1,217 @@
+#include "runtime.h"
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// A loop of count iterations is cut into chunks that depend on count only,
+// and every chunk folds into its own partial result. Partials are combined
+// in chunk order afterwards, so a reduction gives the same bits no matter
+// how many threads ran it, or whether it ran serially.
+constexpr int64_t MinGrain = 64;     // iterations per chunk, at least
+constexpr int64_t MaxChunks = 1024;
+
+double identity(char op){
+    switch(op){
+        case '*': return 1.0;
+        case '<': return HUGE_VAL;
+        case '>': return -HUGE_VAL;
+        default:  return 0.0;
+    }
+}
+
+double combine(char op, double a, double b){
+    switch(op){
+        case '*': return a * b;
+        case '<': return std::fmin(a, b);
+        case '>': return std::fmax(a, b);
+        default:  return a + b;
+    }
+}
+
+// chunk indices [lo, hi) owned by one participant. The owner takes from
+// the front, thieves take the back half.
+struct Range {
+    std::mutex lock;
+    int64_t lo = 0, hi = 0;
+};
+
+struct Job {
+    paradox_pfor_body body;
+    const double* env;
+    int64_t count;
+    int64_t chunks;
+    uint32_t nred;
+    const char* ops;
+    std::vector<double> partials;       // chunks * nred
+    std::unique_ptr<Range[]> ranges;    // one per participant, 0 = caller
+    unsigned participants;
+    unsigned nextId = 1;                // guarded by Pool::lock
+    unsigned active = 0;                // workers inside participate()
+};
+
+void runChunk(Job& job, int64_t c){
+    int64_t lo = c * job.count / job.chunks;
+    int64_t hi = (c + 1) * job.count / job.chunks;
+    double* red = &job.partials[c * job.nred];
+    for(uint32_t k = 0; k < job.nred; k++)
+        red[k] = identity(job.ops[k]);
+    job.body(job.env, lo, hi, red);
+}
+
+bool takeOwn(Job& job, unsigned self, int64_t& chunk){
+    Range& r = job.ranges[self];
+    std::lock_guard<std::mutex> guard(r.lock);
+    if(r.lo >= r.hi) return false;
+    chunk = r.lo++;
+    return true;
+}
+
+// moves the back half of some other participant's range into ours
+bool steal(Job& job, unsigned self, int64_t& chunk){
+    for(unsigned k = 1; k < job.participants; k++){
+        Range& victim = job.ranges[(self + k) % job.participants];
+        int64_t lo, hi;
+        {
+            std::lock_guard<std::mutex> guard(victim.lock);
+            int64_t left = victim.hi - victim.lo;
+            if(left <= 0) continue;
+            hi = victim.hi;
+            lo = victim.hi - (left + 1) / 2;
+            victim.hi = lo;
+        }
+        Range& own = job.ranges[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        own.lo = lo + 1;
+        own.hi = hi;
+        chunk = lo;
+        return true;
+    }
+    return false;
+}
+
+void participate(Job& job, unsigned self){
+    int64_t chunk;
+    while(takeOwn(job, self, chunk) || steal(job, self, chunk))
+        runChunk(job, chunk);
+}
+
+// set on pool threads and on a caller while it runs a loop: a pcycle
+// nested in another one just runs serially on the current thread
+thread_local bool insideLoop = false;
+
+class Pool {
+public:
+    // PARADOX_THREADS overrides the thread count (1 = always serial)
+    Pool(){
+        unsigned n = std::thread::hardware_concurrency();
+        if(const char* env = std::getenv("PARADOX_THREADS"))
+            n = std::strtoul(env, nullptr, 10);
+        Size = std::max(1u, n);
+        // workers are never joined: they sleep between loops and go away
+        // with the process
+        for(unsigned i = 1; i < Size; i++)
+            std::thread([this]{ work(); }).detach();
+    }
+
+    unsigned size() const { return Size; }
+
+    // one loop at a time; false if another thread is using the pool
+    bool tryRun(Job& job){
+        std::unique_lock<std::mutex> busy(Submit, std::try_to_lock);
+        if(!busy.owns_lock()) return false;
+        {
+            std::lock_guard<std::mutex> guard(Lock);
+            Current = &job;
+            Generation++;
+        }
+        Wake.notify_all();
+
+        insideLoop = true;
+        participate(job, 0);
+        insideLoop = false;
+
+        std::unique_lock<std::mutex> guard(Lock);
+        Current = nullptr;
+        Idle.wait(guard, [&]{ return job.active == 0; });
+        return true;
+    }
+
+private:
+    void work(){
+        insideLoop = true;
+        uint64_t seen = 0;
+        for(;;){
+            Job* job;
+            unsigned id;
+            {
+                std::unique_lock<std::mutex> guard(Lock);
+                Wake.wait(guard, [&]{ return Current && Generation != seen; });
+                seen = Generation;
+                job = Current;
+                id = job->nextId++;
+                job->active++;
+            }
+            participate(*job, id);
+            std::lock_guard<std::mutex> guard(Lock);
+            if(--job->active == 0) Idle.notify_all();
+        }
+    }
+
+    unsigned Size;
+    std::mutex Submit;
+    std::mutex Lock;
+    std::condition_variable Wake, Idle;
+    Job* Current = nullptr;
+    uint64_t Generation = 0;
+};
+
+Pool& pool(){
+    // never destroyed, detached workers may still be waiting on it at exit
+    static Pool* p = new Pool();
+    return *p;
+}
+
+} // namespace
+
+extern "C" {
+
+void paradox_pfor(paradox_pfor_body body, const double* env, int64_t count,
+                  uint32_t nred, const char* ops, double* red){
+    if(count <= 0) return;
+
+    Job job;
+    job.body = body;
+    job.env = env;
+    job.count = count;
+    job.chunks = std::clamp<int64_t>(count / MinGrain, 1, MaxChunks);
+    job.nred = nred;
+    job.ops = ops;
+    job.partials.resize(job.chunks * nred);
+
+    bool parallel = false;
+    if(job.chunks > 1 && !insideLoop && pool().size() > 1){
+        job.participants = pool().size();
+        job.ranges.reset(new Range[job.participants]);
+        for(unsigned p = 0; p < job.participants; p++){
+            job.ranges[p].lo = p * job.chunks / job.participants;
+            job.ranges[p].hi = (p + 1) * job.chunks / job.participants;
+        }
+        parallel = pool().tryRun(job);
+    }
+    if(!parallel)
+        for(int64_t c = 0; c < job.chunks; c++)
+            runChunk(job, c);
+
+    for(int64_t c = 0; c < job.chunks; c++)
+        for(uint32_t k = 0; k < nred; k++)
+            red[k] = combine(ops[k], red[k], job.partials[c * nred + k]);
+}
+
+}
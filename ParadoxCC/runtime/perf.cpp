@@ -0,0 +1,240 @@
+#include "perf.h"
+#include "runtime.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct EventSpec {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+};
+
+#ifdef __linux__
+// hardware first: the first event that opens leads the group, and software
+// events can join a hardware group but not the other way round
+const EventSpec Events[PerfEventCount] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"branchMisses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"cacheMisses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"taskClockNs", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {"pageFaults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+int openEvent(const EventSpec& spec, int group){
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = spec.type;
+    attr.config = spec.config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // this thread, any CPU
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+std::string explain(int err){
+    switch(err){
+        case EACCES:
+        case EPERM:
+            return "not permitted, see /proc/sys/kernel/perf_event_paranoid";
+        case ENOENT:
+        case EOPNOTSUPP:
+            return "no such event on this machine (a VM without a virtual PMU?)";
+        case ENOSYS:
+            return "perf_event_open is not supported by this kernel";
+        default:
+            return std::strerror(err);
+    }
+}
+#else
+const EventSpec Events[PerfEventCount] = {
+    {"cycles", 0, 0}, {"instructions", 0, 0}, {"branchMisses", 0, 0},
+    {"cacheMisses", 0, 0}, {"taskClockNs", 0, 0}, {"pageFaults", 0, 0},
+};
+#endif
+
+double nowMs(){
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// --perf-calls bookkeeping of one thread: how deep in counted calls it is,
+// and the counters at the start of the outermost one. The counters are
+// opened on the first call and closed when the thread exits.
+struct ThreadState {
+    unsigned Depth = 0;
+    std::unique_ptr<PerfCounters> Counters;
+    PerfSample Start;
+};
+
+thread_local ThreadState current;
+
+struct CallRecord {
+    PerfCallStats Stats;
+    std::mutex Lock;
+};
+
+std::mutex registryLock;
+std::vector<CallRecord*> registry;
+
+void reportAtExit(){
+    paradox_perf_report(stderr);
+}
+
+CallRecord* getRecord(void** slot, const char* name){
+    auto* published = reinterpret_cast<std::atomic<void*>*>(slot);
+    if(void* r = published->load(std::memory_order_acquire))
+        return static_cast<CallRecord*>(r);
+    std::lock_guard<std::mutex> guard(registryLock);
+    if(void* r = published->load(std::memory_order_acquire))
+        return static_cast<CallRecord*>(r);
+    auto* record = new CallRecord();
+    record->Stats.Name = name;
+    if(registry.empty())
+        std::atexit(reportAtExit);
+    registry.push_back(record);
+    published->store(record, std::memory_order_release);
+    return record;
+}
+
+} // namespace
+
+const char* perfEventName(PerfEvent e){
+    return Events[e].name;
+}
+
+PerfSample& PerfSample::operator+=(const PerfSample& other){
+    for(unsigned e = 0; e < PerfEventCount; e++)
+        Value[e] += other.Value[e];
+    WallMs += other.WallMs;
+    return *this;
+}
+
+PerfSample operator-(const PerfSample& end, const PerfSample& start){
+    PerfSample d;
+    for(unsigned e = 0; e < PerfEventCount; e++)
+        d.Value[e] = end.Value[e] > start.Value[e] ? end.Value[e] - start.Value[e] : 0;
+    d.WallMs = end.WallMs - start.WallMs;
+    return d;
+}
+
+PerfCounters::PerfCounters(){
+    for(unsigned e = 0; e < PerfEventCount; e++)
+        Fd[e] = -1;
+#ifdef __linux__
+    std::string hwError, swError;
+    for(unsigned e = 0; e < PerfEventCount; e++){
+        int fd = openEvent(Events[e], Leader);
+        if(fd < 0){
+            std::string& err = Events[e].type == PERF_TYPE_HARDWARE ? hwError : swError;
+            if(err.empty())
+                err = explain(errno);
+            continue;
+        }
+        if(Leader < 0) Leader = fd;
+        Fd[e] = fd;
+        Slot[e] = Open++;
+    }
+    if(!hwError.empty())
+        Error = "hardware counters: " + hwError;
+    if(!swError.empty())
+        Error += (Error.empty() ? "" : "; ") + std::string("software counters: ") + swError;
+#else
+    Error = "performance counters need Linux perf_event_open";
+#endif
+}
+
+PerfCounters::~PerfCounters(){
+#ifdef __linux__
+    // members before the leader
+    for(unsigned e = 0; e < PerfEventCount; e++)
+        if(Fd[e] >= 0 && Fd[e] != Leader) close(Fd[e]);
+    if(Leader >= 0) close(Leader);
+#endif
+}
+
+PerfSample PerfCounters::read() const {
+    PerfSample s;
+    s.WallMs = nowMs();
+#ifdef __linux__
+    if(Leader < 0) return s;
+    // nr, time enabled, time running, then one value per event
+    uint64_t buf[3 + PerfEventCount];
+    ssize_t got = ::read(Leader, buf, sizeof(buf));
+    if(got < (ssize_t)(3 * sizeof(uint64_t)) || buf[0] != Open)
+        return s;
+    uint64_t enabled = buf[1], running = buf[2];
+    for(unsigned e = 0; e < PerfEventCount; e++){
+        if(Fd[e] < 0) continue;
+        uint64_t v = buf[3 + Slot[e]];
+        if(running && running < enabled)
+            v = (uint64_t)((double)v * enabled / running);
+        s.Value[e] = v;
+    }
+#endif
+    return s;
+}
+
+std::vector<PerfCallStats> collectPerfCalls(){
+    std::lock_guard<std::mutex> guard(registryLock);
+    std::vector<PerfCallStats> out;
+    for(CallRecord* r : registry){
+        std::lock_guard<std::mutex> recordGuard(r->Lock);
+        if(!r->Stats.Calls) continue;
+        out.push_back(r->Stats);
+        r->Stats.Calls = 0;
+        r->Stats.Total = PerfSample();
+    }
+    return out;
+}
+
+extern "C" {
+
+void paradox_perf_enter(void){
+    if(current.Depth++) return;
+    if(!current.Counters)
+        current.Counters = std::make_unique<PerfCounters>();
+    current.Start = current.Counters->read();
+}
+
+void paradox_perf_exit(void** slot, const char* name){
+    if(--current.Depth) return;
+    PerfSample delta = current.Counters->read() - current.Start;
+    CallRecord* record = getRecord(slot, name);
+    std::lock_guard<std::mutex> guard(record->Lock);
+    record->Stats.Calls++;
+    record->Stats.Total += delta;
+}
+
+void paradox_perf_report(FILE* out){
+    std::lock_guard<std::mutex> guard(registryLock);
+    for(CallRecord* r : registry){
+        std::lock_guard<std::mutex> recordGuard(r->Lock);
+        const PerfCallStats& s = r->Stats;
+        if(!s.Calls) continue;
+        std::fprintf(out, "perf: %-16s calls %10llu  wall %10.3f ms",
+                     s.Name.c_str(), (unsigned long long)s.Calls, s.Total.WallMs);
+        for(unsigned e = 0; e < PerfEventCount; e++)
+            if(s.Total.Value[e])
+                std::fprintf(out, "  %s %llu", perfEventName((PerfEvent)e),
+                             (unsigned long long)s.Total.Value[e]);
+        std::fprintf(out, "\n");
+    }
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Performance counters
+// Hardware counters (cycles, instructions, branch and cache misses) plus a
+// few software ones of the calling thread, read through Linux
+// perf_event_open. Whatever can be opened is counted and the rest is left
+// out: in a VM without a virtual PMU, with kernel.perf_event_paranoid too
+// high or off Linux there may be no hardware events, or none at all.
+// error() says why. Kernel time is never counted (paranoid <= 2 allows
+// that without privileges).
+
+enum PerfEvent {
+    PerfCycles,
+    PerfInstructions,
+    PerfBranchMisses,
+    PerfCacheMisses,
+    PerfTaskClock,   // ns on the CPU
+    PerfPageFaults,
+    PerfEventCount
+};
+
+// the name used in reports, e.g. "branchMisses"
+const char* perfEventName(PerfEvent e);
+
+// counter values at some point, or (after operator-) over an interval.
+// Events that aren't available stay 0.
+struct PerfSample {
+    uint64_t Value[PerfEventCount] = {};
+    double WallMs = 0;
+
+    PerfSample& operator+=(const PerfSample& other);
+};
+
+PerfSample operator-(const PerfSample& end, const PerfSample& start);
+
+class PerfCounters {
+public:
+    // opens every event it can for the calling thread, counting from now
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool has(PerfEvent e) const { return Fd[e] >= 0; }
+    // at least one event could be opened
+    bool any() const { return Leader >= 0; }
+    // why some (or all) events are missing, empty if none are
+    const std::string& error() const { return Error; }
+
+    // totals since the constructor, one read() for the whole group. When
+    // the kernel had to multiplex the hardware counters the values are
+    // scaled up to the whole time. Only meaningful on the thread that made
+    // this object.
+    PerfSample read() const;
+
+private:
+    int Leader = -1;
+    int Fd[PerfEventCount];
+    // position of each open event in the group's read() buffer
+    unsigned Slot[PerfEventCount];
+    unsigned Open = 0;
+    std::string Error;
+};
+
+// --perf-calls: totals of the measured calls into one generated function
+// (see paradox_perf_enter / paradox_perf_exit in runtime.h)
+struct PerfCallStats {
+    std::string Name;
+    uint64_t Calls = 0;
+    PerfSample Total;
+};
+
+// every function's totals so far, in order of first call. The totals are
+// reset, so the report printed at exit only has what came after.
+std::vector<PerfCallStats> collectPerfCalls();
@@ -0,0 +1,18 @@
+#include "runtime.h"
+
+const RuntimeSymbol* runtimeSymbols(){
+    static const RuntimeSymbol symbols[] = {
+        {"paradox_memo_get", (void*)&paradox_memo_get},
+        {"paradox_memo_lookup", (void*)&paradox_memo_lookup},
+        {"paradox_memo_store", (void*)&paradox_memo_store},
+        {"paradox_memo_report", (void*)&paradox_memo_report},
+        {"paradox_memo_create", (void*)&paradox_memo_create},
+        {"paradox_memo_destroy", (void*)&paradox_memo_destroy},
+        {"paradox_perf_enter", (void*)&paradox_perf_enter},
+        {"paradox_perf_exit", (void*)&paradox_perf_exit},
+        {"paradox_perf_report", (void*)&paradox_perf_report},
+        {"paradox_pfor", (void*)&paradox_pfor},
+        {nullptr, nullptr},
+    };
+    return symbols;
+}
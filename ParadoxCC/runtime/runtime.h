@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+
+// Paradox runtime
+// Support functions that generated code calls into. They are part of
+// libparadox (the JIT resolves them from runtimeSymbols()) and are also
+// built as libparadoxrt.a for linking AOT output.
+
+extern "C" {
+
+// memoization (see --memoize). Tables belong to a set and are freed with
+// it. Generated code puts them in the one named paradox_memo_tables: in an
+// AOT program that is the runtime's own, which lives as long as the
+// process; every ParadoxJIT binds the name to a set of its own instead
+// (see ParadoxJIT::memoTables), so a JIT or Session frees what its code
+// made.
+struct paradox_memo_set;
+extern paradox_memo_set paradox_memo_tables;
+paradox_memo_set* paradox_memo_create(void);
+void paradox_memo_destroy(paradox_memo_set* tables);
+// *slot is the per-function table pointer owned by the generated code; the
+// table is created in tables on first use
+void* paradox_memo_get(paradox_memo_set* tables, void** slot, const char* name, uint32_t arity);
+// returns 1 and sets *result when args were seen before
+int paradox_memo_lookup(void* table, const double* args, double* result);
+void paradox_memo_store(void* table, const double* args, double result);
+// hit/miss statistics of every table in tables so far. Nothing prints them
+// on its own: the driver does after --batch, embedders ask for them (see
+// Session::memoReport)
+void paradox_memo_report(paradox_memo_set* tables, FILE* out);
+
+// performance counters around calls into generated code (see --perf-calls
+// and perf.h). Only the outermost call on a thread is measured: a call
+// made from Paradox code (recursion, one counted function calling another)
+// is already inside its caller's numbers and isn't recorded on its own.
+// *slot is the per-function record owned by the generated
+// code; it is created when the first measured call returns.
+void paradox_perf_enter(void);
+void paradox_perf_exit(void** slot, const char* name);
+// calls and counter totals of every function so far, also printed at exit
+void paradox_perf_report(FILE* out);
+
+// parallel loops (pcycle). An outlined loop body runs iterations [lo, hi)
+// with env holding the captured variables, and folds its reductions into
+// red[0..nred), which come in set to the identity of their operator.
+typedef void (*paradox_pfor_body)(const double* env, int64_t lo, int64_t hi, double* red);
+// runs body over [0, count) on the work-stealing pool. red holds the value
+// of every reduction variable before the loop and gets the combined result;
+// ops[k] is '+', '*', '<' (min) or '>' (max).
+void paradox_pfor(paradox_pfor_body body, const double* env, int64_t count,
+                  uint32_t nred, const char* ops, double* red);
+
+}
+
+struct RuntimeSymbol {
+    const char* name;
+    void* addr;
+};
+
+// null terminated list of every runtime entry point
+const RuntimeSymbol* runtimeSymbols();
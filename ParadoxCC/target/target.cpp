@@ -0,0 +1,146 @@
+#include "target.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#if __has_include("llvm/TargetParser/Host.h")
+#include "llvm/TargetParser/Host.h"
+#else
+#include "llvm/Support/Host.h"
+#endif
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+llvm::FastMathFlags fastMathFlags(const FPOptions& fp){
+    llvm::FastMathFlags fmf;
+    if(fp.Fast){
+        fmf.setFast();
+        return fmf;
+    }
+    if(fp.Reassoc) fmf.setAllowReassoc();
+    if(fp.Contract) fmf.setAllowContract();
+    if(fp.NoNaNs) fmf.setNoNaNs();
+    return fmf;
+}
+
+void applyFPAttributes(const FPOptions& fp, llvm::Function& fn){
+    if(fp.Fast){
+        fn.addFnAttr("unsafe-fp-math", "true");
+        fn.addFnAttr("no-infs-fp-math", "true");
+        fn.addFnAttr("no-signed-zeros-fp-math", "true");
+        fn.addFnAttr("approx-func-fp-math", "true");
+    }
+    if(fp.Fast || fp.NoNaNs)
+        fn.addFnAttr("no-nans-fp-math", "true");
+    if(fp.Fast || fp.Contract)
+        fn.addFnAttr("less-precise-fpmad", "true");
+}
+
+void applyFPOptions(const FPOptions& fp, llvm::TargetOptions& opts){
+    if(fp.Fast){
+        opts.UnsafeFPMath = true;
+        opts.NoInfsFPMath = true;
+        opts.NoSignedZerosFPMath = true;
+        opts.ApproxFuncFPMath = true;
+    }
+    if(fp.Fast || fp.NoNaNs)
+        opts.NoNaNsFPMath = true;
+    if(fp.Fast || fp.Contract)
+        opts.AllowFPOpFusion = llvm::FPOpFusion::Fast;
+}
+
+// the native target is all we generate code for
+static void initNativeTarget(){
+    static std::once_flag ready;
+    std::call_once(ready, []{
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        llvm::InitializeNativeTargetAsmParser();
+    });
+}
+
+static const llvm::Target* lookupHostTarget(std::string& triple){
+    initNativeTarget();
+    triple = llvm::sys::getDefaultTargetTriple();
+    std::string err;
+    const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, err);
+    if(!target)
+        std::cerr << "No target for " << triple << ": " << err << "\n";
+    return target;
+}
+
+static std::string hostFeatures(){
+    std::vector<std::string> list;
+#if LLVM_VERSION_MAJOR >= 19
+    for(auto& f : llvm::sys::getHostCPUFeatures())
+        list.push_back((f.second ? "+" : "-") + f.first().str());
+#else
+    llvm::StringMap<bool> features;
+    if(llvm::sys::getHostCPUFeatures(features))
+        for(auto& f : features)
+            list.push_back((f.second ? "+" : "-") + f.first().str());
+#endif
+    // StringMap order is arbitrary, keep the attribute stable
+    std::sort(list.begin(), list.end());
+    std::string out;
+    for(auto& f : list)
+        out += (out.empty() ? "" : ",") + f;
+    return out;
+}
+
+bool makeTargetSpec(const std::string& cpu, const std::string& attrs, TargetSpec& out){
+    out = TargetSpec();
+    if(cpu == "native"){
+        out.CPU = llvm::sys::getHostCPUName().str();
+        out.Features = hostFeatures();
+    }
+    else
+        out.CPU = cpu;
+
+    // -mattr=avx2,-fma: a bare name means +name
+    for(size_t pos = 0; pos < attrs.size();){
+        size_t comma = std::min(attrs.find(',', pos), attrs.size());
+        std::string f = attrs.substr(pos, comma - pos);
+        pos = comma + 1;
+        if(f.empty()) continue;
+        if(f[0] != '+' && f[0] != '-') f = "+" + f;
+        out.Features += (out.Features.empty() ? "" : ",") + f;
+    }
+
+    if(out.CPU.empty()) return true;
+    std::string triple;
+    const llvm::Target* target = lookupHostTarget(triple);
+    if(!target) return false;
+    std::unique_ptr<llvm::MCSubtargetInfo> sti(
+        target->createMCSubtargetInfo(triple, "", ""));
+    if(!sti || !sti->isCPUStringValid(out.CPU)){
+        std::cerr << "Unknown CPU '" << out.CPU << "' for " << triple << "\n";
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<llvm::TargetMachine> createTargetMachine(const TargetSpec& spec,
+                                                         const FPOptions& fp){
+    std::string triple;
+    const llvm::Target* target = lookupHostTarget(triple);
+    if(!target) return nullptr;
+    llvm::TargetOptions opts;
+    applyFPOptions(fp, opts);
+    return std::unique_ptr<llvm::TargetMachine>(target->createTargetMachine(
+        triple, spec.CPU.empty() ? "generic" : spec.CPU, spec.Features, opts,
+        llvm::Reloc::PIC_));
+}
+
+void applyTargetAttributes(const TargetSpec& spec, llvm::Function& fn){
+    if(!spec.CPU.empty())
+        fn.addFnAttr("target-cpu", spec.CPU);
+    if(!spec.Features.empty())
+        fn.addFnAttr("target-features", spec.Features);
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <memory>
+#include <string>
+
+namespace llvm {
+class FastMathFlags;
+class Function;
+class Module;
+class TargetMachine;
+class TargetOptions;
+}
+
+// Floating point semantics of generated code.
+// The default is strict IEEE: every operation rounds in source order, no
+// FMA contraction, NaNs and infinities are honoured, so results match C
+// at -O2 bit for bit. Each flag gives some of that up for speed; mostly
+// reductions gain, since reassociation lets the vectorizer split a sum over
+// several accumulators.
+struct FPOptions {
+    bool Reassoc = false;   // --reassoc: (a + b) + c may become a + (b + c)
+    bool Contract = false;  // --fp-contract: a * b + c may become one fma
+    bool NoNaNs = false;    // --no-nans: assume no operand or result is NaN
+    bool Fast = false;      // --fast-math: all of the above, plus no infs,
+                            // no signed zeros, reciprocals and approximations
+    // --precision=f32: numbers are floats inside every function, twice the
+    // SIMD lanes and half the bytes per value. Not a shortcut like the
+    // others, each operation still rounds exactly, just to float. Public
+    // signatures, externs and the runtime stay double (see CodeGen).
+    bool F32 = false;
+
+    bool any() const { return Reassoc || Contract || NoNaNs || Fast; }
+};
+
+// flags for every FP instruction (IRBuilder::setFastMathFlags)
+llvm::FastMathFlags fastMathFlags(const FPOptions& fp);
+
+// the same choice as function attributes. They travel with the IR through
+// bitcode, ThinLTO and the JIT, and the backend reads them per function.
+void applyFPAttributes(const FPOptions& fp, llvm::Function& fn);
+
+// and as TargetMachine options, for targets created here
+void applyFPOptions(const FPOptions& fp, llvm::TargetOptions& opts);
+
+// Target CPU and features (-march / -mcpu / -mattr).
+// Empty means the host's default triple with a generic CPU, i.e. code that
+// runs on any machine of this architecture. The JIT always runs on the
+// host and treats an empty spec as "this machine".
+struct TargetSpec {
+    std::string CPU;        // e.g. "skylake", "generic"
+    std::string Features;   // e.g. "+avx2,+fma,-avx512f"
+
+    bool empty() const { return CPU.empty() && Features.empty(); }
+};
+
+// builds a spec from the -march/-mcpu and -mattr values. cpu "native"
+// becomes the host CPU with every feature the host reports; attrs is a
+// comma separated list of +feature / -feature applied on top. Returns
+// false (and reports) for a CPU this target doesn't know.
+bool makeTargetSpec(const std::string& cpu, const std::string& attrs, TargetSpec& out);
+
+// a TargetMachine for the host triple configured by spec and fp,
+// nullptr (and reports) if the target isn't available
+std::unique_ptr<llvm::TargetMachine> createTargetMachine(const TargetSpec& spec,
+                                                         const FPOptions& fp);
+
+// target-cpu / target-features on fn, what the backend and the inliner
+// look at per function; nothing for an empty spec
+void applyTargetAttributes(const TargetSpec& spec, llvm::Function& fn);